@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include <glm/glm.hpp>
+
+#include "context.hpp"
+#include "mesh.hpp"
+#include "pipeline.hpp"
+
+namespace sr {
+
+//A recorded draw of one submesh with the snapshot of its shading settings
+struct DrawCommand {
+	const Mesh *m_mesh = nullptr;
+	Pipeline::ptr m_pipelineHandler = nullptr;	//Cloned while recording, so that draws could be executed together
+	Context m_context;
+
+	//Optional world space vertices shared among views, with vertex shader already executed
+	const std::vector<Pipeline::VertexData> *m_sharedVertices = nullptr;
+	glm::mat4 m_viewProjectMatrix = glm::mat4(1.0f);	//Applied to the clip position of the shared vertices
+
+	bool m_deferred = false;	//Output to G-buffer, shaded by the lighting pass
+
+	unsigned int getFaceNum() const { return m_mesh->getIndices().size() / 3; }
+
+	//Note: order-independent transparency must be shaded after the opaque faces
+	bool isOITDraw() const { return m_context.m_OITMode != OITMode::OIT_DISABLE; }
+};
+
+//Draw list of a whole frame, which is executed as a single task graph by the renderer
+class CommandBuffer final {
+public:
+	typedef std::shared_ptr<CommandBuffer> ptr;
+
+	void record(const DrawCommand &cmd) { m_commands.push_back(cmd); }
+	void clear() { m_commands.clear(); }
+
+	bool empty() const { return m_commands.empty(); }
+	size_t size() const { return m_commands.size(); }
+	const std::vector<DrawCommand> &getCommands() const { return m_commands; }
+
+	//Frame lighting for light culling
+	//Note: should be the same lights (in the same order) as the pipelines of the recorded draws
+	void setLights(const std::vector<Light::ptr> &lights, const glm::mat4 &viewProjectMatrix) {
+		m_lights = lights;
+		m_viewProjectMatrix = viewProjectMatrix;
+	}
+	const std::vector<Light::ptr> &getLights() const { return m_lights; }
+	const glm::mat4 &getViewProjectMatrix() const { return m_viewProjectMatrix; }
+
+	void setShadingMode(ShadingMode mode) { m_shadingMode = mode; }
+	ShadingMode getShadingMode() const { return m_shadingMode; }
+
+private:
+	std::vector<DrawCommand> m_commands;
+	std::vector<Light::ptr> m_lights;
+	glm::mat4 m_viewProjectMatrix = glm::mat4(1.0f);
+	ShadingMode m_shadingMode = ShadingMode::FORWARD_SHADING;
+};
+
+} // namespace sr
@@ -15,6 +15,22 @@ namespace sr {
 		LINEAR
 	};
 
+	//Taps along the major axis of the pixel footprint in uv space at most, for the surfaces at grazing angles
+	enum class TextureAnisotropy {
+		ANISOTROPY_1X,	//Isotropic filtering only
+		ANISOTROPY_2X,
+		ANISOTROPY_4X,
+		ANISOTROPY_8X,
+		ANISOTROPY_16X
+	};
+
+	enum class TextureCompressionMode {
+		NONE,
+		BC1,
+		BC3,
+		AUTO	//BC3 for the images with translucent texels, BC1 otherwise
+	};
+
 
 	enum class CullFaceMode {
 		CULL_DISABLE,
@@ -41,6 +57,27 @@ namespace sr {
 		ALPHA_TO_COVERAGE
 	};
 
+	//Order-independent transparency, replaces ordered alpha blending if enabled
+	enum class OITMode
+	{
+		OIT_DISABLE,
+		OIT_WEIGHTED_BLENDED,	//Weighted blended accumulation, cheap but approximate
+		OIT_K_BUFFER			//Bounded per-pixel fragment list, higher quality
+	};
+
+
+	enum class ShadingMode
+	{
+		FORWARD_SHADING,
+		DEFERRED_SHADING	//Lit opaque draws are shaded by a screen space lighting pass over the G-buffer
+	};
+
+	//Fragment shader invocations per 2x2 quad, depth testing and coverage stay per sample anyway
+	enum class ShadingRate
+	{
+		SHADING_RATE_1X1,	//One invocation per fragment
+		SHADING_RATE_2X2	//Coarse shading: one invocation per quad, broadcast to the covered fragments
+	};
 
 	enum class LightingMode
 	{
@@ -54,6 +91,8 @@ namespace sr {
 		DepthTestMode m_DepthTestMode = DepthTestMode::DEPTH_TEST_ENABLE;
 		DepthWriteMode m_DepthWriteMode	= DepthWriteMode::DEPTH_WRITE_ENABLE;
 		AlphaBlendingMode m_AlphaBlendMode = AlphaBlendingMode::ALPHA_DISABLE;
+		OITMode m_OITMode = OITMode::OIT_DISABLE;
+		ShadingRate m_ShadingRate = ShadingRate::SHADING_RATE_1X1;
 	};
 
 } // namespace sr
\ No newline at end of file
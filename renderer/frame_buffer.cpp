@@ -47,6 +47,8 @@ void FrameBuffer::clearColor(const glm::vec4 &color)
 	{
 		m_colorBuffer[index] = clearColor;
 	});
+
+	clearOIT();
 }
 
 void FrameBuffer::clearColorAndDepth(const glm::vec4 &color, const float &depth)
@@ -62,6 +64,39 @@ void FrameBuffer::clearColorAndDepth(const glm::vec4 &color, const float &depth)
 		m_depthBuffer[index] = depth;
 		m_colorBuffer[index] = clearColor;
 	});
+
+	clearOIT();
+}
+
+void FrameBuffer::clearRect(const glm::ivec2 &rectMin, const glm::ivec2 &rectMax, const glm::vec4 *color, const float *depth)
+{
+	PixelRGBA clearColor = k_Black;
+	if (color != nullptr)
+	{
+		clearColor[0] = static_cast<unsigned char>(255 * color->x);
+		clearColor[1] = static_cast<unsigned char>(255 * color->y);
+		clearColor[2] = static_cast<unsigned char>(255 * color->z);
+		clearColor[3] = static_cast<unsigned char>(255 * color->w);
+	}
+
+	for (int y = rectMin.y; y <= rectMax.y; ++y)
+	{
+		for (int x = rectMin.x; x <= rectMax.x; ++x)
+		{
+			const size_t index = y * m_width + x;
+			if (depth != nullptr)
+				m_depthBuffer[index] = *depth;
+			if (color != nullptr)
+				m_colorBuffer[index] = clearColor;
+			//Note: the other tiles keep their OIT attachments, which are cleared with the whole frame
+			if (color != nullptr && m_oitEnabled)
+			{
+				m_oitAccum[index] = glm::vec4(0.0f);
+				m_oitRevealage[index] = 1.0f;
+				m_kBuffer[index].m_count = 0;
+			}
+		}
+	}
 }
 
 void FrameBuffer::writeDepth(const uint &x, const uint &y, const uint &i, const float &value)
@@ -153,33 +188,335 @@ void FrameBuffer::writeDepthWithMask(const uint &x, const uint &y, const DepthPi
 	}
 }
 
+void FrameBuffer::enableOIT()
+{
+	if (m_kBuffer.empty())
+	{
+		m_oitAccum.resize(m_width * m_height, glm::vec4(0.0f));
+		m_oitRevealage.resize(m_width * m_height, 1.0f);
+		m_kBuffer.resize(m_width * m_height);
+	}
+	m_oitEnabled = true;
+}
+
+void FrameBuffer::clearOIT()
+{
+	//Note: the attachments are untouched unless OIT was used in last frame
+	if (!m_oitEnabled)
+		return;
+
+	parallelFor((size_t)0, (size_t)(m_width * m_height), [&](const size_t &index)
+	{
+		m_oitAccum[index] = glm::vec4(0.0f);
+		m_oitRevealage[index] = 1.0f;
+		m_kBuffer[index].m_count = 0;
+	});
+	m_oitEnabled = false;
+}
+
+//Average depth and coverage ratio of the covered sampling points
+static inline float coveredFragment(const DepthPixelSampler &depth, const MaskPixelSampler &mask, float &coverageRatio)
+{
+	float sum = 0.0f;
+	int count = 0;
+	for (int s = 0; s < mask.getSamplingNum(); ++s)
+	{
+		if (mask[s] == 1)
+		{
+			sum += depth[s];
+			++count;
+		}
+	}
+	coverageRatio = count / (float)mask.getSamplingNum();
+	return count == 0 ? 0.0f : sum / count;
+}
+
+void FrameBuffer::writeColorWeightedBlended(const uint &x, const uint &y, const glm::vec4 &color, 
+	const DepthPixelSampler &depth, const MaskPixelSampler &mask)
+{
+	if (x >= m_width || y >= m_height)
+		return;
+
+	float coverageRatio;
+	float rhw = coveredFragment(depth, mask, coverageRatio);
+	float alpha = glm::clamp(color.a, 0.0f, 1.0f) * coverageRatio;
+	if (alpha <= 0.0f)
+		return;
+
+	//Depth weight function with view space depth
+	//Refs: McGuire and Bavoil, Weighted Blended Order-Independent Transparency, eq.(9)
+	float z = 1.0f / glm::max(rhw, 1e-6f);
+	float weight = alpha * glm::clamp(10.0f / (1e-5f + glm::pow(z / 5.0f, 2.0f) + glm::pow(z / 200.0f, 6.0f)), 1e-2f, 3e3f);
+
+	int index = y * m_width + x;
+	m_oitAccum[index] += glm::vec4(glm::vec3(color) * alpha, alpha) * weight;
+	m_oitRevealage[index] *= (1.0f - alpha);
+}
+
+void FrameBuffer::writeColorKBuffer(const uint &x, const uint &y, const glm::vec4 &color, 
+	const DepthPixelSampler &depth, const MaskPixelSampler &mask)
+{
+	if (x >= m_width || y >= m_height)
+		return;
+
+	float coverageRatio;
+	OITFragment frag;
+	frag.m_depth = coveredFragment(depth, mask, coverageRatio);
+	frag.m_color = glm::vec4(glm::vec3(color), glm::clamp(color.a, 0.0f, 1.0f) * coverageRatio);
+	if (frag.m_color.a <= 0.0f)
+		return;
+
+	insertKBufferFragment(m_kBuffer[y * m_width + x], frag);
+}
+
+//Front-to-back over operator, the merged fragment takes the depth of the front one
+static OITFragment mergeOITFragments(const OITFragment &front, const OITFragment &back)
+{
+	OITFragment merged;
+	float alpha = front.m_color.a + back.m_color.a * (1.0f - front.m_color.a);
+	glm::vec3 premul = glm::vec3(front.m_color) * front.m_color.a 
+		+ glm::vec3(back.m_color) * back.m_color.a * (1.0f - front.m_color.a);
+	merged.m_depth = front.m_depth;
+	merged.m_color = glm::vec4(premul / glm::max(alpha, 1e-5f), alpha);
+	return merged;
+}
+
+void insertKBufferFragment(KBufferPixel &pixel, const OITFragment &frag)
+{
+	//Insertion sorting from near to far into k + 1 slots
+	std::array<OITFragment, k_OITLayers + 1> sorted;
+	const auto &frags = pixel.m_fragments;
+	int pos = pixel.m_count;
+	while (pos > 0 && frags[pos - 1].m_depth < frag.m_depth)
+	{
+		sorted[pos] = frags[pos - 1];
+		--pos;
+	}
+	sorted[pos] = frag;
+	for (int i = 0; i < pos; ++i)
+	{
+		sorted[i] = frags[i];
+	}
+	int count = pixel.m_count + 1;
+
+	//Overflow: merge the farthest two fragments to keep the list bounded
+	if (count > k_OITLayers)
+	{
+		sorted[k_OITLayers - 1] = mergeOITFragments(sorted[k_OITLayers - 1], sorted[k_OITLayers]);
+		count = k_OITLayers;
+	}
+
+	std::copy(sorted.begin(), sorted.begin() + count, pixel.m_fragments.begin());
+	pixel.m_count = count;
+}
+
+void FrameBuffer::enableGBuffer()
+{
+	if (m_gbuffer.empty())
+	{
+		m_gbuffer.resize(m_width * m_height);
+	}
+}
+
+void FrameBuffer::writeGBufferWithMask(const uint &x, const uint &y, const GBufferTexel &texel, const MaskPixelSampler &mask)
+{
+	if (x >= m_width || y >= m_height)
+		return;
+	bool empty = true;
+	for (int s = 0; s < mask.getSamplingNum(); ++s)
+		empty = empty && mask[s] == 0;
+	if (empty)
+		return;
+
+	//The fragment only takes the sampling points it won, the kept surfaces give them up
+	auto &dst = m_gbuffer[y * m_width + x];
+	int slot = -1, fewest = 0, fewestNum = mask.getSamplingNum() + 1;
+	for (int i = 0; i < k_GBufferSurfaces; ++i)
+	{
+		auto &coverage = dst.m_surfaces[i].m_coverage;
+		int num = 0;
+		for (int s = 0; s < mask.getSamplingNum(); ++s)
+		{
+			coverage[s] = mask[s] ? 0 : coverage[s];
+			num += coverage[s] != 0;
+		}
+		if (num == 0)
+			slot = i;
+		else if (num < fewestNum)
+		{
+			fewest = i;
+			fewestNum = num;
+		}
+	}
+
+	MaskPixelSampler coverage = mask;
+	if (slot < 0)
+	{
+		//Overflow: the surface covering the fewest sampling points is replaced
+		slot = fewest;
+		for (int s = 0; s < mask.getSamplingNum(); ++s)
+			coverage[s] |= dst.m_surfaces[slot].m_coverage[s];
+	}
+	dst.m_surfaces[slot] = texel;
+	dst.m_surfaces[slot].m_coverage = coverage;
+}
+
+void FrameBuffer::compositeOIT(const size_t &index, ColorPixelSampler &pixel) const
+{
+	glm::vec3 dst = glm::vec3(pixel[0][0], pixel[0][1], pixel[0][2]) / 255.0f;
+
+	//Weighted blended
+	const auto &accum = m_oitAccum[index];
+	const float &revealage = m_oitRevealage[index];
+	if (revealage < 1.0f)
+	{
+		dst = glm::vec3(accum) / glm::max(accum.a, 1e-5f) * (1.0f - revealage) + dst * revealage;
+	}
+
+	//K-buffer, from far to near
+	const auto &kpixel = m_kBuffer[index];
+	for (int k = kpixel.m_count - 1; k >= 0; --k)
+	{
+		const auto &src = kpixel.m_fragments[k].m_color;
+		dst = glm::vec3(src) * src.a + dst * (1.0f - src.a);
+	}
+
+	dst = glm::clamp(dst, glm::vec3(0.0f), glm::vec3(1.0f));
+	pixel[0][0] = static_cast<unsigned char>(dst.x * 255);//RED
+	pixel[0][1] = static_cast<unsigned char>(dst.y * 255);//GREEN
+	pixel[0][2] = static_cast<unsigned char>(dst.z * 255);//BLUE
+}
+
+void FrameBuffer::enableTemporalCache(const FrameBuffer *history, const glm::mat4 &historyViewProject, 
+	const unsigned int &frameIndex)
+{
+	//Empty the cache of this frame
+	if (m_temporalCache.size() != m_width * m_height)
+	{
+		m_temporalCache.resize(m_width * m_height);
+	}
+	parallelFor((size_t)0, (size_t)(m_width * m_height), [&](const size_t &index)
+	{
+		m_temporalCache[index].m_depth = 0.0f;
+	});
+
+	//Note: only the history of the same size with a valid cache could be reprojected
+	const bool validHistory = history != nullptr && history != this && history->m_width == m_width && 
+		history->m_height == m_height && history->m_temporalCache.size() == m_temporalCache.size();
+	m_history = validHistory ? history : nullptr;
+	m_historyViewProject = historyViewProject;
+	m_staleTiles = nullptr;
+	m_frameIndex = frameIndex;
+	m_temporalEnabled = true;
+}
+
+bool FrameBuffer::reprojectColor(const uint &x, const uint &y, const glm::vec3 &worldPos, glm::vec4 &color) const
+{
+	if (m_history == nullptr)
+		return false;
+
+	//Rotating subset of the quads to be reshaded, so that the view-dependent shading converges
+	if (((x >> 1) + (y >> 1) * 5 + m_frameIndex) % k_TemporalRefreshPeriod == 0)
+		return false;
+	if (m_staleTiles != nullptr && (*m_staleTiles)[(y / m_staleTileSize) * m_staleTilesX + x / m_staleTileSize] != 0)
+		return false;
+
+	//Reprojection into the screen of last frame
+	glm::vec4 clipPos = m_historyViewProject * glm::vec4(worldPos, 1.0f);
+	if (clipPos.w <= 0.0f)
+		return false;
+	const float rhw = 1.0f / clipPos.w;
+	const float sx = (clipPos.x * rhw * 0.5f + 0.5f) * m_width;
+	const float sy = (0.5f - clipPos.y * rhw * 0.5f) * m_height;
+	if (sx < 0.0f || sy < 0.0f || sx >= m_width || sy >= m_height)
+		return false;
+
+	//Same surface if the depth of history is close to the reprojected one
+	const TemporalTexel &texel = m_history->m_temporalCache[static_cast<uint>(sy) * m_width + static_cast<uint>(sx)];
+	if (texel.m_depth <= 0.0f || glm::abs(texel.m_depth - rhw) > 0.01f * rhw)
+		return false;
+
+	color = texel.m_color;
+	return true;
+}
+
+void FrameBuffer::writeTemporalCache(const uint &x, const uint &y, const glm::vec4 &color, const DepthPixelSampler &depth, 
+	const MaskPixelSampler &mask)
+{
+	if (x >= m_width || y >= m_height)
+		return;
+	float nearest = 0.0f;
+	for (int s = 0; s < mask.getSamplingNum(); ++s)
+	{
+		if (mask[s] == 1)
+			nearest = glm::max(nearest, depth[s]);
+	}
+	//Note: fragments passing the depth test are nearer, so the last written one is the visible surface
+	TemporalTexel &texel = m_temporalCache[y * m_width + x];
+	texel.m_color = color;
+	texel.m_depth = nearest;
+}
+
 const ColorBuffer &FrameBuffer::resolve() {
-	//MSAA Resolve according to coverage mask
-	//Refs: http://www.zwqxin.com/archives/opengl/talk-about-alpha-to-coverage.html
 	parallelFor((size_t)0, (size_t)(m_width * m_height), [&](const size_t &index) {
-		auto &currentSamper = m_colorBuffer[index];
-		glm::vec4 sum(0.0f);
-		//Average the sampling color for each shaded pixel.
-#pragma unroll(4)
-		for (int s = 0; s < currentSamper.getSamplingNum(); ++s) {
-			{
-				sum.x += currentSamper[s][0];//RED
-				sum.y += currentSamper[s][1];//GREEN
-				sum.z += currentSamper[s][2];//BLUE
-				sum.w += currentSamper[s][3];//ALPHA
-			}
-		}
-		sum /= currentSamper.getSamplingNum();
-		PixelRGBA value;
-		value[0] = static_cast<unsigned char>((sum.x));
-		value[1] = static_cast<unsigned char>((sum.y));
-		value[2] = static_cast<unsigned char>((sum.z));
-		value[3] = static_cast<unsigned char>((sum.w));
-		currentSamper[0] = value;
-		
+		resolvePixel(index);
 	}, ExecutionPolicy::PARALLEL);
 	
 	return m_colorBuffer;
 }
 
+void FrameBuffer::resolveRect(const glm::ivec2 &rectMin, const glm::ivec2 &rectMax)
+{
+	for (int y = rectMin.y; y <= rectMax.y; ++y)
+	{
+		for (int x = rectMin.x; x <= rectMax.x; ++x)
+		{
+			resolvePixel(y * m_width + x);
+		}
+	}
+}
+
+void FrameBuffer::copyRect(const FrameBuffer &src, const glm::ivec2 &rectMin, const glm::ivec2 &rectMax)
+{
+	if (src.m_width != m_width || src.m_height != m_height)
+		return;
+	for (int y = rectMin.y; y <= rectMax.y; ++y)
+	{
+		const size_t begin = y * m_width + rectMin.x, end = y * m_width + rectMax.x + 1;
+		std::copy(src.m_colorBuffer.begin() + begin, src.m_colorBuffer.begin() + end, m_colorBuffer.begin() + begin);
+		std::copy(src.m_depthBuffer.begin() + begin, src.m_depthBuffer.begin() + end, m_depthBuffer.begin() + begin);
+	}
+}
+
+void FrameBuffer::resolvePixel(const size_t &index)
+{
+	//MSAA Resolve according to coverage mask
+	//Refs: http://www.zwqxin.com/archives/opengl/talk-about-alpha-to-coverage.html
+	auto &currentSamper = m_colorBuffer[index];
+	glm::vec4 sum(0.0f);
+	//Average the sampling color for each shaded pixel.
+#pragma unroll(4)
+	for (int s = 0; s < currentSamper.getSamplingNum(); ++s) {
+		{
+			sum.x += currentSamper[s][0];//RED
+			sum.y += currentSamper[s][1];//GREEN
+			sum.z += currentSamper[s][2];//BLUE
+			sum.w += currentSamper[s][3];//ALPHA
+		}
+	}
+	sum /= currentSamper.getSamplingNum();
+	PixelRGBA value;
+	value[0] = static_cast<unsigned char>((sum.x));
+	value[1] = static_cast<unsigned char>((sum.y));
+	value[2] = static_cast<unsigned char>((sum.z));
+	value[3] = static_cast<unsigned char>((sum.w));
+	currentSamper[0] = value;
+
+	//Composite order-independent transparency over the resolved color
+	if (m_oitEnabled)
+	{
+		compositeOIT(index, currentSamper);
+	}
+}
+
 } // namespace sr
\ No newline at end of file
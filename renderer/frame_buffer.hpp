@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <memory>
 
@@ -11,6 +12,46 @@ namespace sr {
 
 using uint = unsigned int;
 
+//Order-independent transparency attachments
+constexpr int k_OITLayers = 4;	//Max transparent layers kept per pixel by k-buffer
+struct OITFragment {
+	float m_depth;				//Note: reversed depth, the larger the nearer
+	glm::vec4 m_color;
+};
+struct KBufferPixel {
+	std::array<OITFragment, k_OITLayers> m_fragments;	//Sorted from near to far
+	int m_count = 0;
+};
+//Insert the fragment in depth order, the farthest two are merged once the layers overflow
+void insertKBufferFragment(KBufferPixel &pixel, const OITFragment &frag);
+
+//G-buffer attachment for deferred shading
+struct GBufferTexel {
+	glm::vec3 m_pos;		//World space position
+	glm::vec3 m_nor;		//World space normal
+	glm::vec3 m_ambient;
+	glm::vec3 m_diffuse;	//Diffuse albedo multiplied by diffuse coefficient
+	glm::vec3 m_specular;
+	glm::vec3 m_emission;
+	float m_shininess;
+	float m_alpha;
+	MaskPixelSampler m_coverage = 0;	//Sampling points covered by the surface, none -> empty texel
+};
+
+//Surfaces kept for each pixel, so that the edge between two surfaces is lit exactly
+//Note: a third surface takes the sampling points of the one covering the fewest
+constexpr int k_GBufferSurfaces = 2;
+struct GBufferPixel {
+	std::array<GBufferTexel, k_GBufferSurfaces> m_surfaces;
+};
+
+//Temporal reprojection cache, the shaded color of the visible opaque surface of a pixel
+constexpr int k_TemporalRefreshPeriod = 8;	//Each quad is reshaded at least once per period of frames
+struct TemporalTexel {
+	glm::vec4 m_color;
+	float m_depth = 0.0f;		//Note: reversed depth of the nearest covered sample, 0 -> empty texel
+};
+
 class FrameBuffer final {
 public:
 	typedef std::shared_ptr<FrameBuffer> ptr;
@@ -22,6 +63,8 @@ public:
 	void clearDepth(const float &depth);
 	void clearColor(const glm::vec4 &color);
 	void clearColorAndDepth(const glm::vec4 &color, const float &depth);
+	//Clear the rectangle [rectMin, rectMax] only, e.g. the redrawn tiles (nullptr -> not cleared)
+	void clearRect(const glm::ivec2 &rectMin, const glm::ivec2 &rectMax, const glm::vec4 *color, const float *depth);
 
 	int getWidth() const { return m_width; }
 	int getHeight() const { return m_height; }
@@ -37,13 +80,69 @@ public:
 	void writeColorWithMaskAlphaBlending(const uint &x, const uint &y, const glm::vec4 &color, const MaskPixelSampler &mask);
 	void writeDepthWithMask(const uint &x, const uint &y, const DepthPixelSampler &depth, const MaskPixelSampler &mask);
 
+	// OIT
+	//Note: must be called before drawing transparent faces of current frame
+	void enableOIT();
+	void writeColorWeightedBlended(const uint &x, const uint &y, const glm::vec4 &color, const DepthPixelSampler &depth, const MaskPixelSampler &mask);
+	void writeColorKBuffer(const uint &x, const uint &y, const glm::vec4 &color, const DepthPixelSampler &depth, const MaskPixelSampler &mask);
+
+	// Deferred shading
+	//Note: the G-buffer is emptied by the lighting pass, no need to clear
+	void enableGBuffer();
+	void writeGBufferWithMask(const uint &x, const uint &y, const GBufferTexel &texel, const MaskPixelSampler &mask);
+	GBufferPixel &getGBufferPixel(const uint &x, const uint &y) { return m_gbuffer[y * m_width + x]; }
+
+	// Temporal reprojection
+	//Note: must be called before drawing each frame, history is the target of last frame (nullptr -> nothing reused)
+	void enableTemporalCache(const FrameBuffer *history, const glm::mat4 &historyViewProject, const unsigned int &frameIndex);
+	void disableTemporalCache() { m_temporalEnabled = false; m_history = nullptr; m_staleTiles = nullptr; }
+	//Tiles whose shading changed since last frame, e.g. lit by a moved light, are not reprojected (nullptr -> none)
+	//Note: must be set after enableTemporalCache, the tiles are owned by the caller and kept while drawing
+	void setTemporalStaleTiles(const std::vector<unsigned char> *tiles, const int &tileSize, const int &tilesX)
+	{
+		m_staleTiles = tiles; m_staleTileSize = tileSize; m_staleTilesX = tilesX;
+	}
+	bool isTemporalCacheEnabled() const { return m_temporalEnabled; }
+	//Fetch the shading of last frame at the world position of the fragment (x, y)
+	//Return false if disoccluded, i.e. the depth in history differs, or if the quad is due for refreshing
+	bool reprojectColor(const uint &x, const uint &y, const glm::vec3 &worldPos, glm::vec4 &color) const;
+	void writeTemporalCache(const uint &x, const uint &y, const glm::vec4 &color, const DepthPixelSampler &depth, const MaskPixelSampler &mask);
+
 	// MSAA 
 	const ColorBuffer &resolve();
+	//Resolve the pixels of the rectangle [rectMin, rectMax] only, e.g. the redrawn tiles
+	void resolveRect(const glm::ivec2 &rectMin, const glm::ivec2 &rectMax);
+
+	//Copy the samples of color and depth in the rectangle from the frame buffer of the same size
+	void copyRect(const FrameBuffer &src, const glm::ivec2 &rectMin, const glm::ivec2 &rectMax);
+
+private:
+	void resolvePixel(const size_t &index);
+	void clearOIT();
+	void compositeOIT(const size_t &index, ColorPixelSampler &pixel) const;
 
 private:
 	DepthBuffer m_depthBuffer;
 	ColorBuffer m_colorBuffer;
 	unsigned int m_width, m_height;
+
+	//OIT attachments, allocated once transparent faces are drawn with OIT
+	bool m_oitEnabled = false;
+	std::vector<glm::vec4> m_oitAccum;		//Weighted premultiplied color and alpha
+	std::vector<float> m_oitRevealage;		//Product of (1 - alpha)
+	std::vector<KBufferPixel> m_kBuffer;
+
+	//G-buffer, allocated once drawing with deferred shading
+	std::vector<GBufferPixel> m_gbuffer;
+
+	//Temporal reprojection cache of this frame and the one of last frame
+	bool m_temporalEnabled = false;
+	std::vector<TemporalTexel> m_temporalCache;
+	const FrameBuffer *m_history = nullptr;
+	glm::mat4 m_historyViewProject = glm::mat4(1.0f);
+	const std::vector<unsigned char> *m_staleTiles = nullptr;
+	int m_staleTileSize = 1, m_staleTilesX = 0;
+	unsigned int m_frameIndex = 0;
 	
 };
 
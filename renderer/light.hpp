@@ -1,11 +1,15 @@
 #pragma once
 
 #include <memory>
+#include <limits>
 
 #include <glm/glm.hpp>
 
 namespace sr {
 
+class Model;
+class ShadowMap;
+
 class Light {
 public:
 	typedef std::shared_ptr<Light> ptr;
@@ -19,8 +23,25 @@ public:
 	virtual float cutoff(const glm::vec3 &lightDir) const = 0;
 	virtual glm::vec3 direction(const glm::vec3 &fragPos) const = 0;
 
+	//Bounding sphere of the lit region, return false if the light affects everywhere
+	virtual bool influenceSphere(glm::vec3 &center, float &radius) const { return false; }
+
+	//Shadow casting
+	//Note: the shadow map is cached and updated by the renderer
+	void setCastShadow(bool cast) { m_castShadow = cast; }
+	bool isCastShadow() const { return m_castShadow; }
+	void setShadowMap(const std::shared_ptr<ShadowMap> &shadowMap) { m_shadowMap = shadowMap; }
+	const std::shared_ptr<ShadowMap> &getShadowMap() const { return m_shadowMap; }
+	//Visible mesh of the light (e.g. the bulb around it), which never shadows its own light
+	//Note: only compared with the casters, the model is not kept alive
+	void setProxyModel(const Model *model) { m_proxyModel = model; }
+	const Model *getProxyModel() const { return m_proxyModel; }
+
 protected:
 	glm::vec3 m_intensity;
+	bool m_castShadow = false;
+	std::shared_ptr<ShadowMap> m_shadowMap = nullptr;
+	const Model *m_proxyModel = nullptr;
 
 };
 
@@ -29,7 +50,10 @@ public:
 	typedef std::shared_ptr<PointLight> ptr;
 
 	PointLight(const glm::vec3 &intensity, const glm::vec3 &lightPos, const glm::vec3 &atten)
-		: Light(intensity), m_lightPos(lightPos), m_attenuation(atten) { }
+		: Light(intensity), m_lightPos(lightPos), m_attenuation(atten) 
+	{ 
+		m_radius = influenceRadius(intensity, atten);
+	}
 
 	virtual float attenuation(const glm::vec3 &fragPos) const override {
 		float distance = glm::length(m_lightPos - fragPos);
@@ -42,11 +66,32 @@ public:
 
 	virtual float cutoff(const glm::vec3 &lightDir) const override { return 1.0f; }
 
+	virtual bool influenceSphere(glm::vec3 &center, float &radius) const override {
+		center = m_lightPos;
+		radius = m_radius;
+		return m_radius < std::numeric_limits<float>::max();
+	}
+
 	glm::vec3 &getLightPos() { return m_lightPos; }
+	const glm::vec3 &getLightPos() const { return m_lightPos; }
+	const glm::vec3 &getAttenuation() const { return m_attenuation; }
+
+	//Distance where the attenuated intensity drops below 1/256, i.e. invisible in 8-bit color
+	//Solve: kc + kl * d + kq * d^2 = 256 * max(intensity)
+	static float influenceRadius(const glm::vec3 &intensity, const glm::vec3 &atten) {
+		const float threshold = 256.0f * glm::max(intensity.x, glm::max(intensity.y, intensity.z));
+		if (atten.z > 0.0f)
+			return glm::max((-atten.y + glm::sqrt(atten.y * atten.y - 4.0f * atten.z * (atten.x - threshold))) / (2.0f * atten.z), 0.0f);
+		else if (atten.y > 0.0f)
+			return glm::max((threshold - atten.x) / atten.y, 0.0f);
+		//Constant attenuation, no bound at all
+		return std::numeric_limits<float>::max();
+	}
 
 private:
 	glm::vec3 m_lightPos; // world space
 	glm::vec3 m_attenuation;
+	float m_radius;		  // influence radius
 
 };
 
@@ -60,11 +105,14 @@ public:
 
 	virtual float cutoff(const glm::vec3 &lightDir) const override {
 		float theta = glm::dot(lightDir, -m_spotDir);
-		static const float epsilon = m_innerCutoff - m_outerCutoff;
+		const float epsilon = m_innerCutoff - m_outerCutoff;
 		return glm::clamp((theta - m_outerCutoff) / epsilon, 0.0f, 1.0f);
 	}
 
 	glm::vec3 &getSpotDirection() { return m_spotDir; }
+	const glm::vec3 &getSpotDirection() const { return m_spotDir; }
+	const float &getInnerCutoff() const { return m_innerCutoff; }
+	const float &getOuterCutoff() const { return m_outerCutoff; }
 
 private:
 	glm::vec3 m_spotDir;
@@ -85,6 +133,8 @@ public:
 	virtual glm::vec3 direction(const glm::vec3 &fragPos) const override { return m_lightDir; }
 	virtual float cutoff(const glm::vec3 &lightDir) const override { return 1.0f; }
 
+	const glm::vec3 &getLightDir() const { return m_lightDir; }
+
 private:
 	glm::vec3 m_lightDir;
 };
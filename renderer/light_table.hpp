@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include <glm/glm.hpp>
+
+#include "light.hpp"
+
+namespace sr {
+
+//Lights of a frame packed in SoA layout, so that they could be evaluated without virtual calls
+//Note: all the lights share the same formulas, e.g. a point light is a spot light with full cone:
+//      attenuation = 1 / (kc + kl * d + kq * d^2)
+//      cutoff = clamp((dot(L, -spotDir) - cosOuter) / (cosInner - cosOuter), 0, 1)
+class LightTable final {
+public:
+	typedef std::shared_ptr<LightTable> ptr;
+
+	void build(const std::vector<Light::ptr> &lights)
+	{
+		const size_t num = lights.size();
+		m_positional.resize(num);
+		m_posX.resize(num); m_posY.resize(num); m_posZ.resize(num);
+		m_dirX.resize(num); m_dirY.resize(num); m_dirZ.resize(num);
+		m_colorR.resize(num); m_colorG.resize(num); m_colorB.resize(num);
+		m_kc.resize(num); m_kl.resize(num); m_kq.resize(num);
+		m_cosInner.resize(num); m_cosOuter.resize(num);
+		m_shadowMaps.resize(num);
+
+		for (size_t i = 0; i < num; ++i)
+		{
+			const Light *light = lights[i].get();
+			glm::vec3 pos(0.0f), dir(0.0f, 0.0f, 1.0f), atten(1.0f, 0.0f, 0.0f);
+			//Full cone, cutoff always equals to 1
+			float cosInner = -1.0f, cosOuter = -2.0f;
+			bool positional = true;
+
+			if (const SpotLight *spot = dynamic_cast<const SpotLight*>(light))
+			{
+				pos = spot->getLightPos();
+				atten = spot->getAttenuation();
+				dir = spot->getSpotDirection();
+				cosInner = spot->getInnerCutoff();
+				cosOuter = spot->getOuterCutoff();
+			}
+			else if (const PointLight *point = dynamic_cast<const PointLight*>(light))
+			{
+				pos = point->getLightPos();
+				atten = point->getAttenuation();
+			}
+			else if (const DirectionalLight *directional = dynamic_cast<const DirectionalLight*>(light))
+			{
+				dir = directional->getLightDir();
+				positional = false;
+			}
+
+			m_positional[i] = positional;
+			m_posX[i] = pos.x; m_posY[i] = pos.y; m_posZ[i] = pos.z;
+			m_dirX[i] = dir.x; m_dirY[i] = dir.y; m_dirZ[i] = dir.z;
+			m_colorR[i] = light->intensity().x; m_colorG[i] = light->intensity().y; m_colorB[i] = light->intensity().z;
+			m_kc[i] = atten.x; m_kl[i] = atten.y; m_kq[i] = atten.z;
+			m_cosInner[i] = cosInner; m_cosOuter[i] = cosOuter;
+			m_shadowMaps[i] = light->isCastShadow() ? light->getShadowMap().get() : nullptr;
+		}
+	}
+
+	size_t size() const { return m_positional.size(); }
+
+	//Whether light i has the same parameters as light j of the other table
+	bool sameLight(const size_t &i, const LightTable &other, const size_t &j) const
+	{
+		return m_positional[i] == other.m_positional[j] && position(i) == other.position(j) &&
+			direction(i) == other.direction(j) && color(i) == other.color(j) && m_kc[i] == other.m_kc[j] &&
+			m_kl[i] == other.m_kl[j] && m_kq[i] == other.m_kq[j] && m_cosInner[i] == other.m_cosInner[j] &&
+			m_cosOuter[i] == other.m_cosOuter[j] && m_shadowMaps[i] == other.m_shadowMaps[j];
+	}
+
+	glm::vec3 position(const size_t &i) const { return glm::vec3(m_posX[i], m_posY[i], m_posZ[i]); }
+	glm::vec3 direction(const size_t &i) const { return glm::vec3(m_dirX[i], m_dirY[i], m_dirZ[i]); }
+	glm::vec3 color(const size_t &i) const { return glm::vec3(m_colorR[i], m_colorG[i], m_colorB[i]); }
+
+	//Point or spot light -> true, directional light -> false (direction is the light direction then)
+	std::vector<unsigned char> m_positional;
+	std::vector<float> m_posX, m_posY, m_posZ;
+	std::vector<float> m_dirX, m_dirY, m_dirZ;
+	std::vector<float> m_colorR, m_colorG, m_colorB;
+	std::vector<float> m_kc, m_kl, m_kq;
+	std::vector<float> m_cosInner, m_cosOuter;
+	//Null if the light casts no shadow
+	std::vector<const ShadowMap*> m_shadowMaps;
+};
+
+} // namespace sr
\ No newline at end of file
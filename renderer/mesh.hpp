@@ -7,6 +7,7 @@
 #include <glm/glm.hpp>
 
 #include "context.hpp"
+#include "spherical_harmonics.hpp"
 
 namespace sr {
 
@@ -29,12 +30,13 @@ public:
 	~Mesh() = default;
 	
 	Mesh(const Mesh& mesh) : m_vertices(mesh.m_vertices), m_indices(mesh.m_indices), 
-	m_drawingMaterial(mesh.m_drawingMaterial) {}
+	m_prtTransfer(mesh.m_prtTransfer), m_drawingMaterial(mesh.m_drawingMaterial) {}
 
 	Mesh& Mesh::operator=(const Mesh& mesh) {
 		if (&mesh == this) return *this;
 		m_vertices = mesh.m_vertices;
 		m_indices = mesh.m_indices;
+		m_prtTransfer = mesh.m_prtTransfer;
 		m_drawingMaterial = mesh.m_drawingMaterial;
 		return *this;
 	}
@@ -57,14 +59,20 @@ public:
 	const std::vector<Vertex>& getVertices() const { return m_vertices; }
 	const std::vector<unsigned int>& getIndices() const { return m_indices; }
 
+	//Baked transfer of each vertex for precomputed radiance transfer, empty if not baked
+	void setPRTTransfer(const std::vector<SHTransfer> &transfer) { m_prtTransfer = transfer; }
+	const std::vector<SHTransfer>& getPRTTransfer() const { return m_prtTransfer; }
+
 	void clear() {
 		std::vector<Vertex>().swap(m_vertices);
 		std::vector<unsigned int>().swap(m_indices);
+		std::vector<SHTransfer>().swap(m_prtTransfer);
 	}
 
 private:
 	VertexBuffer m_vertices;
 	IndexBuffer  m_indices;
+	std::vector<SHTransfer> m_prtTransfer;
 
 	struct MaterialTex {
 		int m_diffuseMapTexId = -1;
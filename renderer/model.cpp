@@ -1,6 +1,7 @@
 #include "Model.hpp"
 
 #include <map>
+#include <limits>
 #include <iostream>
 
 #include "assimp/Importer.hpp"
@@ -14,10 +15,12 @@ namespace sr {
 
 class AssimpImporterWrapper final{
 public:
-	//textureDict is for avoiding redundant loading
+	//textureDict is for avoiding redundant acquiring within the model, the registry shares them across the models
 	std::map<std::string, int> textureDict = {};
+	std::vector<int> textureIds = {};
 	std::string directory = "";
 	bool generatedMipmap = false;
+	TextureCompressionMode compression = TextureCompressionMode::NONE;
 
 	Mesh processMesh(aiMesh *mesh, const aiScene *scene) {
 		Mesh drawable;
@@ -80,10 +83,10 @@ public:
 				}
 				else
 				{
-					Texture::ptr diffTex = std::make_shared<Texture>(generatedMipmap);
-					bool success = diffTex->loadTextureFromFile(directory + '/' + str.C_Str());
-					auto texId = Pipeline::uploadTexture(diffTex);
+					//Decoded in the background unless loaded by others, the textures of all the models are loaded concurrently
+					auto texId = Pipeline::acquireTexture(directory + '/' + str.C_Str(), generatedMipmap, compression);
 					textureDict.insert({ str.C_Str(), texId });
+					textureIds.push_back(texId);
 					return texId;
 				}
 			}
@@ -121,12 +124,13 @@ public:
 };
 
 
-void Model::importMeshFromFile(const std::string &path, bool generatedMipmap) {
+void Model::importMeshFromFile(const std::string &path, bool generatedMipmap, TextureCompressionMode compression) {
 	for (auto &mesh : m_meshes)
 	{
 		mesh.clear();
 	}
 	m_meshes.clear();
+	releaseTextures();
 
 	// read file via ASSIMP
 	Assimp::Importer importer;
@@ -142,9 +146,10 @@ void Model::importMeshFromFile(const std::string &path, bool generatedMipmap) {
 	// retrieve the directory path of the filepath
 	AssimpImporterWrapper wrapper;
 	wrapper.generatedMipmap = generatedMipmap;
+	wrapper.compression = compression;
 	wrapper.directory = path.substr(0, path.find_last_of('/'));
 	wrapper.processNode(scene->mRootNode, scene, m_meshes);
-	
+	m_textureIds.swap(wrapper.textureIds);
 }
 
 void Model::clear()
@@ -153,11 +158,34 @@ void Model::clear()
 	{
 		mesh.clear();
 	}
+	releaseTextures();
 }
 
-Model::Model(const std::string &path, bool generatedMipmap)
+void Model::releaseTextures()
 {
-	importMeshFromFile(path, generatedMipmap);
+	for (auto &mesh : m_meshes)
+	{
+		mesh.setDiffuseMapTexId(-1);
+		mesh.setSpecularMapTexId(-1);
+		mesh.setNormalMapTexId(-1);
+		mesh.setGlowMapTexId(-1);
+	}
+	for (const auto &id : m_textureIds)
+	{
+		Pipeline::releaseTexture(id);
+	}
+	std::vector<int>().swap(m_textureIds);
+}
+
+Model::Model(const std::string &path, bool generatedMipmap, TextureCompressionMode compression)
+{
+	importMeshFromFile(path, generatedMipmap, compression);
+	computeBounds();
+}
+
+Model::~Model()
+{
+	releaseTextures();
 }
 
 unsigned int Model::getDrawableMaxFaceNums() const
@@ -170,4 +198,39 @@ unsigned int Model::getDrawableMaxFaceNums() const
 	return num;
 }
 
+void Model::computeBounds()
+{
+	m_boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	m_boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (const auto &mesh : m_meshes)
+	{
+		for (const auto &vertex : mesh.getVertices())
+		{
+			m_boundsMin = glm::min(m_boundsMin, vertex.m_vpositions);
+			m_boundsMax = glm::max(m_boundsMax, vertex.m_vpositions);
+		}
+	}
+	//Empty model
+	if (m_boundsMin.x > m_boundsMax.x)
+	{
+		m_boundsMin = m_boundsMax = glm::vec3(0.0f);
+	}
+}
+
+void Model::getWorldBounds(glm::vec3 &boundsMin, glm::vec3 &boundsMax) const
+{
+	//Transform the corners of the local bounding box
+	const glm::mat4 &modelMatrix = m_drawing_config.m_modelMatrix;
+	boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (int c = 0; c < 8; ++c)
+	{
+		glm::vec3 corner((c & 1) ? m_boundsMax.x : m_boundsMin.x, (c & 2) ? m_boundsMax.y : m_boundsMin.y,
+			(c & 4) ? m_boundsMax.z : m_boundsMin.z);
+		glm::vec3 pos = glm::vec3(modelMatrix * glm::vec4(corner, 1.0f));
+		boundsMin = glm::min(boundsMin, pos);
+		boundsMax = glm::max(boundsMax, pos);
+	}
+}
+
 } // namespace sr
\ No newline at end of file
@@ -8,16 +8,23 @@ class Model {
 public:
 	typedef std::shared_ptr<Model> ptr;
 
-	Model(const std::string &path, bool generatedMipmap);
+	Model(const std::string &path, bool generatedMipmap,
+		TextureCompressionMode compression = TextureCompressionMode::NONE);
+	~Model();
 
+	//Note: the textures are reference counted by the models holding them
+	Model(const Model &) = delete;
+	Model &operator=(const Model &) = delete;
+
+	//Release the meshes and the textures
 	void clear();
 
-	void setAmbientCoff(const glm::vec3 &cof) { m_drawingMaterial.m_kA = cof; }
-	void setDiffuseCoff(const glm::vec3 &cof) { m_drawingMaterial.m_kD = cof; }
-	void setSpecularCoff(const glm::vec3 &cof) { m_drawingMaterial.m_kS = cof; }
-	void setEmissionCoff(const glm::vec3 &cof) { m_drawingMaterial.m_kE = cof; }
-	void setSpecularExponent(const float &cof) { m_drawingMaterial.m_shininess = cof; }
-	void setTransparency(const float &alpha) { m_drawingMaterial.m_transparency = alpha; }
+	void setAmbientCoff(const glm::vec3 &cof) { m_drawingMaterial.m_kA = cof; ++m_version; }
+	void setDiffuseCoff(const glm::vec3 &cof) { m_drawingMaterial.m_kD = cof; ++m_version; }
+	void setSpecularCoff(const glm::vec3 &cof) { m_drawingMaterial.m_kS = cof; ++m_version; }
+	void setEmissionCoff(const glm::vec3 &cof) { m_drawingMaterial.m_kE = cof; ++m_version; }
+	void setSpecularExponent(const float &cof) { m_drawingMaterial.m_shininess = cof; ++m_version; }
+	void setTransparency(const float &alpha) { m_drawingMaterial.m_transparency = alpha; ++m_version; }
 
 	const glm::vec3& getAmbientCoff() const { return m_drawingMaterial.m_kA; }
 	const glm::vec3& getDiffuseCoff() const { return m_drawingMaterial.m_kD; }
@@ -26,35 +33,58 @@ public:
 	const float& getSpecularExponent() const { return m_drawingMaterial.m_shininess; }
 	const float& getTransparency() const { return m_drawingMaterial.m_transparency; }
 
-	void setCullfaceMode(CullFaceMode mode) { m_drawing_config.m_cullfaceMode = mode; }
-	void setDepthtestMode(DepthTestMode mode) { m_drawing_config.m_depthtestMode = mode; }
-	void setDepthwriteMode(DepthWriteMode mode) { m_drawing_config.m_depthwriteMode = mode; }
-	void setAlphablendMode(AlphaBlendingMode mode) { m_drawing_config.m_alphaBlendMode = mode; }
-	void setModelMatrix(const glm::mat4& mat) { m_drawing_config.m_modelMatrix = mat; }
-	void setLightingMode(LightingMode mode) { m_drawing_config.m_lightingMode = mode; }
+	void setCullfaceMode(CullFaceMode mode) { m_drawing_config.m_cullfaceMode = mode; ++m_version; }
+	void setDepthtestMode(DepthTestMode mode) { m_drawing_config.m_depthtestMode = mode; ++m_version; }
+	void setDepthwriteMode(DepthWriteMode mode) { m_drawing_config.m_depthwriteMode = mode; ++m_version; }
+	void setAlphablendMode(AlphaBlendingMode mode) { m_drawing_config.m_alphaBlendMode = mode; ++m_version; }
+	void setOITMode(OITMode mode) { m_drawing_config.m_oitMode = mode; ++m_version; }
+	void setModelMatrix(const glm::mat4& mat) { m_drawing_config.m_modelMatrix = mat; ++m_version; }
+	void setLightingMode(LightingMode mode) { m_drawing_config.m_lightingMode = mode; ++m_version; }
+	void setCastShadow(bool cast) { m_drawing_config.m_castShadow = cast; ++m_version; }
+	void setShadingRate(ShadingRate rate) { m_drawing_config.m_shadingRate = rate; ++m_version; }
 
 	CullFaceMode getCullfaceMode() const { return m_drawing_config.m_cullfaceMode; }
 	DepthTestMode getDepthtestMode() const { return m_drawing_config.m_depthtestMode; }
 	DepthWriteMode getDepthwriteMode() const { return m_drawing_config.m_depthwriteMode; }
 	AlphaBlendingMode getAlphablendMode() const { return m_drawing_config.m_alphaBlendMode; }
+	OITMode getOITMode() const { return m_drawing_config.m_oitMode; }
 	const glm::mat4& getModelMatrix() const { return m_drawing_config.m_modelMatrix; }
 	LightingMode getLightingMode() const { return m_drawing_config.m_lightingMode; }
+	bool isCastShadow() const { return m_drawing_config.m_castShadow; }
+	ShadingRate getShadingRate() const { return m_drawing_config.m_shadingRate; }
+
+	//Bumped by each setter, so that the renderer could tell whether the model changed since last frame
+	unsigned int getVersion() const { return m_version; }
 
 	unsigned int getDrawableMaxFaceNums() const;
+
+	//Axis-aligned bounding box in local space and world space
+	const glm::vec3 &getLocalBoundsMin() const { return m_boundsMin; }
+	const glm::vec3 &getLocalBoundsMax() const { return m_boundsMax; }
+	void getWorldBounds(glm::vec3 &boundsMin, glm::vec3 &boundsMax) const;
 	MeshBuffer& getDrawableSubMeshes() { return m_meshes; }
 
 protected:
-	void importMeshFromFile(const std::string &path, bool generatedMipmap = true);
+	void importMeshFromFile(const std::string &path, bool generatedMipmap = true,
+		TextureCompressionMode compression = TextureCompressionMode::NONE);
+	void computeBounds();
+	void releaseTextures();
 
 protected:
 	MeshBuffer m_meshes;
+	std::vector<int> m_textureIds;		//Acquired texture units, each only once
+	glm::vec3 m_boundsMin = glm::vec3(0.0f);
+	glm::vec3 m_boundsMax = glm::vec3(0.0f);
 
 	struct DrawableConfig {
 		CullFaceMode m_cullfaceMode = CullFaceMode::CULL_BACK;
 		DepthTestMode m_depthtestMode = DepthTestMode::DEPTH_TEST_ENABLE;
 		DepthWriteMode m_depthwriteMode = DepthWriteMode::DEPTH_WRITE_ENABLE;
 		AlphaBlendingMode m_alphaBlendMode = AlphaBlendingMode::ALPHA_DISABLE;
+		OITMode m_oitMode = OITMode::OIT_DISABLE;
 		LightingMode m_lightingMode = LightingMode::LIGHTING_ENABLE;
+		bool m_castShadow = true;
+		ShadingRate m_shadingRate = ShadingRate::SHADING_RATE_1X1;
 		glm::mat4 m_modelMatrix = glm::mat4(1.0f);
 	};
 	DrawableConfig m_drawing_config;
@@ -69,6 +99,8 @@ protected:
 	};
 	DrawableMaterialCof m_drawingMaterial;
 
+	unsigned int m_version = 0;
+
 };
 
 } // namespace sr
\ No newline at end of file
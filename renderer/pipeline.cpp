@@ -2,8 +2,18 @@
 
 #include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <climits>
+#include <mutex>
+#include <unordered_map>
+
+#include <tbb/task_group.h>
 
 #include "parallel_wrapper.hpp"
+#include "math_utils.hpp"
+#include "pipeline_t.hpp"
+#include "shadow_map.hpp"
 
 namespace sr {
 
@@ -21,6 +31,10 @@ Pipeline::VertexData Pipeline::VertexData::lerp(const Pipeline::VertexData &v0,
 		result.m_tbn = (1.0f - frac) * v0.m_tbn + frac * v1.m_tbn;
 		result.m_needInterpolatedTBN = true;
 	}
+	if (v0.m_needInterpolatedColor) {
+		result.m_color = (1.0f - frac) * v0.m_color + frac * v1.m_color;
+		result.m_needInterpolatedColor = true;
+	}
 
 	return result;
 }
@@ -41,6 +55,9 @@ Pipeline::FragmentData Pipeline::VertexData::barycentricLerp(
 	if (v0.m_needInterpolatedTBN) {
 		result.m_tbn = w.x * v0.m_tbn + w.y * v1.m_tbn + w.z * v2.m_tbn;
 	}
+	if (v0.m_needInterpolatedColor) {
+		result.m_color = w.x * v0.m_color + w.y * v1.m_color + w.z * v2.m_color;
+	}
 
 	return result;
 }
@@ -57,6 +74,7 @@ void Pipeline::VertexData::prePerspCorrection(VertexData &v) {
 	v.m_pos *= v.m_rhw;
 	v.m_tex *= v.m_rhw;
 	v.m_nor *= v.m_rhw;
+	v.m_color *= v.m_rhw;
 }
 
 void Pipeline::FragmentData::aftPrespCorrection(FragmentData &v) {
@@ -66,13 +84,20 @@ void Pipeline::FragmentData::aftPrespCorrection(FragmentData &v) {
 	v.m_pos *= w;
 	v.m_tex *= w;
 	v.m_nor *= w;
+	v.m_color *= w;
 }
 
 
-std::vector<Texture::ptr> Pipeline::m_globalTextureUnits = {};
-std::vector<Light::ptr> Pipeline::m_lights = {};
-glm::vec3 Pipeline::m_viewerPos = glm::vec3(0.0f);
-float Pipeline::m_exposure = 1.0f;
+tbb::concurrent_vector<Texture::ptr> Pipeline::m_globalTextureUnits;
+std::atomic<unsigned int> Pipeline::m_textureGeneration(0);
+
+//Background loads of the textures
+//Note: never destroyed, so that exiting with the pending loads is fine
+static tbb::task_group &textureLoadingGroup()
+{
+	static tbb::task_group *group = new tbb::task_group();
+	return *group;
+}
 
 void Pipeline::rasterizeFillEdgeFunction(
 	const VertexData &v0,
@@ -81,6 +106,18 @@ void Pipeline::rasterizeFillEdgeFunction(
 	const unsigned int &screenWidth,
 	const unsigned int &screenHeight,
 	std::vector<QuadFragments> &rasterized_fragments)
+{
+	rasterizeFillEdgeFunction(v0, v1, v2, glm::ivec2(0, 0), 
+		glm::ivec2((int)screenWidth - 1, (int)screenHeight - 1), rasterized_fragments);
+}
+
+void Pipeline::rasterizeFillEdgeFunction(
+	const VertexData &v0,
+	const VertexData &v1,
+	const VertexData &v2,
+	const glm::ivec2 &rectMin,
+	const glm::ivec2 &rectMax,
+	std::vector<QuadFragments> &rasterized_fragments)
 {
 	//Edge function rasterization algorithm
 	//Accelerated Half-Space Triangle Rasterization
@@ -91,10 +128,12 @@ void Pipeline::rasterizeFillEdgeFunction(
 	VertexData v[] = { v0, v1, v2 };
 	glm::ivec2 boundingMin;
 	glm::ivec2 boundingMax;
-	boundingMin.x = std::max(std::min(v0.m_spos.x, std::min(v1.m_spos.x, v2.m_spos.x)), 0);
-	boundingMin.y = std::max(std::min(v0.m_spos.y, std::min(v1.m_spos.y, v2.m_spos.y)), 0);
-	boundingMax.x = std::min(std::max(v0.m_spos.x, std::max(v1.m_spos.x, v2.m_spos.x)), (int)screenWidth - 1);
-	boundingMax.y = std::min(std::max(v0.m_spos.y, std::max(v1.m_spos.y, v2.m_spos.y)), (int)screenHeight - 1);
+	boundingMin.x = std::max(std::min(v0.m_spos.x, std::min(v1.m_spos.x, v2.m_spos.x)), rectMin.x);
+	boundingMin.y = std::max(std::min(v0.m_spos.y, std::min(v1.m_spos.y, v2.m_spos.y)), rectMin.y);
+	boundingMax.x = std::min(std::max(v0.m_spos.x, std::max(v1.m_spos.x, v2.m_spos.x)), rectMax.x);
+	boundingMax.y = std::min(std::max(v0.m_spos.y, std::max(v1.m_spos.y, v2.m_spos.y)), rectMax.y);
+	if (boundingMin.x > boundingMax.x || boundingMin.y > boundingMax.y)
+		return;
 
 	//Adjust the order
 	{
@@ -276,8 +315,8 @@ int Pipeline::uploadTexture(Texture::ptr tex)
 {
 	if (tex != nullptr)
 	{
-		m_globalTextureUnits.push_back(tex);
-		return m_globalTextureUnits.size() - 1;
+		auto iter = m_globalTextureUnits.push_back(tex);
+		return static_cast<int>(iter - m_globalTextureUnits.begin());
 	}
 	return -1;
 }
@@ -286,38 +325,359 @@ Texture::ptr Pipeline::getTexture(int index)
 {
 	if (index < 0 || index >= m_globalTextureUnits.size())
 		return nullptr;
-	return m_globalTextureUnits[index];
+	return std::atomic_load(&m_globalTextureUnits[index]);
+}
+
+int Pipeline::uploadTextureAsync(const std::string &filepath, bool generatedMipmap, TextureCompressionMode compression)
+{
+	//The unit is reserved before loading, so that the ids are known up front
+	Texture::ptr tex = std::make_shared<Texture>(generatedMipmap, compression);
+	int index = uploadTexture(tex);
+	textureLoadingGroup().run([tex, filepath]()
+	{
+		//Note: the unit stays a placeholder if the loading failed
+		if (tex->loadTextureFromFile(filepath))
+			++m_textureGeneration;
+	});
+	return index;
+}
+
+//Registry of the shared textures
+//Note: never destroyed as the texture units
+struct TextureRegistry {
+	struct Entry {
+		int m_refCount = 0;
+		std::vector<std::string> m_pathKeys;	//All the paths resolved to the texture
+		size_t m_contentKey = 0;
+	};
+	std::mutex m_mutex;
+	std::unordered_map<std::string, int> m_byPath;
+	std::unordered_map<size_t, int> m_byContent;
+	std::unordered_map<int, Entry> m_entries;
+	std::vector<Texture::ptr> m_released;		//Kept alive until no frame samples them
+};
+
+static TextureRegistry &textureRegistry()
+{
+	static TextureRegistry *registry = new TextureRegistry();
+	return *registry;
+}
+
+//Absolute path with the symbolic links and the relative components resolved, or the given one if it does not exist
+static std::string canonicalPath(const std::string &filepath)
+{
+	std::string path = filepath;
+#ifdef _WIN32
+	char resolved[_MAX_PATH];
+	if (_fullpath(resolved, filepath.c_str(), _MAX_PATH) != nullptr)
+		path = resolved;
+	std::replace(path.begin(), path.end(), '\\', '/');
+	std::transform(path.begin(), path.end(), path.begin(), ::tolower);
+#else
+	char resolved[PATH_MAX];
+	if (realpath(filepath.c_str(), resolved) != nullptr)
+		path = resolved;
+#endif
+	return path;
+}
+
+int Pipeline::acquireTexture(const std::string &filepath, bool generatedMipmap, TextureCompressionMode compression)
+{
+	auto &registry = textureRegistry();
+
+	//The settings are part of the keys, since they change the loaded texels
+	std::string pathKey = canonicalPath(filepath);
+	pathKey += '|';
+	pathKey += generatedMipmap ? '1' : '0';
+	pathKey += (char)('0' + (int)compression);
+
+	std::lock_guard<std::mutex> lock(registry.m_mutex);
+	auto iter = registry.m_byPath.find(pathKey);
+	if (iter != registry.m_byPath.end())
+	{
+		++registry.m_entries[iter->second].m_refCount;
+		return iter->second;
+	}
+
+	//The unit is reserved at once, the image is read, hashed and decoded in the background
+	Texture::ptr tex = std::make_shared<Texture>(generatedMipmap, compression);
+	int index = uploadTexture(tex);
+	TextureRegistry::Entry &entry = registry.m_entries[index];
+	entry.m_refCount = 1;
+	entry.m_pathKeys.push_back(pathKey);
+	registry.m_byPath[pathKey] = index;
+
+	textureLoadingGroup().run([tex, index, filepath, generatedMipmap, compression]()
+	{
+		std::vector<unsigned char> bytes;
+		{
+			std::ifstream file(filepath, std::ios::in | std::ios::binary);
+			if (file.is_open())
+				bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		}
+
+		//Same image under another path, e.g. the copies in the material packs of different scenes
+		if (!bytes.empty())
+		{
+			size_t contentKey = FNV_OFFSET_BASIS;
+			fnv1aHash(contentKey, bytes.data(), bytes.size());
+			fnv1aHash(contentKey, &generatedMipmap, sizeof(generatedMipmap));
+			fnv1aHash(contentKey, &compression, sizeof(compression));
+
+			auto &registry = textureRegistry();
+			std::lock_guard<std::mutex> lock(registry.m_mutex);
+			auto entryIter = registry.m_entries.find(index);
+			//Released before loaded
+			if (entryIter == registry.m_entries.end())
+				return;
+			auto contentIter = registry.m_byContent.find(contentKey);
+			if (contentIter != registry.m_byContent.end())
+			{
+				//The paths now resolve to the first entry, the unit shares its texture and the duplicate is dropped
+				TextureRegistry::Entry &first = registry.m_entries[contentIter->second];
+				for (const auto &pathKey : entryIter->second.m_pathKeys)
+				{
+					registry.m_byPath[pathKey] = contentIter->second;
+					first.m_pathKeys.push_back(pathKey);
+				}
+				entryIter->second.m_pathKeys.clear();
+				std::atomic_store(&m_globalTextureUnits[index], std::atomic_load(&m_globalTextureUnits[contentIter->second]));
+				++m_textureGeneration;
+				return;
+			}
+			registry.m_byContent[contentKey] = index;
+			entryIter->second.m_contentKey = contentKey;
+		}
+
+		//Note: the unit stays a placeholder if the loading failed
+		if (tex->loadTextureFromMemory(filepath, std::move(bytes)))
+			++m_textureGeneration;
+	});
+	return index;
+}
+
+void Pipeline::releaseTexture(int index)
+{
+	auto &registry = textureRegistry();
+	std::lock_guard<std::mutex> lock(registry.m_mutex);
+	auto iter = registry.m_entries.find(index);
+	if (iter == registry.m_entries.end() || --iter->second.m_refCount > 0)
+		return;
+
+	for (const auto &pathKey : iter->second.m_pathKeys)
+		registry.m_byPath.erase(pathKey);
+	auto contentIter = registry.m_byContent.find(iter->second.m_contentKey);
+	if (iter->second.m_contentKey != 0 && contentIter != registry.m_byContent.end() && contentIter->second == index)
+		registry.m_byContent.erase(contentIter);
+	registry.m_entries.erase(iter);
+
+	//Note: the unit is not reused, the pending load (if any) keeps the texture alive until finished.
+	//      The renderers may still sample it in their current frame, so it is destroyed at the frame boundary.
+	registry.m_released.push_back(std::atomic_exchange(&m_globalTextureUnits[index], Texture::ptr()));
+	++m_textureGeneration;
 }
 
-int Pipeline::addLight(Light::ptr lightSource)
+void Pipeline::collectReleasedTextures()
 {
-	m_lights.push_back(lightSource);
-	return m_lights.size() - 1;
+	std::vector<Texture::ptr> released;
+	{
+		auto &registry = textureRegistry();
+		std::lock_guard<std::mutex> lock(registry.m_mutex);
+		released.swap(registry.m_released);
+	}
 }
 
-Light::ptr Pipeline::getLight(int index)
+void Pipeline::waitTextureLoading()
 {
-	return m_lights[index];
+	textureLoadingGroup().wait();
+}
+
+const Texture *Pipeline::getReadyTexture(int index)
+{
+	if (index < 0 || index >= (int)m_globalTextureUnits.size())
+		return nullptr;
+	//Note: the raw pointer is valid until the frame boundary, see releaseTexture
+	const Texture *tex = std::atomic_load(&m_globalTextureUnits[index]).get();
+	return (tex != nullptr && tex->isReady()) ? tex : nullptr;
 }
 
 glm::vec4 Pipeline::texture(const unsigned int &id, const glm::vec2 &uv,
 	const glm::vec2 &dUVdx, const glm::vec2 &dUVdy)
 {
-	if (id < 0 || id >= m_globalTextureUnits.size())
+	const Texture *tex = getReadyTexture(id);
+	if (tex == nullptr)
 		return glm::vec4(0.0f);
-	const auto &texture = m_globalTextureUnits[id];
-	if (texture->isGeneratedMipmap())
+	return texture(tex, uv, dUVdx, dUVdy);
+}
+
+glm::vec4 Pipeline::texture(const Texture *texture, const glm::vec2 &uv,
+	const glm::vec2 &dUVdx, const glm::vec2 &dUVdy)
+{
+	TextureLod lod(dUVdx, dUVdy);
+	return texture->sample(uv, lod(texture).m_level);
+}
+
+void Pipeline::textureQuad(const Texture *texture, const glm::vec2 uv[4],
+	const glm::vec2 &dUVdx, const glm::vec2 &dUVdy, glm::vec4 texels[4])
+{
+	TextureLod lod(dUVdx, dUVdy);
+	texture->sampleQuad(uv, lod(texture).m_level, texels);
+}
+
+glm::vec4 Pipeline::texture(const Texture *texture, const glm::vec2 &uv, TextureLod &lod)
+{
+	const auto &footprint = lod(texture);
+	if (footprint.m_taps > 1)
 	{
-		//Calculate lod level
-		glm::vec2 dfdx = dUVdx * glm::vec2(texture->getWidth(), texture->getHeight());
-		glm::vec2 dfdy = dUVdy * glm::vec2(texture->getWidth(), texture->getHeight());
-		float L = glm::max(glm::dot(dfdx, dfdx), glm::dot(dfdy, dfdy));
-		return texture->sample(uv, glm::max(0.5f * glm::log2(L), 0.0f));
+		return texture->sampleAnisotropic(uv, footprint.m_level, footprint.m_step, footprint.m_taps);
+	}
+	return texture->sample(uv, footprint.m_level);
+}
+
+void Pipeline::textureQuad(const Texture *texture, const glm::vec2 uv[4], TextureLod &lod, glm::vec4 texels[4])
+{
+	const auto &footprint = lod(texture);
+	if (footprint.m_taps > 1)
+	{
+		texture->sampleQuadAnisotropic(uv, footprint.m_level, footprint.m_step, footprint.m_taps, texels);
 	}
 	else
 	{
-		return texture->sample(uv);
+		texture->sampleQuad(uv, footprint.m_level, texels);
+	}
+}
+
+void Pipeline::fragmentShaderQuad(const QuadFragments &quad, const QuadMask &active, const LightIndices &lights,
+	glm::vec4 fragColor[4]) const
+{
+	shadeQuadLanes(*this, quad, active, fragColor);
+}
+
+void Pipeline::shadeQuads(std::vector<QuadFragments> &quads, const Context &context, FrameBuffer *framebuffer,
+	const LightIndices &lights) const
+{
+	shadeQuadFragments(*this, quads, context, framebuffer, lights);
+}
+
+void Pipeline::shadeQuadsGBuffer(std::vector<QuadFragments> &quads, const Context &context, FrameBuffer *framebuffer) const
+{
+	for (auto &block : quads)
+	{
+		//Perspective correction restore
+		block.aftPrespCorrectionForBlocks();
+
+		QuadMask active;
+		for (int i = 0; i < 4; ++i)
+			active[i] = earlyDepthTest(block.m_fragments[i], context, framebuffer);
+		if (!(active[0] || active[1] || active[2] || active[3]))
+			continue;
+
+		//Save the surface attributes to G-buffer instead of shading
+		GBufferTexel texels[4];
+		fragmentShaderGBuffer(block, active, texels);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!active[i])
+				continue;
+			const auto &fragment = block.m_fragments[i];
+			framebuffer->writeGBufferWithMask(fragment.m_spos.x, fragment.m_spos.y, texels[i], fragment.m_coverage);
+			if (context.m_DepthWriteMode == DepthWriteMode::DEPTH_WRITE_ENABLE)
+			{
+				framebuffer->writeDepthWithMask(fragment.m_spos.x, fragment.m_spos.y, fragment.m_coverageDepth, fragment.m_coverage);
+			}
+		}
+	}
+}
+
+void Pipeline::deferredLightingQuad(const GBufferTexel *texels[4], const LightIndices &lights, glm::vec4 fragColor[4]) const
+{
+	QuadVec3 fragPos, normal, ambient, diffuse, specular, emission;
+	QuadFloat shininess;
+	for (int i = 0; i < 4; ++i)
+	{
+		fragPos.setLane(i, texels[i]->m_pos);
+		normal.setLane(i, texels[i]->m_nor);
+		ambient.setLane(i, texels[i]->m_ambient);
+		diffuse.setLane(i, texels[i]->m_diffuse);
+		specular.setLane(i, texels[i]->m_specular);
+		emission.setLane(i, texels[i]->m_emission);
+		shininess[i] = texels[i]->m_shininess;
+	}
+
+	//Calculate the lighting
+	QuadVec3 hdrColor = lightingQuad(fragPos, normal, ambient, diffuse, specular, shininess, lights, true) + emission;
+
+	//Tone mapping: HDR -> LDR
+	QuadVec3 ldrColor = QuadVec3(glm::vec3(1.0f)) - quadExp(hdrColor * QuadFloat(-m_exposure));
+	for (int i = 0; i < 4; ++i)
+		fragColor[i] = glm::vec4(ldrColor.lane(i), texels[i]->m_alpha);
+}
+
+QuadVec3 Pipeline::lightingQuad(const QuadVec3 &fragPos, const QuadVec3 &normal, const QuadVec3 &ambColor,
+	const QuadVec3 &diffuse, const QuadVec3 &speColor, const QuadFloat &shininess, const LightIndices &lights, 
+	const bool &blinn) const
+{
+	QuadVec3 color(glm::vec3(0.0f));
+	QuadVec3 viewDir = quadNormalize(QuadVec3(m_viewerPos) - fragPos);
+	const QuadFloat zero(0.0f), one(1.0f);
+	const LightTable &table = *m_lightTable;
+	//Note: only the culled lights are evaluated, the parameters of each light are broadcast to the lanes
+	for (size_t i = 0; i < lights.size(); ++i)
+	{
+		const unsigned int &l = lights[i];
+
+		//Light direction and distance
+		QuadVec3 lightDir;
+		QuadFloat distance(0.0f);
+		if (table.m_positional[l])
+		{
+			QuadVec3 toLight = QuadVec3(table.position(l)) - fragPos;
+			QuadFloat invDistance = quadInverseSqrt(quadDot(toLight, toLight));
+			lightDir = toLight * invDistance;
+			distance = one / invDistance;
+		}
+		else
+		{
+			lightDir = QuadVec3(table.direction(l));
+		}
+
+		//Attenuation and spot cutoff
+		QuadFloat attenuation = one / (QuadFloat(table.m_kc[l]) + QuadFloat(table.m_kl[l]) * distance
+			+ QuadFloat(table.m_kq[l]) * distance * distance);
+		QuadFloat theta = -quadDot(lightDir, QuadVec3(table.direction(l)));
+		QuadFloat cutoff = glm::clamp((theta - QuadFloat(table.m_cosOuter[l])) / 
+			QuadFloat(table.m_cosInner[l] - table.m_cosOuter[l]), zero, one);
+
+		//Diffuse
+		QuadFloat diffCof = glm::max(quadDot(normal, lightDir), zero);
+
+		//Blin-Phong or Phong Specular
+		QuadFloat specCof;
+		if (blinn)
+		{
+			QuadVec3 halfwayDir = quadNormalize(viewDir + lightDir);
+			specCof = quadDot(halfwayDir, normal);
+		}
+		else
+		{
+			//reflect(-L, N) = 2 * dot(N, L) * N - L
+			QuadVec3 reflectDir = normal * (QuadFloat(2.0f) * quadDot(normal, lightDir)) - lightDir;
+			specCof = quadDot(viewDir, reflectDir);
+		}
+		QuadFloat spec = quadPow(glm::max(specCof, zero), shininess);
+		QuadVec3 specular = speColor * spec;
+
+		//Shadowing, the ambient term is not occluded
+		QuadFloat visibility = one;
+		if (const ShadowMap *shadowMap = table.m_shadowMaps[l])
+		{
+			for (int j = 0; j < 4; ++j)
+				visibility[j] = shadowMap->visibility(fragPos.lane(j), diffCof[j]);
+		}
+
+		color += (ambColor + (diffuse * diffCof + specular) * visibility) * table.color(l) * (attenuation * cutoff);
 	}
+	return color;
 }
 
 } // namespace sr
\ No newline at end of file
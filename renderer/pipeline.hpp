@@ -2,19 +2,30 @@
 
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <string>
 
 #include <glm/glm.hpp>
+#include <tbb/concurrent_vector.h>
 
 #include "light.hpp"
+#include "light_table.hpp"
+#include "context.hpp"
 #include "textures/texture.hpp"
 #include "parallel_wrapper.hpp"
 #include "pixel_sampler.hpp"
+#include "quad_simd.hpp"
+#include "spherical_harmonics.hpp"
+#include "frame_buffer.hpp"
+#include "math_utils.hpp"
 
 namespace sr {
 
 class Pipeline {
 public:
 	typedef std::shared_ptr<Pipeline> ptr;
+	//Indices into the lights, e.g. the lights affecting a screen tile
+	typedef std::vector<unsigned int> LightIndices;
 	
 	struct FragmentData;
 	struct VertexData {
@@ -24,8 +35,11 @@ public:
 		glm::vec4 m_cpos; //Clip space position
 		glm::ivec2 m_spos;//Screen space position
 		glm::mat3 m_tbn;  //Tangent, bitangent, normal matrix
+		glm::vec3 m_color = glm::vec3(0.0f);//Per-vertex color, e.g. precomputed radiance transfer
 		bool m_needInterpolatedTBN = false;
+		bool m_needInterpolatedColor = false;
 		float m_rhw;
+		const SHTransfer *m_transfer = nullptr;//Baked transfer of the vertex (input of vertex shader only)
 
 		VertexData() = default;
 		VertexData(const glm::ivec2 &screenPos) : m_spos(screenPos) {}
@@ -47,6 +61,7 @@ public:
 		glm::vec2 m_tex;	//World space texture coordinate
 		glm::ivec2 m_spos;//Screen space position
 		glm::mat3 m_tbn;  //Tangent, bitangent, normal matrix
+		glm::vec3 m_color = glm::vec3(0.0f);//Per-vertex color
 		float m_rhw;
 		
 		// MSAA Mask
@@ -92,6 +107,9 @@ public:
 
 	virtual ~Pipeline() = default;
 
+	//Copy of the pipeline with its current settings, e.g. for drawing several views simultaneously
+	virtual ptr clone() const = 0;
+
 	//Vertex shader settting
 	void setModelMatrix(const glm::mat4 &model) 
 	{ 
@@ -101,6 +119,18 @@ public:
 	}
 	void setViewProjectMatrix(const glm::mat4 &vp) { m_viewProjectMatrix = vp; }
 	void setLightingEnable(bool enable) { m_lightingEnable = enable; }
+	void setViewerPos(const glm::vec3 &viewer) { m_viewerPos = viewer; }
+	void setLights(const std::vector<Light::ptr> &lights) 
+	{ 
+		m_lights = lights;
+		//Note: the packed table is immutable and shared by the clones
+		auto table = std::make_shared<LightTable>();
+		table->build(lights);
+		m_lightTable = table;
+	}
+	const std::vector<Light::ptr> &getLights() const { return m_lights; }
+	void setExposure(const float &exposure) { m_exposure = exposure; }
+	void setTextureAnisotropy(TextureAnisotropy anisotropy) { m_maxAnisotropy = 1 << (int)anisotropy; }
 
 	//Fragment shader setting
 	void setAmbientCoef(const glm::vec3 &ka) { m_kA = ka; }
@@ -108,10 +138,10 @@ public:
 	void setSpecularCoef(const glm::vec3 &ks) { m_kS = ks; }
 	void setEmissionColor(const glm::vec3 &ke) { m_kE = ke; }
 	void setTransparency(const float &alpha) { m_transparency = alpha; }
-	void setDiffuseTexId(const int &id) { m_diffuseTexId = id; }
-	void setSpecularTexId(const int &id) { m_specularTexId = id; }
-	void setNormalTexId(const int &id) { m_normalTexId = id; }
-	void setGlowTexId(const int &id) { m_glowTexId = id; }
+	void setDiffuseTexId(const int &id) { m_diffuseTexId = id; m_diffuseTex = getReadyTexture(id); }
+	void setSpecularTexId(const int &id) { m_specularTexId = id; m_specularTex = getReadyTexture(id); }
+	void setNormalTexId(const int &id) { m_normalTexId = id; m_normalTex = getReadyTexture(id); }
+	void setGlowTexId(const int &id) { m_glowTexId = id; m_glowTex = getReadyTexture(id); }
 	void setShininess(const float &shininess) { m_shininess = shininess; }
 
 	//Shaders
@@ -119,6 +149,30 @@ public:
 	virtual void fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const = 0;
 
+	//Quad-wide fragment shader, the four fragments are shaded at once as SIMD lanes
+	//Note: only the active lanes need to be shaded, derivatives are taken from the quad.
+	//      lights are the culled lights which may affect the quad.
+	virtual void fragmentShaderQuad(const QuadFragments &quad, const QuadMask &active, 
+		const LightIndices &lights, glm::vec4 fragColor[4]) const;
+
+	//Shading and output merging of the rasterized quads
+	//Note: the fragment shader is called virtually here, see PipelineT for the specialized one
+	virtual void shadeQuads(std::vector<QuadFragments> &quads, const Context &context, 
+		FrameBuffer *framebuffer, const LightIndices &lights) const;
+
+	//Deferred shading
+	//Geometry pass: the shader outputs the surface attributes of the lanes instead of color
+	virtual bool supportDeferredShading() const { return false; }
+	//Note: unused unless supportDeferredShading is overridden, outputs black surfaces
+	virtual void fragmentShaderGBuffer(const QuadFragments &, const QuadMask &, GBufferTexel texels[4]) const
+	{
+		for (int i = 0; i < 4; ++i)
+			texels[i] = GBufferTexel();
+	}
+	void shadeQuadsGBuffer(std::vector<QuadFragments> &quads, const Context &context, FrameBuffer *framebuffer) const;
+	//Lighting pass: Blinn-Phong lighting of four G-buffer texels with the lights of this pipeline
+	void deferredLightingQuad(const GBufferTexel *texels[4], const LightIndices &lights, glm::vec4 fragColor[4]) const;
+
 	//Rasterization
 	static void rasterizeFillEdgeFunction(
 		const VertexData &v0,
@@ -128,28 +182,132 @@ public:
 		const unsigned int &screenHeight,
 		std::vector<QuadFragments> &rasterized_points);
 
-	//Textures and lights setting
+	//Rasterization limited to the rectangle [rectMin, rectMax], e.g. a screen tile
+	static void rasterizeFillEdgeFunction(
+		const VertexData &v0,
+		const VertexData &v1,
+		const VertexData &v2,
+		const glm::ivec2 &rectMin,
+		const glm::ivec2 &rectMax,
+		std::vector<QuadFragments> &rasterized_points);
+
+	//Textures setting
+	//Note: textures are shared by all the renderers, uploading is thread-safe
 	static int uploadTexture(Texture::ptr tex);
 	static Texture::ptr getTexture(int index);
-	static int addLight(Light::ptr lightSource);
-	static Light::ptr getLight(int index);
-	static void setExposure(const float &exposure) { m_exposure = exposure; }
-	static void setViewerPos(const glm::vec3 &viewer) { m_viewerPos = viewer; }
+	//Reserve a texture unit and load the image in the background, all the pending loads run concurrently
+	//Note: the texture is bound as none (i.e. the material constants) until loaded, or for good if the loading failed
+	static int uploadTextureAsync(const std::string &filepath, bool generatedMipmap,
+		TextureCompressionMode compression = TextureCompressionMode::NONE);
+	//Shared texture of the image file, loaded once for all the models and scenes
+	//Note: deduplicated by the canonical path first and then by the content, with the same loading settings.
+	//      The content is hashed by the background load, a duplicate unit then shares the texture of the first one.
+	//      Each acquiring should be paired with a releasing, the unit is freed once nobody holds it.
+	static int acquireTexture(const std::string &filepath, bool generatedMipmap,
+		TextureCompressionMode compression = TextureCompressionMode::NONE);
+	static void releaseTexture(int index);
+	//Destroy the textures released since last call
+	//Note: the application must call it between the frames of all the renderers as TextureStreaming::update,
+	//      since a released texture could still be sampled in the current frame
+	static void collectReleasedTextures();
+	//Block until all the background loads finished
+	static void waitTextureLoading();
+	//Bumped each time a background load finished, i.e. the shading of the textured draws changed
+	static unsigned int getTextureGeneration() { return m_textureGeneration.load(std::memory_order_acquire); }
+	//Raw pointer of the texture if it is loaded, nullptr otherwise
+	static const Texture *getReadyTexture(int index);
+
+	//Lod level and anisotropic taps from the uv derivatives, shared by the textures of the same size (e.g. the maps of a material)
+	//Note: the footprint is only recomputed once the size of the sampled texture changes
+	class TextureLod final {
+	public:
+		struct Footprint {
+			float m_level = 0.0f;
+			int m_taps = 1;								//Taps along the major axis
+			glm::vec2 m_step = glm::vec2(0.0f);			//Uv offset between the taps
+		};
+
+		TextureLod(const glm::vec2 &dUVdx, const glm::vec2 &dUVdy, const int &maxAnisotropy = 1) :
+			m_dUVdx(dUVdx), m_dUVdy(dUVdy), m_dUVdx2(dUVdx * dUVdx), m_dUVdy2(dUVdy * dUVdy), m_maxAnisotropy(maxAnisotropy) {}
+
+		const Footprint &operator()(const Texture *tex) {
+			static const Footprint base;
+			if (!tex->isGeneratedMipmap())
+				return base;
+			if (tex->getWidth() != m_width || tex->getHeight() != m_height)
+			{
+				m_width = tex->getWidth();
+				m_height = tex->getHeight();
+				resolve();
+			}
+			return m_footprint;
+		}
+
+	private:
+		void resolve() {
+			//Squared lengths of the footprint axes in texels
+			const glm::vec2 size2 = glm::vec2(m_width, m_height) * glm::vec2(m_width, m_height);
+			const float Px = glm::dot(m_dUVdx2, size2), Py = glm::dot(m_dUVdy2, size2);
+			const float Pmax = glm::max(Px, Py), Pmin = glm::min(Px, Py);
+
+			//Anisotropic: the major axis is covered by the taps of the minor axis size, and so is the lod level
+			//Note: rounded to the nearest tap number, so that the nearly isotropic footprints stay single tapped
+			//Refs: https://registry.khronos.org/OpenGL/extensions/EXT/EXT_texture_filter_anisotropic.txt
+			int taps = 1;
+			if (m_maxAnisotropy > 1)
+			{
+				const float ratio2 = Pmax / glm::max(Pmin, 1e-20f);
+				taps = (ratio2 >= (float)(m_maxAnisotropy * m_maxAnisotropy)) ? m_maxAnisotropy : (int)(glm::sqrt(ratio2) + 0.5f);
+			}
+			m_footprint.m_taps = taps;
+			m_footprint.m_step = (taps > 1) ? (Px >= Py ? m_dUVdx : m_dUVdy) / (float)taps : glm::vec2(0.0f);
+			const float L = (taps > 1) ? glm::max(Pmax / (float)(taps * taps), Pmin) : Pmax;
+			m_footprint.m_level = glm::max(0.5f * fastLog2(L), 0.0f);
+		}
 
-	//Texture sampling
+		glm::vec2 m_dUVdx, m_dUVdy;
+		glm::vec2 m_dUVdx2, m_dUVdy2;	//Squared derivatives
+		int m_maxAnisotropy;
+		int m_width = 0, m_height = 0;
+		Footprint m_footprint;
+	};
+
+	//Texture sampling, isotropic with the derivatives
 	static glm::vec4 texture(const unsigned int &id, const glm::vec2 &uv, 
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy);
+	//Note: no bounds checking and reference counting, the texture should be resolved in advance
+	static glm::vec4 texture(const Texture *tex, const glm::vec2 &uv,
+		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy);
+	//Sampling for the four lanes of a quad, which share the derivatives
+	static void textureQuad(const Texture *tex, const glm::vec2 uv[4],
+		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy, glm::vec4 texels[4]);
+	//Sampling with the footprint shared by several textures, anisotropic if the footprint is
+	static glm::vec4 texture(const Texture *tex, const glm::vec2 &uv, TextureLod &lod);
+	static void textureQuad(const Texture *tex, const glm::vec2 uv[4], TextureLod &lod, glm::vec4 texels[4]);
+
+protected:
+	//Lighting of the quad lanes with the packed lights, return the HDR color
+	//Note: diffuse is the albedo multiplied by diffuse coefficient
+	QuadVec3 lightingQuad(const QuadVec3 &fragPos, const QuadVec3 &normal, const QuadVec3 &ambColor,
+		const QuadVec3 &diffuse, const QuadVec3 &speColor, const QuadFloat &shininess, const LightIndices &lights, 
+		const bool &blinn) const;
 
 protected:
 	glm::mat4 m_modelMatrix = glm::mat4(1.0f);
 	glm::mat3 m_invTransModelMatrix = glm::mat3(1.0f);
 	glm::mat4 m_viewProjectMatrix = glm::mat4(1.0f);
+	glm::vec3 m_viewerPos = glm::vec3(0.0f);
+
+	//Lighting settings of the owner renderer
+	std::vector<Light::ptr> m_lights;
+	std::shared_ptr<const LightTable> m_lightTable = std::make_shared<LightTable>();
+	float m_exposure = 1.0f;
+	int m_maxAnisotropy = 1;
 
 	//Global shading setttings
-	static std::vector<Texture::ptr> m_globalTextureUnits;
-	static std::vector<Light::ptr> m_lights;
-	static glm::vec3 m_viewerPos;
-	static float m_exposure;
+	//Note: concurrent_vector keeps the published textures valid while others are being uploaded
+	static tbb::concurrent_vector<Texture::ptr> m_globalTextureUnits;
+	static std::atomic<unsigned int> m_textureGeneration;
 
 	//Material setting
 	glm::vec3 m_kA = glm::vec3(0.0f);
@@ -163,6 +321,13 @@ protected:
 	int m_normalTexId = -1;
 	int m_glowTexId = -1;
 
+	//Textures resolved while setting the ids
+	//Note: textures are only released with their models, i.e. after the draws using them
+	const Texture *m_diffuseTex = nullptr;
+	const Texture *m_specularTex = nullptr;
+	const Texture *m_normalTex = nullptr;
+	const Texture *m_glowTex = nullptr;
+
 	bool m_lightingEnable = true;
 };
 
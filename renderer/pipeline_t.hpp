@@ -0,0 +1,352 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include <glm/glm.hpp>
+
+#include "context.hpp"
+#include "pipeline.hpp"
+#include "frame_buffer.hpp"
+
+namespace sr {
+
+//Early depth testing of a fragment, return false if it should be discarded
+inline bool earlyDepthTest(Pipeline::FragmentData &fragment, const Context &context, FrameBuffer *framebuffer)
+{
+	//Note: spos.x equals -1 -> invalid fragment
+	if (fragment.m_spos.x == -1)
+		return false;
+
+	auto &coverage = fragment.m_coverage;
+	const auto &fragCoord = fragment.m_spos;
+	const int samplingNum = MaskPixelSampler::getSamplingNum();
+
+	int num_failed = 0;
+	//Depth testing for each sampling point (Early Z strategy herein)
+	if (context.m_DepthTestMode == DepthTestMode::DEPTH_TEST_ENABLE)
+	{
+		const auto &coverageDepth = fragment.m_coverageDepth;
+#pragma unroll(3)
+		for (int s = 0; s < samplingNum; ++s)
+		{
+			if (coverage[s] == 1 &&
+				framebuffer->readDepth(fragCoord.x, fragCoord.y, s) >= coverageDepth[s])
+			{
+				coverage[s] = 0;//Occuluded
+				++num_failed;
+			}
+			else if (coverage[s] == 0)
+			{
+				++num_failed;
+			}
+		}
+	}
+
+	//No valid mask, just discard.
+	return num_failed != samplingNum;
+}
+
+//Only the shading of opaque, depth-tested surfaces could be cached and reused across frames
+inline bool temporalReusable(const Context &context, const FrameBuffer *framebuffer)
+{
+	return framebuffer->isTemporalCacheEnabled() &&
+		context.m_AlphaBlendMode == AlphaBlendingMode::ALPHA_DISABLE &&
+		context.m_OITMode == OITMode::OIT_DISABLE &&
+		context.m_DepthTestMode == DepthTestMode::DEPTH_TEST_ENABLE &&
+		context.m_DepthWriteMode == DepthWriteMode::DEPTH_WRITE_ENABLE;
+}
+
+//Output stage of a shaded fragment: alpha to coverage, output merging and depth writing
+inline void mergeFragment(Pipeline::FragmentData &fragment, const glm::vec4 &fragColor, const Context &context,
+	FrameBuffer *framebuffer)
+{
+	auto &coverage = fragment.m_coverage;
+	const auto &fragCoord = fragment.m_spos;
+	const int samplingNum = MaskPixelSampler::getSamplingNum();
+
+	//Alpha to coverage
+	//Note: alpha to coverage only work with MSAA
+	//Refs: http://www.zwqxin.com/archives/opengl/talk-about-alpha-to-coverage.html
+	if (context.m_AlphaBlendMode == AlphaBlendingMode::ALPHA_TO_COVERAGE && samplingNum >= 4)
+	{
+		int num_cancle = samplingNum  - int(samplingNum * fragColor.a);
+		//None left, just discard in advance
+		if (num_cancle == samplingNum)
+		{
+			return;
+		}
+		for (int c = 0; c < num_cancle; ++c)
+		{
+			coverage[c] = 0;
+		}
+	}
+
+	//Order-independent transparency: accumulate into OIT attachments without depth writing
+	if (context.m_OITMode == OITMode::OIT_WEIGHTED_BLENDED)
+	{
+		framebuffer->writeColorWeightedBlended(fragCoord.x, fragCoord.y, fragColor, fragment.m_coverageDepth, coverage);
+		return;
+	}
+	else if (context.m_OITMode == OITMode::OIT_K_BUFFER)
+	{
+		framebuffer->writeColorKBuffer(fragCoord.x, fragCoord.y, fragColor, fragment.m_coverageDepth, coverage);
+		return;
+	}
+
+	//Save the rendered result to frame buffer
+	switch (context.m_AlphaBlendMode)
+	{
+	case AlphaBlendingMode::ALPHA_DISABLE://No alpha blending
+	case AlphaBlendingMode::ALPHA_TO_COVERAGE://Or alpha to coverage
+		framebuffer->writeColorWithMask(fragCoord.x, fragCoord.y, fragColor, coverage);
+		break;
+	case AlphaBlendingMode::ALPHA_BLENDING://Alpha blending
+		framebuffer->writeColorWithMaskAlphaBlending(fragCoord.x, fragCoord.y, fragColor, coverage);
+		break;
+	default:
+		framebuffer->writeColorWithMask(fragCoord.x, fragCoord.y, fragColor, coverage);
+		break;
+	}
+
+	//Depth writing
+	if (context.m_DepthWriteMode == DepthWriteMode::DEPTH_WRITE_ENABLE)
+	{
+		framebuffer->writeDepthWithMask(fragCoord.x, fragCoord.y, fragment.m_coverageDepth, coverage);
+	}
+
+	//Cache the shading for the next frame
+	if (temporalReusable(context, framebuffer))
+	{
+		framebuffer->writeTemporalCache(fragCoord.x, fragCoord.y, fragColor, fragment.m_coverageDepth, coverage);
+	}
+}
+
+//Shading of a 2x2 fragments block
+//Note: 2x2 fragment block as an execution unit for calculating dFdx, dFdy.
+//Scalar fallback of the quad-wide fragment shader: shade the active lanes one by one
+template<typename Shader>
+inline void shadeQuadLanes(const Shader &shader, const Pipeline::QuadFragments &quad, const QuadMask &active,
+	glm::vec4 fragColor[4])
+{
+	//Calculate dUVdx, dUVdy for mipmap
+	glm::vec2 dUVdx(quad.dUdx(), quad.dVdx());
+	glm::vec2 dUVdy(quad.dUdy(), quad.dVdy());
+	for (int i = 0; i < 4; ++i)
+	{
+		if (active[i])
+		{
+			shader.fragmentShader(quad.m_fragments[i], fragColor[i], dUVdx, dUVdy);
+		}
+	}
+}
+
+//Screen position of the f0 lane of a quad, return false if none of its fragments is valid
+inline bool quadOrigin(const Pipeline::QuadFragments &block, glm::ivec2 &origin)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		if (block.m_fragments[i].m_spos.x != -1)
+		{
+			origin = block.m_fragments[i].m_spos - glm::ivec2(i & 1, i >> 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+//Coarse shaded quads whose representative lanes are lit at once, one quad per lane
+struct CoarseQuadBatch {
+	Pipeline::QuadFragments *m_blocks[4];
+	glm::ivec2 m_origins[4];
+	QuadMask m_active[4];
+	QuadMask m_shade[4];
+	glm::vec4 m_fragColor[4][4];
+	GBufferTexel m_texels[4];
+	int m_num = 0;
+
+	//Note: the quads are merged in their drawing order, so a quad must not overlap a pending one
+	bool overlaps(const glm::ivec2 &origin) const
+	{
+		for (int j = 0; j < m_num; ++j)
+		{
+			const glm::ivec2 offset = glm::abs(origin - m_origins[j]);
+			if (offset.x < 2 && offset.y < 2)
+				return true;
+		}
+		return false;
+	}
+
+	template<typename Shader>
+	void flush(const Shader &shader, const Context &context, FrameBuffer *framebuffer, const Pipeline::LightIndices &lights)
+	{
+		if (m_num == 0)
+			return;
+		//Replicate the first texel for the unused lanes
+		const GBufferTexel *texels[4];
+		for (int j = 0; j < 4; ++j)
+			texels[j] = &m_texels[j < m_num ? j : 0];
+		glm::vec4 coarseColor[4];
+		shader.deferredLightingQuad(texels, lights, coarseColor);
+
+		for (int j = 0; j < m_num; ++j)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				if (m_shade[j][i])
+					m_fragColor[j][i] = coarseColor[j];
+				if (m_active[j][i])
+					mergeFragment(m_blocks[j]->m_fragments[i], m_fragColor[j][i], context, framebuffer);
+			}
+		}
+		m_num = 0;
+	}
+};
+
+//Shading loop of the rasterized quads
+//Note: instantiated per shader type, so the shader body could be inlined into the quad loop if it is visible
+template<typename Shader>
+inline void shadeQuadFragments(const Shader &shader, std::vector<Pipeline::QuadFragments> &quads, 
+	const Context &context, FrameBuffer *framebuffer, const Pipeline::LightIndices &lights)
+{
+	const bool reusable = temporalReusable(context, framebuffer);
+	//Coarse shading of a lit surface: only one lane of each quad is lit, so four quads share the lighting
+	//Note: the surface is output as a G-buffer texel, which gives the same color as the forward shading
+	const bool coarseBatched = context.m_ShadingRate == ShadingRate::SHADING_RATE_2X2 && shader.supportDeferredShading();
+	CoarseQuadBatch batch;
+	for (auto &block : quads)
+	{
+		glm::ivec2 origin;
+		if (coarseBatched)
+		{
+			if (!quadOrigin(block, origin))
+				continue;
+			if (batch.overlaps(origin))
+				batch.flush(shader, context, framebuffer, lights);
+		}
+
+		//Perspective correction restore
+		block.aftPrespCorrectionForBlocks();
+
+		QuadMask active;
+		active[0] = earlyDepthTest(block.m_fragments[0], context, framebuffer);
+		active[1] = earlyDepthTest(block.m_fragments[1], context, framebuffer);
+		active[2] = earlyDepthTest(block.m_fragments[2], context, framebuffer);
+		active[3] = earlyDepthTest(block.m_fragments[3], context, framebuffer);
+		if (!(active[0] || active[1] || active[2] || active[3]))
+			continue;
+
+		//Lanes whose shading of last frame is still valid are not shaded again
+		glm::vec4 fragColor[4];
+		QuadMask shade = active;
+		if (reusable)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				const auto &fragment = block.m_fragments[i];
+				if (active[i] && framebuffer->reprojectColor(fragment.m_spos.x, fragment.m_spos.y, fragment.m_pos, fragColor[i]))
+					shade[i] = false;
+			}
+		}
+
+		//Execute fragment shader for all the lanes at once, and save the result to frame buffer
+		if (!(shade[0] || shade[1] || shade[2] || shade[3]))
+		{
+			//Fully reused
+		}
+		else if (context.m_ShadingRate == ShadingRate::SHADING_RATE_2X2)
+		{
+			//Coarse shading: only the first lane to be shaded is shaded, the others reuse its color
+			int first = 0;
+			while (!shade[first])
+				++first;
+			QuadMask single(false);
+			single[first] = true;
+			if (coarseBatched)
+			{
+				GBufferTexel texels[4];
+				shader.fragmentShaderGBuffer(block, single, texels);
+				const int j = batch.m_num++;
+				batch.m_blocks[j] = &block;
+				batch.m_origins[j] = origin;
+				batch.m_active[j] = active;
+				batch.m_shade[j] = shade;
+				batch.m_texels[j] = texels[first];
+				for (int i = 0; i < 4; ++i)
+					batch.m_fragColor[j][i] = fragColor[i];
+				if (batch.m_num == 4)
+					batch.flush(shader, context, framebuffer, lights);
+				continue;
+			}
+
+			//Note: the scalar fallback of the quad shader only shades the active lane
+			glm::vec4 coarseColor[4];
+			shader.fragmentShaderQuad(block, single, lights, coarseColor);
+			for (int i = 0; i < 4; ++i)
+			{
+				if (shade[i])
+					fragColor[i] = coarseColor[first];
+			}
+		}
+		else
+		{
+			glm::vec4 shadedColor[4];
+			shader.fragmentShaderQuad(block, shade, lights, shadedColor);
+			for (int i = 0; i < 4; ++i)
+			{
+				if (shade[i])
+					fragColor[i] = shadedColor[i];
+			}
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			if (active[i])
+			{
+				mergeFragment(block.m_fragments[i], fragColor[i], context, framebuffer);
+			}
+		}
+	}
+	batch.flush(shader, context, framebuffer, lights);
+}
+
+//Compile-time specialized pipeline (CRTP)
+//The shading loop is instantiated with the concrete shader, so that the fragment shader is called 
+//without virtual dispatch and could be inlined. Only one virtual call is made for each batch of quads.
+//Note: Shader should be final and derived from PipelineT<Shader, Base>. Instantiate explicitly in the 
+//      translation unit where the body of Shader::fragmentShader is defined.
+template<typename Shader, typename Base>
+class PipelineT : public Base {
+public:
+	virtual ~PipelineT() = default;
+
+	virtual Pipeline::ptr clone() const override;
+
+	virtual void fragmentShaderQuad(const Pipeline::QuadFragments &quad, const QuadMask &active,
+		const Pipeline::LightIndices &lights, glm::vec4 fragColor[4]) const override;
+
+	virtual void shadeQuads(std::vector<Pipeline::QuadFragments> &quads, const Context &context,
+		FrameBuffer *framebuffer, const Pipeline::LightIndices &lights) const override;
+};
+
+template<typename Shader, typename Base>
+Pipeline::ptr PipelineT<Shader, Base>::clone() const
+{
+	return std::make_shared<Shader>(static_cast<const Shader&>(*this));
+}
+
+template<typename Shader, typename Base>
+void PipelineT<Shader, Base>::fragmentShaderQuad(const Pipeline::QuadFragments &quad, const QuadMask &active,
+	const Pipeline::LightIndices &lights, glm::vec4 fragColor[4]) const
+{
+	//Note: shaders with a quad-wide implementation override this
+	shadeQuadLanes(static_cast<const Shader&>(*this), quad, active, fragColor);
+}
+
+template<typename Shader, typename Base>
+void PipelineT<Shader, Base>::shadeQuads(std::vector<Pipeline::QuadFragments> &quads, const Context &context,
+	FrameBuffer *framebuffer, const Pipeline::LightIndices &lights) const
+{
+	shadeQuadFragments(static_cast<const Shader&>(*this), quads, context, framebuffer, lights);
+}
+
+} // namespace sr
\ No newline at end of file
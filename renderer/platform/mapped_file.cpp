@@ -0,0 +1,91 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace sr {
+
+#ifdef _WIN32
+
+MappedFile::ptr MappedFile::open(const std::string &path) {
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	MappedFile::ptr mapped(new MappedFile());
+	mapped->m_data = static_cast<const unsigned char*>(data);
+	mapped->m_size = static_cast<size_t>(size.QuadPart);
+	mapped->m_file = file;
+	mapped->m_mapping = mapping;
+	return mapped;
+}
+
+MappedFile::~MappedFile() {
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != nullptr)
+		CloseHandle(m_mapping);
+	if (m_file != nullptr)
+		CloseHandle(m_file);
+}
+
+#else
+
+MappedFile::ptr MappedFile::open(const std::string &path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return nullptr;
+	}
+
+	//Note: the mapping stays valid after closing the descriptor
+	void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	MappedFile::ptr mapped(new MappedFile());
+	mapped->m_data = static_cast<const unsigned char*>(data);
+	mapped->m_size = static_cast<size_t>(info.st_size);
+	return mapped;
+}
+
+MappedFile::~MappedFile() {
+	if (m_data != nullptr)
+		munmap(const_cast<unsigned char*>(m_data), m_size);
+}
+
+#endif
+
+} // namespace sr
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+namespace sr {
+
+//Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile final {
+public:
+	typedef std::shared_ptr<MappedFile> ptr;
+
+	//Return nullptr if the file does not exist, is empty or failed to be mapped
+	static ptr open(const std::string &path);
+
+	~MappedFile();
+
+	const unsigned char *data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile &operator=(const MappedFile&) = delete;
+
+private:
+	const unsigned char *m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void *m_file = nullptr;
+	void *m_mapping = nullptr;
+#endif
+};
+
+} // namespace sr
\ No newline at end of file
@@ -0,0 +1,364 @@
+#include "prt.hpp"
+
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+
+#include "math_utils.hpp"
+#include "parallel_wrapper.hpp"
+
+namespace sr {
+
+static constexpr float PRT_PI = 3.14159265358979323846f;
+
+//Stratified directions over the unit sphere
+//Note: a fixed seed keeps the bakes reproducible, which the disk cache relies on
+static std::vector<glm::vec3> stratifiedDirections(const int &sampleNum)
+{
+	const int n = glm::max(1, static_cast<int>(glm::sqrt(static_cast<float>(sampleNum)) + 0.5f));
+	std::mt19937 rng(20210425u);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	std::vector<glm::vec3> dirs;
+	dirs.reserve(n * n);
+	for (int i = 0; i < n; ++i)
+	{
+		for (int j = 0; j < n; ++j)
+		{
+			float u = (i + uniform(rng)) / n, v = (j + uniform(rng)) / n;
+			float cosTheta = 1.0f - 2.0f * u, sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+			float phi = 2.0f * PRT_PI * v;
+			dirs.push_back(glm::vec3(sinTheta * glm::cos(phi), sinTheta * glm::sin(phi), cosTheta));
+		}
+	}
+	return dirs;
+}
+
+//Bounding volume hierarchy of the triangles for the visibility rays
+class TriangleBVH final {
+public:
+	struct Triangle { glm::vec3 m_v0, m_e1, m_e2; };
+
+	void build(std::vector<Triangle> &&triangles)
+	{
+		m_triangles = std::move(triangles);
+		m_nodes.clear();
+		if (m_triangles.empty())
+			return;
+		m_nodes.reserve(m_triangles.size() * 2);
+		buildNode(0, static_cast<int>(m_triangles.size()));
+	}
+
+	//Any hit along the ray within (0, tmax)
+	bool occluded(const glm::vec3 &origin, const glm::vec3 &dir, const float &tmax) const
+	{
+		if (m_nodes.empty())
+			return false;
+		const glm::vec3 invDir = 1.0f / dir;
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node &node = m_nodes[stack[--top]];
+			//Slab test
+			glm::vec3 t0 = (node.m_min - origin) * invDir, t1 = (node.m_max - origin) * invDir;
+			glm::vec3 tnear = glm::min(t0, t1), tfar = glm::max(t0, t1);
+			float enter = glm::max(glm::max(tnear.x, tnear.y), glm::max(tnear.z, 0.0f));
+			float exit = glm::min(glm::min(tfar.x, tfar.y), glm::min(tfar.z, tmax));
+			if (enter > exit)
+				continue;
+
+			if (node.m_count > 0)
+			{
+				for (int i = node.m_start; i < node.m_start + node.m_count; ++i)
+				{
+					if (intersect(m_triangles[i], origin, dir, tmax))
+						return true;
+				}
+			}
+			else
+			{
+				//Note: median splits keep the depth logarithmic, the stack never overflows
+				stack[top++] = node.m_right;
+				stack[top++] = node.m_start;
+			}
+		}
+		return false;
+	}
+
+private:
+	//Leaf: [m_start, m_start + m_count) triangles, inner: children at m_start and m_right
+	struct Node { glm::vec3 m_min, m_max; int m_start, m_count, m_right; };
+
+	static constexpr int LEAF_SIZE = 4;
+
+	int buildNode(const int &begin, const int &end)
+	{
+		const int index = static_cast<int>(m_nodes.size());
+		m_nodes.push_back(Node());
+
+		glm::vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+		glm::vec3 cmin = bmin, cmax = bmax;
+		for (int i = begin; i < end; ++i)
+		{
+			const auto &tri = m_triangles[i];
+			glm::vec3 v1 = tri.m_v0 + tri.m_e1, v2 = tri.m_v0 + tri.m_e2;
+			bmin = glm::min(bmin, glm::min(tri.m_v0, glm::min(v1, v2)));
+			bmax = glm::max(bmax, glm::max(tri.m_v0, glm::max(v1, v2)));
+			glm::vec3 centroid = centroidOf(tri);
+			cmin = glm::min(cmin, centroid);
+			cmax = glm::max(cmax, centroid);
+		}
+		m_nodes[index].m_min = bmin;
+		m_nodes[index].m_max = bmax;
+
+		if (end - begin <= LEAF_SIZE)
+		{
+			m_nodes[index].m_start = begin;
+			m_nodes[index].m_count = end - begin;
+			m_nodes[index].m_right = -1;
+			return index;
+		}
+
+		//Median split along the longest axis of the centroids
+		glm::vec3 extent = cmax - cmin;
+		int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+		const int mid = (begin + end) / 2;
+		std::nth_element(m_triangles.begin() + begin, m_triangles.begin() + mid, m_triangles.begin() + end,
+			[&](const Triangle &a, const Triangle &b) { return centroidOf(a)[axis] < centroidOf(b)[axis]; });
+
+		int left = buildNode(begin, mid);
+		int right = buildNode(mid, end);
+		m_nodes[index].m_start = left;
+		m_nodes[index].m_count = 0;
+		m_nodes[index].m_right = right;
+		return index;
+	}
+
+	static glm::vec3 centroidOf(const Triangle &tri) { return tri.m_v0 + (tri.m_e1 + tri.m_e2) / 3.0f; }
+
+	//Moller-Trumbore ray-triangle intersection, double-sided
+	static bool intersect(const Triangle &tri, const glm::vec3 &origin, const glm::vec3 &dir, const float &tmax)
+	{
+		glm::vec3 pvec = glm::cross(dir, tri.m_e2);
+		float det = glm::dot(tri.m_e1, pvec);
+		if (glm::abs(det) < 1e-12f)
+			return false;
+		float invDet = 1.0f / det;
+		glm::vec3 tvec = origin - tri.m_v0;
+		float u = glm::dot(tvec, pvec) * invDet;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		glm::vec3 qvec = glm::cross(tvec, tri.m_e1);
+		float v = glm::dot(dir, qvec) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		float t = glm::dot(tri.m_e2, qvec) * invDet;
+		return t > 0.0f && t < tmax;
+	}
+
+private:
+	std::vector<Triangle> m_triangles;
+	std::vector<Node> m_nodes;
+};
+
+PRTBaker::PRTBaker(int sampleNum, bool shadowed) : m_sampleNum(glm::max(sampleNum, 1)), m_shadowed(shadowed) {}
+
+void PRTBaker::bake(Model &model, const std::string &cacheDir) const
+{
+	std::string cachePath;
+	if (!cacheDir.empty())
+	{
+		std::stringstream ss;
+		ss << cacheDir << "/" << std::hex << hashModel(model) << ".prt";
+		cachePath = ss.str();
+		if (loadCache(cachePath, model))
+			return;
+	}
+
+	auto &submeshes = model.getDrawableSubMeshes();
+	const glm::mat4 &modelMatrix = model.getModelMatrix();
+	const glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(modelMatrix)));
+
+	//World space triangles of the whole model as the occluders
+	std::vector<TriangleBVH::Triangle> triangles;
+	glm::vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+	for (const auto &mesh : submeshes)
+	{
+		const auto &vertices = mesh.getVertices();
+		const auto &indices = mesh.getIndices();
+		for (size_t f = 0; f + 2 < indices.size(); f += 3)
+		{
+			glm::vec3 v0 = glm::vec3(modelMatrix * glm::vec4(vertices[indices[f + 0]].m_vpositions, 1.0f));
+			glm::vec3 v1 = glm::vec3(modelMatrix * glm::vec4(vertices[indices[f + 1]].m_vpositions, 1.0f));
+			glm::vec3 v2 = glm::vec3(modelMatrix * glm::vec4(vertices[indices[f + 2]].m_vpositions, 1.0f));
+			triangles.push_back({ v0, v1 - v0, v2 - v0 });
+			bmin = glm::min(bmin, glm::min(v0, glm::min(v1, v2)));
+			bmax = glm::max(bmax, glm::max(v0, glm::max(v1, v2)));
+		}
+	}
+	if (triangles.empty())
+		return;
+	const float sceneSize = glm::length(bmax - bmin);
+	const float epsilon = 1e-4f * sceneSize;
+
+	TriangleBVH bvh;
+	if (m_shadowed)
+	{
+		bvh.build(std::move(triangles));
+	}
+
+	//Basis of the sample directions, shared by all the vertices
+	const std::vector<glm::vec3> dirs = stratifiedDirections(m_sampleNum);
+	std::vector<SHTransfer> basis(dirs.size());
+	for (size_t d = 0; d < dirs.size(); ++d)
+	{
+		evalSHBasis(dirs[d], basis[d].data());
+	}
+
+	//Monte Carlo estimation: T_i = 1/pi * integral(V(w) * max(dot(N, w), 0) * Y_i(w))
+	const float weight = 4.0f / static_cast<float>(dirs.size());
+	for (auto &mesh : submeshes)
+	{
+		const auto &vertices = mesh.getVertices();
+		std::vector<SHTransfer> transfer(vertices.size());
+		parallelFor((size_t)0, vertices.size(), [&](const size_t &v)
+		{
+			glm::vec3 pos = glm::vec3(modelMatrix * glm::vec4(vertices[v].m_vpositions, 1.0f));
+			glm::vec3 normal = glm::normalize(normalMatrix * vertices[v].m_vnormals);
+			glm::vec3 origin = pos + normal * epsilon;
+			SHTransfer &result = transfer[v];
+			result.fill(0.0f);
+			for (size_t d = 0; d < dirs.size(); ++d)
+			{
+				float cosTheta = glm::dot(normal, dirs[d]);
+				if (cosTheta <= 0.0f)
+					continue;
+				if (m_shadowed && bvh.occluded(origin, dirs[d], sceneSize))
+					continue;
+				for (int i = 0; i < SH_COEFF_NUM; ++i)
+				{
+					result[i] += basis[d][i] * cosTheta;
+				}
+			}
+			for (int i = 0; i < SH_COEFF_NUM; ++i)
+			{
+				result[i] *= weight;
+			}
+		}, ExecutionPolicy::PARALLEL);
+		mesh.setPRTTransfer(transfer);
+	}
+
+	if (!cachePath.empty())
+	{
+		saveCache(cachePath, model);
+	}
+}
+
+SHLighting PRTBaker::projectLighting(const std::function<glm::vec3(const glm::vec3 &dir)> &radiance, int sampleNum)
+{
+	SHLighting lighting;
+	lighting.fill(glm::vec3(0.0f));
+	const std::vector<glm::vec3> dirs = stratifiedDirections(glm::max(sampleNum, 1));
+	const float weight = 4.0f * PRT_PI / static_cast<float>(dirs.size());
+	float basis[SH_COEFF_NUM];
+	for (const auto &dir : dirs)
+	{
+		glm::vec3 L = radiance(dir);
+		evalSHBasis(dir, basis);
+		for (int i = 0; i < SH_COEFF_NUM; ++i)
+		{
+			lighting[i] += L * (basis[i] * weight);
+		}
+	}
+	return lighting;
+}
+
+size_t PRTBaker::hashModel(Model &model) const
+{
+	size_t hash = FNV_OFFSET_BASIS;
+	const int coeffNum = SH_COEFF_NUM;
+	fnv1aHash(hash, &coeffNum, sizeof(coeffNum));
+	fnv1aHash(hash, &m_sampleNum, sizeof(m_sampleNum));
+	fnv1aHash(hash, &m_shadowed, sizeof(m_shadowed));
+	fnv1aHash(hash, &model.getModelMatrix(), sizeof(glm::mat4));
+	for (const auto &mesh : model.getDrawableSubMeshes())
+	{
+		for (const auto &vertex : mesh.getVertices())
+		{
+			fnv1aHash(hash, &vertex.m_vpositions, sizeof(glm::vec3));
+			fnv1aHash(hash, &vertex.m_vnormals, sizeof(glm::vec3));
+		}
+		const auto &indices = mesh.getIndices();
+		if (!indices.empty())
+		{
+			fnv1aHash(hash, indices.data(), indices.size() * sizeof(unsigned int));
+		}
+	}
+	return hash;
+}
+
+//Cache file layout: "PRT1", coefficient number, submesh number, then the vertex number and transfer of each submesh
+bool PRTBaker::loadCache(const std::string &path, Model &model) const
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	char magic[4];
+	uint32_t coeffNum = 0, meshNum = 0;
+	file.read(magic, 4);
+	file.read(reinterpret_cast<char*>(&coeffNum), sizeof(coeffNum));
+	file.read(reinterpret_cast<char*>(&meshNum), sizeof(meshNum));
+	auto &submeshes = model.getDrawableSubMeshes();
+	if (!file || std::string(magic, 4) != "PRT1" || coeffNum != SH_COEFF_NUM || meshNum != submeshes.size())
+		return false;
+
+	std::vector<std::vector<SHTransfer>> transfers(meshNum);
+	for (uint32_t m = 0; m < meshNum; ++m)
+	{
+		uint32_t vertexNum = 0;
+		file.read(reinterpret_cast<char*>(&vertexNum), sizeof(vertexNum));
+		if (!file || vertexNum != submeshes[m].getVertices().size())
+			return false;
+		transfers[m].resize(vertexNum);
+		file.read(reinterpret_cast<char*>(transfers[m].data()), vertexNum * sizeof(SHTransfer));
+		if (!file)
+			return false;
+	}
+
+	for (uint32_t m = 0; m < meshNum; ++m)
+	{
+		submeshes[m].setPRTTransfer(transfers[m]);
+	}
+	return true;
+}
+
+void PRTBaker::saveCache(const std::string &path, Model &model) const
+{
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cerr << "Failed to write the PRT cache: " << path << std::endl;
+		return;
+	}
+
+	const auto &submeshes = model.getDrawableSubMeshes();
+	const uint32_t coeffNum = SH_COEFF_NUM, meshNum = static_cast<uint32_t>(submeshes.size());
+	file.write("PRT1", 4);
+	file.write(reinterpret_cast<const char*>(&coeffNum), sizeof(coeffNum));
+	file.write(reinterpret_cast<const char*>(&meshNum), sizeof(meshNum));
+	for (const auto &mesh : submeshes)
+	{
+		const auto &transfer = mesh.getPRTTransfer();
+		const uint32_t vertexNum = static_cast<uint32_t>(transfer.size());
+		file.write(reinterpret_cast<const char*>(&vertexNum), sizeof(vertexNum));
+		file.write(reinterpret_cast<const char*>(transfer.data()), vertexNum * sizeof(SHTransfer));
+	}
+}
+
+} // namespace sr
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <functional>
+
+#include <glm/glm.hpp>
+
+#include "model.hpp"
+#include "spherical_harmonics.hpp"
+
+namespace sr {
+
+//Baking of the precomputed radiance transfer (diffuse, self-shadowed) of static models
+//Refs: Sloan et al., Precomputed Radiance Transfer for Real-Time Rendering in Dynamic, Low-Frequency Lighting Environments
+class PRTBaker final {
+public:
+	//sampleNum: number of the stratified directions over the sphere for each vertex
+	PRTBaker(int sampleNum = 256, bool shadowed = true);
+	~PRTBaker() = default;
+
+	//Bake the world space transfer of all the submeshes with the current model matrix
+	//Note: loaded from cacheDir if baked before, the cache is keyed by the hash of the meshes and the settings.
+	//      An empty cacheDir disables the disk cache.
+	void bake(Model &model, const std::string &cacheDir) const;
+
+	//Project the distant lighting onto the SH basis, radiance is the incident radiance from the direction
+	static SHLighting projectLighting(const std::function<glm::vec3(const glm::vec3 &dir)> &radiance, int sampleNum = 4096);
+
+private:
+	size_t hashModel(Model &model) const;
+	bool loadCache(const std::string &path, Model &model) const;
+	void saveCache(const std::string &path, Model &model) const;
+
+private:
+	int m_sampleNum;
+	bool m_shadowed;
+};
+
+} // namespace sr
\ No newline at end of file
@@ -4,312 +4,259 @@
 
 #include "pipeline.hpp"
 #include "shader.hpp"
+#include "shadow_map.hpp"
+#include "texture_streaming.hpp"
 #include "math_utils.hpp"
 #include "parallel_wrapper.hpp"
 
-#include <tbb/parallel_pipeline.h>
-#include <tbb/task_arena.h>
+#include <tbb/flow_graph.h>
+#include <tbb/concurrent_vector.h>
+#include <tbb/enumerable_thread_specific.h>
 
-#include <mutex>
 #include <atomic>
-#include <thread>
+#include <limits>
+#include <algorithm>
 
 
 namespace sr {
 
-using MutexType = tbb::spin_mutex;				//TBB thread mutex type
 static constexpr int PIPELINE_BATCH_SIZE = 512; //The number of faces processed for each batch
+static constexpr int TILE_SIZE = 32;			//The width and height of a screen tile in pixels
 
-//The cache for rasterized results. For example: the face i -> FragmentCache[i]
-using FragmentCache = std::array<std::vector<Pipeline::QuadFragments>, PIPELINE_BATCH_SIZE>;
+//A screen space triangle waiting for rasterization
+struct RasterTriangle {
+	Pipeline::VertexData m_vertices[3];
+	int m_command;								//Index of the draw command
+};
 
+//Reference to a triangle in the bin of a tile
+//Note: batches are numbered in submission order, so (batch, index) is the submission order of triangles
+struct TriangleRef {
+	unsigned int m_batch;						//Face batch which produced the triangle
+	unsigned int m_index;						//Triangle index in the batch
 
-//Draw call setting which would be utilized in shading parallel pipeline 
-class DrawcallSetting final {
-public:
-	const VertexBuffer &m_vertexBuffer;			//Vertex data buffer
-	const IndexBuffer  &m_indexBuffer;			//Index data buffer
-	Pipeline *m_pipelineHandler;			//Shader handler
-	const Context &m_context;			//Shading state
-	const glm::mat4 &m_viewportMatrix;			//Viewport transformation matrix
-	float m_near, m_far;							//Near plane and far plane of frustum
-	FrameBuffer *m_frameBuffer;					//Framebuffer 
-
-	explicit DrawcallSetting(const VertexBuffer& vbo, const IndexBuffer& ibo, Pipeline* handler,
-		const Context& context, const glm::mat4& viewportMat, float np, float fp, FrameBuffer* fb)
-		: m_vertexBuffer(vbo), m_indexBuffer(ibo), m_pipelineHandler(handler), m_context(context),
-		m_viewportMatrix(viewportMat), m_near(np), m_far(fp), m_frameBuffer(fb) {}
+	bool operator<(const TriangleRef &rhs) const {
+		return m_batch < rhs.m_batch || (m_batch == rhs.m_batch && m_index < rhs.m_index);
+	}
 };
 
+using TileBin = tbb::concurrent_vector<TriangleRef>;
 
-//Each point (i,j) of framebuffer have its own mutex lock for avoiding accessing conflict among different threads
-class FramebufferMutex final {
-public:
-	FramebufferMutex(int width, int height)
-		: m_width(width), m_height(height) {
-		m_mutexBuffer.resize(width * height, nullptr);
-		for (int i = 0; i < width * height; ++i)
-		{
-			m_mutexBuffer[i] = new MutexType();
-		}
-	}
 
-	~FramebufferMutex() {
-		for (auto &mutex : m_mutexBuffer)
-		{
-			delete mutex;
-			mutex = nullptr;
-		}
+//Scratch memory of the shading pipeline for one render target.
+//Note: each target owns its scratch so that different targets could be drawn simultaneously
+class DrawcallScratch final {
+public:
+	DrawcallScratch(int width, int height) : m_width(width), m_height(height) {
+		m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+		m_bins.resize(m_tilesX * m_tilesY);
+		m_tileLights.resize(m_tilesX * m_tilesY);
 	}
 
-	MutexType &getLocker(const int &x, const int &y) {
-		return *m_mutexBuffer[y * m_width + x];
+	int getWidth() const { return m_width; }
+	int getHeight() const { return m_height; }
+	int getTileNum() const { return m_tilesX * m_tilesY; }
+
+	//Note: capacities are kept among frames
+	void prepare(size_t numCommands, size_t numBatches) {
+		m_vertexStreams.resize(numCommands);
+		m_batchTriangles.resize(numBatches);
+		for (auto &triangles : m_batchTriangles)
+			triangles.clear();
+		for (auto &bin : m_bins)
+			bin.clear();
 	}
 
-public:
-	using MutexBuffer = std::vector<MutexType*>;
 	int m_width, m_height;
-	MutexBuffer m_mutexBuffer;
+	int m_tilesX, m_tilesY;
+
+	//Vertex shader outputs of each command
+	std::vector<std::vector<Pipeline::VertexData>> m_vertexStreams;
+	//Setup triangles of each face batch
+	std::vector<std::vector<RasterTriangle>> m_batchTriangles;
+	//Triangle bins of each tile
+	std::vector<TileBin> m_bins;
+	//Culled lights of each tile
+	std::vector<Pipeline::LightIndices> m_tileLights;
+	//Rasterized quads of the tile being processed by current thread
+	tbb::enumerable_thread_specific<std::vector<Pipeline::QuadFragments>> m_tileQuads;
 };
 
 
-//Vertex transformation, cliping, culling and rasterization.
-class TBBVertexRastFilter final {
-public:
-	explicit TBBVertexRastFilter(int bs, int startIndex, int overIndex, const DrawcallSetting &drawcall,
-		FragmentCache &cache) : m_batchSize(bs), m_startIndex(startIndex), m_overIndex(overIndex),
-		m_drawCall(drawcall), m_fragmentCache(cache) {
-		m_currIndex.store(startIndex);
-	}
+//Screen space bounding rectangle of a world space box, return false if it is invisible
+static bool boxScreenRect(const glm::vec3 &boxMin, const glm::vec3 &boxMax, const glm::mat4 &viewProjectMatrix,
+	const glm::mat4 &viewportMatrix, const int &width, const int &height, glm::ivec2 &rectMin, glm::ivec2 &rectMax)
+{
+	rectMin = glm::ivec2(0, 0);
+	rectMax = glm::ivec2(width - 1, height - 1);
 
-	int operator()(tbb::flow_control &fc) const {
-		//Note: process the faces in [startIndex, overIndex) parallely
-		int faceIndex = 0;
-		//Fetch the face index that needs to be processed.
+	//Project the corners of the box
+	glm::vec2 minPos(std::numeric_limits<float>::max()), maxPos(-std::numeric_limits<float>::max());
+	int num_behind = 0;
+	for (int c = 0; c < 8; ++c)
+	{
+		glm::vec3 corner((c & 1) ? boxMax.x : boxMin.x, (c & 2) ? boxMax.y : boxMin.y, (c & 4) ? boxMax.z : boxMin.z);
+		glm::vec4 clipPos = viewProjectMatrix * glm::vec4(corner, 1.0f);
+		if (clipPos.w <= 1e-5f)
 		{
-			//Note: an atomic add herein for excusively accesing the face
-			if ((faceIndex = m_currIndex.fetch_add(1)) >= m_overIndex)
-			{
-				fc.stop();//Exceed range, stop the processing flow
-				return -1;
-			}
+			++num_behind;
+			continue;
 		}
+		glm::vec2 screenPos = glm::vec2(viewportMatrix * (clipPos / clipPos.w));
+		minPos = glm::min(minPos, screenPos);
+		maxPos = glm::max(maxPos, screenPos);
+	}
 
-		//The fragment cache index
-		int order = faceIndex - m_startIndex;
-		faceIndex *= 3;
-
-		Pipeline::VertexData v[3];
-		const auto &indexBuffer = m_drawCall.m_indexBuffer;
-		const auto &vertexBuffer = m_drawCall.m_vertexBuffer;
-#pragma unroll(3)
-		for (int i = 0; i < 3; ++i)
-		{
-			v[i].m_pos = vertexBuffer[indexBuffer[faceIndex + i]].m_vpositions;
-			v[i].m_nor = vertexBuffer[indexBuffer[faceIndex + i]].m_vnormals;
-			v[i].m_tex = vertexBuffer[indexBuffer[faceIndex + i]].m_vtexcoords;
-			v[i].m_tbn[0] = vertexBuffer[indexBuffer[faceIndex + i]].m_vtangent;
-			v[i].m_tbn[1] = vertexBuffer[indexBuffer[faceIndex + i]].m_vbitangent;
-		}
+	//Entirely behind the viewer
+	if (num_behind == 8)
+		return false;
+	//Crossing the camera plane, just regard it as covering the whole screen
+	if (num_behind > 0)
+		return true;
 
-		//Vertex shader stage
-		m_drawCall.m_pipelineHandler->vertexShader(v[0]);
-		m_drawCall.m_pipelineHandler->vertexShader(v[1]);
-		m_drawCall.m_pipelineHandler->vertexShader(v[2]);
+	rectMin = glm::max(glm::ivec2(minPos), rectMin);
+	rectMax = glm::min(glm::ivec2(maxPos) + glm::ivec2(1), rectMax);
+	return rectMin.x <= rectMax.x && rectMin.y <= rectMax.y;
+}
 
-		//Homogeneous space cliping
-		std::vector<Pipeline::VertexData> clipped_vertices;
-		clipped_vertices = Renderer::clipingSutherlandHodgeman(v[0], v[1], v[2], m_drawCall.m_near, m_drawCall.m_far);
-		if (clipped_vertices.empty()) {
-			return -1; //Totally outside
-		}
+//Screen space bounding rectangle of the influence sphere of a light, return false if it is invisible
+static bool lightScreenRect(const Light &light, const glm::mat4 &viewProjectMatrix, const glm::mat4 &viewportMatrix,
+	const int &width, const int &height, glm::ivec2 &rectMin, glm::ivec2 &rectMax)
+{
+	//Unbounded light affects all the tiles
+	rectMin = glm::ivec2(0, 0);
+	rectMax = glm::ivec2(width - 1, height - 1);
+	glm::vec3 center;
+	float radius;
+	if (!light.influenceSphere(center, radius))
+		return true;
+
+	return boxScreenRect(center - glm::vec3(radius), center + glm::vec3(radius), viewProjectMatrix, viewportMatrix,
+		width, height, rectMin, rectMax);
+}
 
-		//Perspective division: from clip space -> ndc space
-		for (auto &vert : clipped_vertices) {
-			Pipeline::VertexData::prePerspCorrection(vert);
-			vert.m_cpos *= vert.m_rhw;
+//Deferred lighting pass of a tile: shade the G-buffer texels, four pixels at once
+//Note: the lit texels are emptied, so that the G-buffer needs no clearing
+static void deferredLightingTile(const Pipeline &handler, FrameBuffer *target, const glm::ivec2 &rectMin,
+	const glm::ivec2 &rectMax, const Pipeline::LightIndices &lights)
+{
+	const GBufferTexel *texels[4];
+	GBufferTexel *lit[4];
+	glm::ivec2 coords[4];
+	int num = 0;
+	auto flush = [&]()
+	{
+		//Replicate the first texel for the unused lanes
+		for (int i = num; i < 4; ++i)
+			texels[i] = texels[0];
+		glm::vec4 fragColor[4];
+		handler.deferredLightingQuad(texels, lights, fragColor);
+		for (int i = 0; i < num; ++i)
+		{
+			target->writeColorWithMask(coords[i].x, coords[i].y, fragColor[i], lit[i]->m_coverage);
+			lit[i]->m_coverage = 0;
 		}
+		num = 0;
+	};
 
-		int num_verts = clipped_vertices.size();
-		for (int i = 0; i < num_verts - 2; ++i) {
-			//Triangle assembly
-			Pipeline::VertexData vert[3] = { clipped_vertices[0], clipped_vertices[i + 1], clipped_vertices[i + 2] };
-
-			//Transform to screen space
-			vert[0].m_spos = glm::ivec2(m_drawCall.m_viewportMatrix * vert[0].m_cpos + glm::vec4(0.5f));
-			vert[1].m_spos = glm::ivec2(m_drawCall.m_viewportMatrix * vert[1].m_cpos + glm::vec4(0.5f));
-			vert[2].m_spos = glm::ivec2(m_drawCall.m_viewportMatrix * vert[2].m_cpos + glm::vec4(0.5f));
-
-			//Backface culling
-			if (shouldCulled(vert[0].m_spos, vert[1].m_spos, vert[2].m_spos, m_drawCall.m_context.m_CullFaceMode))
+	for (int y = rectMin.y; y <= rectMax.y; ++y)
+	{
+		for (int x = rectMin.x; x <= rectMax.x; ++x)
+		{
+			//Each surface kept is lit for its own sampling points
+			for (auto &texel : target->getGBufferPixel(x, y).m_surfaces)
 			{
-				continue;
+				bool empty = true;
+				for (int s = 0; s < texel.m_coverage.getSamplingNum(); ++s)
+					empty = empty && texel.m_coverage[s] == 0;
+				if (empty)
+					continue;
+
+				texels[num] = &texel;
+				lit[num] = &texel;
+				coords[num] = glm::ivec2(x, y);
+				if (++num == 4)
+					flush();
 			}
-
-			//Rasterization
-			Pipeline::rasterizeFillEdgeFunction(vert[0], vert[1], vert[2],
-				m_drawCall.m_frameBuffer->getWidth(), m_drawCall.m_frameBuffer->getHeight(), m_fragmentCache[order]);
 		}
-
-		return order;
 	}
+	if (num > 0)
+		flush();
+}
 
-private:
+static inline bool shouldCulled(const glm::ivec2 &v0, const glm::ivec2 &v1, const glm::ivec2 &v2, CullFaceMode mode)
+{
+	if (mode == CullFaceMode::CULL_DISABLE)
+		return false;
+	//Back face culling in screen space
+	auto e1 = v1 - v0;
+	auto e2 = v2 - v0;
+	int orient = e1.x * e2.y - e1.y * e2.x;
+	return (mode == CullFaceMode::CULL_BACK) ? orient > 0 : orient < 0;
+}
 
-	static inline bool shouldCulled(const glm::ivec2 &v0, const glm::ivec2 &v1, const glm::ivec2 &v2, CullFaceMode mode)
+//Fetch the vertex shader outputs of the face
+static inline void fetchFace(const DrawCommand &cmd, const std::vector<Pipeline::VertexData> &vertices, 
+	const int &faceIndex, Pipeline::VertexData v[3])
+{
+	const auto &indexBuffer = cmd.m_mesh->getIndices();
+#pragma unroll(3)
+	for (int i = 0; i < 3; ++i)
 	{
-		if (mode == CullFaceMode::CULL_DISABLE)
-			return false;
-		//Back face culling in screen space
-		auto e1 = v1 - v0;
-		auto e2 = v2 - v0;
-		int orient = e1.x * e2.y - e1.y * e2.x;
-		return (mode == CullFaceMode::CULL_BACK) ? orient > 0 : orient < 0;
+		v[i] = vertices[indexBuffer[faceIndex * 3 + i]];
 	}
 
-private:
-	int m_batchSize;
-	const int m_startIndex;
-	const int m_overIndex;
-	const DrawcallSetting &m_drawCall;
-
-	//this is for excessively accessing to face among threads
-	static std::atomic<int> m_currIndex;
-
-	FragmentCache &m_fragmentCache;
-};
-
-std::atomic<int> TBBVertexRastFilter::m_currIndex;
-
-
-//Fragment shader execution
-class TBBFragmentFilter final
-{
-public:
-	explicit TBBFragmentFilter(int bs, const DrawcallSetting &drawcall, FragmentCache &cache, FramebufferMutex &fbMutex)
-		: m_batchSize(bs), m_drawCall(drawcall), m_fragmentCache(cache), m_framebufferMutex(fbMutex) {}
-
-	void operator()(int index) const
+	//Vertex shader had been executed once for all views, only the view projection is left
+	if (cmd.m_sharedVertices != nullptr)
 	{
-		//No fragments
-		if (index == -1 || m_fragmentCache[index].empty())
-			return;
-
-		//Fragment shader & Depth testing
-		auto fragment_func = [&](Pipeline::FragmentData &fragment, const glm::vec2 &dUVdx, const glm::vec2 &dUVdy)
-		{
-			//Note: spos.x equals -1 -> invalid fragment
-			if (fragment.m_spos.x == -1)
-				return;
-
-			auto &coverage = fragment.m_coverage;
-			const auto &fragCoord = fragment.m_spos;
-			auto &framebuffer = m_drawCall.m_frameBuffer;
-			const auto &context = m_drawCall.m_context;
-
-			//A mutex locker herein for (x,y) to prevent from simultanenously accessing depth buffer at the same place
-			MutexType::scoped_lock lock(m_framebufferMutex.getLocker(fragCoord.x, fragCoord.y));
-
-			const int samplingNum = MaskPixelSampler::getSamplingNum();
-
-			int num_failed = 0;
-			//Depth testing for each sampling point (Early Z strategy herein)
-			if (context.m_DepthTestMode == DepthTestMode::DEPTH_TEST_ENABLE)
-			{
-				const auto &coverageDepth = fragment.m_coverageDepth;
-#pragma unroll(3)
-				for (int s = 0; s < samplingNum; ++s)
-				{
-					if (coverage[s] == 1 &&
-						framebuffer->readDepth(fragCoord.x, fragCoord.y, s) >= coverageDepth[s])
-					{
-						coverage[s] = 0;//Occuluded
-						++num_failed;
-					}
-					else if (coverage[s] == 0)
-					{
-						++num_failed;
-					}
-				}
-			}
-
-			//No valid mask, just discard.
-			if (num_failed == samplingNum)
-				return;
+		v[0].m_cpos = cmd.m_viewProjectMatrix * v[0].m_cpos;
+		v[1].m_cpos = cmd.m_viewProjectMatrix * v[1].m_cpos;
+		v[2].m_cpos = cmd.m_viewProjectMatrix * v[2].m_cpos;
+	}
+}
 
-			//Execute fragment shader, and save the result to frame buffer
-			glm::vec4 fragColor;
-			m_drawCall.m_pipelineHandler->fragmentShader(fragment, fragColor, dUVdx, dUVdy);
+//Cliping, perspective division, viewport transformation and face culling.
+//Note: each resulted screen space triangle is handed to func(v0, v1, v2)
+template <typename Function>
+static void setupTriangles(const Pipeline::VertexData v[3], const float &near, const float &far,
+	const glm::mat4 &viewportMatrix, CullFaceMode cullMode, const Function &func)
+{
+	//Homogeneous space cliping
+	std::vector<Pipeline::VertexData> clipped_vertices;
+	clipped_vertices = Renderer::clipingSutherlandHodgeman(v[0], v[1], v[2], near, far);
+	if (clipped_vertices.empty()) {
+		return; //Totally outside
+	}
 
-			//Alpha to coverage
-			//Note: alpha to coverage only work with MSAA
-			//Refs: http://www.zwqxin.com/archives/opengl/talk-about-alpha-to-coverage.html
-			if (context.m_AlphaBlendMode == AlphaBlendingMode::ALPHA_TO_COVERAGE && samplingNum >= 4)
-			{
-				int num_cancle = samplingNum  - int(samplingNum * fragColor.a);
-				//None left, just discard in advance
-				if (num_cancle == samplingNum)
-				{
-					return;
-				}
-				for (int c = 0; c < num_cancle; ++c)
-				{
-					coverage[c] = 0;
-				}
-			}
+	//Perspective division: from clip space -> ndc space
+	for (auto &vert : clipped_vertices) {
+		Pipeline::VertexData::prePerspCorrection(vert);
+		vert.m_cpos *= vert.m_rhw;
+	}
 
-			//Save the rendered result to frame buffer
-			switch (context.m_AlphaBlendMode)
-			{
-			case AlphaBlendingMode::ALPHA_DISABLE://No alpha blending
-			case AlphaBlendingMode::ALPHA_TO_COVERAGE://Or alpha to coverage
-				framebuffer->writeColorWithMask(fragCoord.x, fragCoord.y, fragColor, coverage);
-				break;
-			case AlphaBlendingMode::ALPHA_BLENDING://Alpha blending
-				framebuffer->writeColorWithMaskAlphaBlending(fragCoord.x, fragCoord.y, fragColor, coverage);
-				break;
-			default:
-				framebuffer->writeColorWithMask(fragCoord.x, fragCoord.y, fragColor, coverage);
-				break;
-			}
+	int num_verts = clipped_vertices.size();
+	for (int i = 0; i < num_verts - 2; ++i) {
+		//Triangle assembly
+		Pipeline::VertexData vert[3] = { clipped_vertices[0], clipped_vertices[i + 1], clipped_vertices[i + 2] };
 
-			//Depth writing
-			if (context.m_DepthWriteMode == DepthWriteMode::DEPTH_WRITE_ENABLE)
-			{
-				framebuffer->writeDepthWithMask(fragCoord.x, fragCoord.y, fragment.m_coverageDepth, coverage);
-			}
-			
-		};
+		//Transform to screen space
+		vert[0].m_spos = glm::ivec2(viewportMatrix * vert[0].m_cpos + glm::vec4(0.5f));
+		vert[1].m_spos = glm::ivec2(viewportMatrix * vert[1].m_cpos + glm::vec4(0.5f));
+		vert[2].m_spos = glm::ivec2(viewportMatrix * vert[2].m_cpos + glm::vec4(0.5f));
 
-		//Note: 2x2 fragment block as an execution unit for calculating dFdx, dFdy.
-		parallelFor((size_t)0, (size_t)m_fragmentCache[index].size(), [&](const size_t &f)
+		//Backface culling
+		if (shouldCulled(vert[0].m_spos, vert[1].m_spos, vert[2].m_spos, cullMode))
 		{
-			auto &block = m_fragmentCache[index][f];
-
-			//Perspective correction restore
-			block.aftPrespCorrectionForBlocks();
-
-			//Calculate dUVdx, dUVdy for mipmap
-			glm::vec2 dUVdx(block.dUdx(), block.dVdx());
-			glm::vec2 dUVdy(block.dUdy(), block.dVdy());
-
-			fragment_func(block.m_fragments[0], dUVdx, dUVdy);
-			fragment_func(block.m_fragments[1], dUVdx, dUVdy);
-			fragment_func(block.m_fragments[2], dUVdx, dUVdy);
-			fragment_func(block.m_fragments[3], dUVdx, dUVdy);
-
-		}, ExecutionPolicy::PARALLEL);
+			continue;
+		}
 
-		m_fragmentCache[index].clear();
+		func(vert[0], vert[1], vert[2]);
 	}
+}
 
-private:
-	int m_batchSize;
-	const DrawcallSetting &m_drawCall;
-	FragmentCache &m_fragmentCache;
-	FramebufferMutex &m_framebufferMutex;
-};
-
+//Fragment shader & Depth testing
+//Note: the caller should make sure that no other thread is accessing (x,y) of the framebuffer
 //----------------------------------------------TRRenderer----------------------------------------------
 
 Renderer::Renderer(int width, int height) : m_backBuffer(nullptr), m_frontBuffer(nullptr) {
@@ -317,6 +264,7 @@ Renderer::Renderer(int width, int height) : m_backBuffer(nullptr), m_frontBuffer
 	m_backBuffer = std::make_shared<FrameBuffer>(width, height);
 	m_frontBuffer = std::make_shared<FrameBuffer>(width, height);
 	m_renderedImg.resize(width * height * 3, 0);
+	m_scratch = std::make_shared<DrawcallScratch>(width, height);
 
 	//Setup viewport matrix (ndc space -> screen space)
 	m_viewportMatrix = calcViewPortMatrix(width, height);
@@ -343,18 +291,35 @@ void Renderer::unloadDrawableMesh()
 
 void Renderer::setViewerPos(const glm::vec3 &viewer)
 {
+	m_viewerPos = viewer;
 	if (m_pipelineHandler == nullptr)
 		return;
 	m_pipelineHandler->setViewerPos(viewer);
 }
 
-int Renderer::addLightSource(Light::ptr lightSource) { return Pipeline::addLight(lightSource); }
+int Renderer::addLightSource(Light::ptr lightSource)
+{
+	m_lights.push_back(lightSource);
+	m_historyValid = false;
+	m_trackedValid = false;
+	return m_lights.size() - 1;
+}
 
-Light::ptr Renderer::getLightSource(const int &index) { return Pipeline::getLight(index); }
+Light::ptr Renderer::getLightSource(const int &index)
+{
+	if (index < 0 || index >= (int)m_lights.size())
+		return nullptr;
+	return m_lights[index];
+}
 
-void Renderer::setExposure(const float &exposure) { Pipeline::setExposure(exposure); }
+void Renderer::setExposure(const float &exposure) 
+{ 
+	m_exposure = exposure;
+	m_historyValid = false;
+	m_trackedValid = false;
+}
 
-unsigned int Renderer::renderAllModels()
+bool Renderer::preparePipelineHandler()
 {
 	if (m_pipelineHandler == nullptr)
 	{
@@ -364,13 +329,280 @@ unsigned int Renderer::renderAllModels()
 	//Load the matrices
 	m_pipelineHandler->setModelMatrix(m_modelMatrix);
 	m_pipelineHandler->setViewProjectMatrix(m_projectMatrix * m_viewMatrix);
+	m_pipelineHandler->setViewerPos(m_viewerPos);
+	bool shadowsChanged = updateShadowMaps();
+	m_pipelineHandler->setLights(m_lights);
+	m_pipelineHandler->setExposure(m_exposure);
+	m_pipelineHandler->setTextureAnisotropy(m_textureAnisotropy);
+	return shadowsChanged;
+}
 
-	//Draw a mesh step by step
-	unsigned int num_triangles = 0;
+bool Renderer::updateShadowMaps()
+{
+	bool changed = false;
+	static constexpr int SHADOW_MAP_RESOLUTION = 1024;
+	static constexpr int SHADOW_CUBE_MAP_RESOLUTION = 512;
 
+	m_shadowsChanged.assign(m_lights.size(), 0);
+	for (size_t l = 0; l < m_lights.size(); ++l)
+	{
+		const auto &light = m_lights[l];
+		if (!light->isCastShadow())
+			continue;
+		if (light->getShadowMap() == nullptr)
+		{
+			//Note: cube maps of point lights are rendered six times, hence a lower resolution
+			bool cube = dynamic_cast<const PointLight*>(light.get()) != nullptr && 
+				dynamic_cast<const SpotLight*>(light.get()) == nullptr;
+			light->setShadowMap(std::make_shared<ShadowMap>(cube ? SHADOW_CUBE_MAP_RESOLUTION : SHADOW_MAP_RESOLUTION));
+		}
+		m_shadowsChanged[l] = light->getShadowMap()->update(*light, m_models) ? 1 : 0;
+		changed = changed || m_shadowsChanged[l] != 0;
+	}
+	return changed;
+}
+
+void Renderer::markTilesDirty(const TrackedRect &rect, std::vector<unsigned char> &dirtyTiles) const
+{
+	if (!rect.m_visible)
+		return;
+	const int tilesX = m_scratch->m_tilesX;
+	for (int ty = rect.m_min.y / TILE_SIZE; ty <= rect.m_max.y / TILE_SIZE; ++ty)
+	{
+		for (int tx = rect.m_min.x / TILE_SIZE; tx <= rect.m_max.x / TILE_SIZE; ++tx)
+		{
+			dirtyTiles[ty * tilesX + tx] = 1;
+		}
+	}
+}
+
+bool Renderer::trackChanges(std::vector<unsigned char> &dirtyTiles, bool &viewChanged)
+{
+	const int width = m_backBuffer->getWidth(), height = m_backBuffer->getHeight();
+	const glm::mat4 viewProject = m_projectMatrix * m_viewMatrix;
+	const glm::mat4 viewportMatrix = calcViewPortMatrix(width, height);
+
+	//Screen rectangles of the models and the lights in current frame
+	std::vector<TrackedModel> models(m_models.size());
 	for (size_t m = 0; m < m_models.size(); ++m)
 	{
-		num_triangles += renderModel(m);
+		glm::vec3 boundsMin, boundsMax;
+		m_models[m]->getWorldBounds(boundsMin, boundsMax);
+		models[m].m_model = m_models[m].get();
+		models[m].m_version = m_models[m]->getVersion();
+		models[m].m_rect.m_visible = boxScreenRect(boundsMin, boundsMax, viewProject, viewportMatrix, width, height,
+			models[m].m_rect.m_min, models[m].m_rect.m_max);
+	}
+	std::vector<TrackedRect> lightRects(m_lights.size());
+	for (size_t l = 0; l < m_lights.size(); ++l)
+	{
+		lightRects[l].m_visible = lightScreenRect(*m_lights[l], viewProject, viewportMatrix, width, height,
+			lightRects[l].m_min, lightRects[l].m_max);
+	}
+	auto lights = std::make_shared<LightTable>();
+	lights->build(m_lights);
+
+	//Unknown changes once the scene was replaced
+	viewChanged = viewProject != m_trackedViewProject || m_viewerPos != m_trackedViewerPos;
+	bool full = !m_trackedValid || models.size() != m_trackedModels.size() || m_lights.size() != m_trackedLightRects.size();
+	for (size_t m = 0; !full && m < models.size(); ++m)
+	{
+		full = models[m].m_model != m_trackedModels[m].m_model;
+	}
+
+	dirtyTiles.assign(m_scratch->getTileNum(), full ? 1 : 0);
+	auto markDirty = [&](const TrackedRect &rect) { markTilesDirty(rect, dirtyTiles); };
+
+	if (!full)
+	{
+		//Changed models: the regions they left and they moved into
+		for (size_t m = 0; m < models.size(); ++m)
+		{
+			if (models[m].m_version != m_trackedModels[m].m_version)
+			{
+				markDirty(m_trackedModels[m].m_rect);
+				markDirty(models[m].m_rect);
+			}
+		}
+		//Changed lights: the regions they lit and they light now
+		for (size_t l = 0; l < m_lights.size(); ++l)
+		{
+			if (!lights->sameLight(l, *m_trackedLights, l))
+			{
+				markDirty(m_trackedLightRects[l]);
+				markDirty(lightRects[l]);
+			}
+		}
+	}
+
+	m_trackedValid = true;
+	m_trackedViewProject = viewProject;
+	m_trackedViewerPos = m_viewerPos;
+	m_trackedModels.swap(models);
+	m_trackedLightRects.swap(lightRects);
+	m_trackedLights = lights;
+	return !full;
+}
+
+void Renderer::clearColor(const glm::vec4 &color)
+{
+	if (!m_incrementalRendering)
+	{
+		m_backBuffer->clearColor(color);
+		return;
+	}
+	m_pendingClearColor = true;
+	m_pendingColor = color;
+}
+
+void Renderer::clearDepth(const float &depth)
+{
+	if (!m_incrementalRendering)
+	{
+		m_backBuffer->clearDepth(depth);
+		return;
+	}
+	m_pendingClearDepth = true;
+	m_pendingDepth = depth;
+}
+
+void Renderer::clearColorAndDepth(const glm::vec4 &color, const float &depth)
+{
+	if (!m_incrementalRendering)
+	{
+		m_backBuffer->clearColorAndDepth(color, depth);
+		return;
+	}
+	m_pendingClearColor = m_pendingClearDepth = true;
+	m_pendingColor = color;
+	m_pendingDepth = depth;
+}
+
+void Renderer::applyPendingClear(const std::vector<unsigned char> *dirtyTiles)
+{
+	const glm::vec4 *color = m_pendingClearColor ? &m_pendingColor : nullptr;
+	const float *depth = m_pendingClearDepth ? &m_pendingDepth : nullptr;
+	m_pendingClearColor = m_pendingClearDepth = false;
+	if (color == nullptr && depth == nullptr)
+		return;
+
+	if (dirtyTiles == nullptr)
+	{
+		if (color != nullptr && depth != nullptr)
+			m_backBuffer->clearColorAndDepth(*color, *depth);
+		else if (color != nullptr)
+			m_backBuffer->clearColor(*color);
+		else
+			m_backBuffer->clearDepth(*depth);
+		return;
+	}
+
+	const int tilesX = m_scratch->m_tilesX;
+	const int width = m_backBuffer->getWidth(), height = m_backBuffer->getHeight();
+	parallelFor((int)0, m_scratch->getTileNum(), [&](const int &t)
+	{
+		if (!(*dirtyTiles)[t])
+			return;
+		glm::ivec2 rectMin((t % tilesX) * TILE_SIZE, (t / tilesX) * TILE_SIZE);
+		glm::ivec2 rectMax(glm::min(rectMin.x + TILE_SIZE, width) - 1, glm::min(rectMin.y + TILE_SIZE, height) - 1);
+		m_backBuffer->clearRect(rectMin, rectMax, color, depth);
+	}, ExecutionPolicy::PARALLEL);
+}
+
+unsigned int Renderer::renderAllModels()
+{
+	const bool shadowsChanged = preparePipelineHandler();
+
+	//Newly loaded textures or streamed levels change the shading of the draws using them
+	//Note: the streamed levels are updated by the application between frames, see TextureStreaming::update
+	const unsigned int textureGeneration = Pipeline::getTextureGeneration();
+	const unsigned int streamingGeneration = TextureStreaming::getGeneration();
+	if (textureGeneration != m_textureGeneration || streamingGeneration != m_streamingGeneration)
+	{
+		m_textureGeneration = textureGeneration;
+		m_streamingGeneration = streamingGeneration;
+		m_historyValid = false;
+		m_trackedValid = false;
+	}
+
+	//Incremental rendering: only the tiles whose contents could have changed are drawn
+	std::vector<unsigned char> dirtyTiles;
+	bool viewChanged = true;
+	const bool tracked = (m_incrementalRendering || m_temporalReuse) && trackChanges(dirtyTiles, viewChanged);
+	const bool incremental = m_incrementalRendering && tracked && !viewChanged;
+	//Re-rendered shadow maps only change the shading where their lights reach
+	for (size_t l = 0; tracked && shadowsChanged && l < m_lights.size(); ++l)
+	{
+		if (m_shadowsChanged[l])
+			markTilesDirty(m_trackedLightRects[l], dirtyTiles);
+	}
+
+	//Record the draw list of the whole frame
+	m_commandBuffer.clear();
+	m_commandBuffer.setLights(m_lights, m_projectMatrix * m_viewMatrix);
+	m_commandBuffer.setShadingMode(m_shadingMode);
+	for (size_t m = 0; m < m_models.size(); ++m)
+	{
+		//Skip the models which do not overlap any redrawn tile
+		if (incremental)
+		{
+			const auto &rect = m_trackedModels[m].m_rect;
+			bool overlapped = false;
+			for (int ty = rect.m_min.y / TILE_SIZE; rect.m_visible && !overlapped && ty <= rect.m_max.y / TILE_SIZE; ++ty)
+			{
+				for (int tx = rect.m_min.x / TILE_SIZE; !overlapped && tx <= rect.m_max.x / TILE_SIZE; ++tx)
+				{
+					overlapped = dirtyTiles[ty * m_scratch->m_tilesX + tx] != 0;
+				}
+			}
+			if (!overlapped)
+				continue;
+		}
+		recordModel(m_commandBuffer, m_models[m], *m_pipelineHandler);
+	}
+
+	//Temporal reprojection from the frame drawn last time
+	//Note: incremental frames are not swapped, so there is no history for them
+	const glm::mat4 viewProject = m_projectMatrix * m_viewMatrix;
+	if (m_temporalReuse && !incremental)
+	{
+		//The changed models, lights and shadows invalidate the history of the tiles they covered and cover now
+		//Note: the tiles are in the screen of last frame only if the view did not change, the whole history is dropped otherwise
+		bool sceneChanged = false;
+		for (size_t t = 0; !sceneChanged && t < dirtyTiles.size(); ++t)
+			sceneChanged = dirtyTiles[t] != 0;
+		const bool historyValid = m_historyValid && tracked && !(sceneChanged && viewChanged);
+		m_backBuffer->enableTemporalCache(historyValid ? m_frontBuffer.get() : nullptr, m_historyViewProject, m_frameIndex++);
+		if (sceneChanged)
+			m_backBuffer->setTemporalStaleTiles(&dirtyTiles, TILE_SIZE, m_scratch->m_tilesX);
+	}
+	else
+	{
+		m_backBuffer->disableTemporalCache();
+	}
+
+	//Execute all the draws as a task graph
+	applyPendingClear(incremental ? &dirtyTiles : nullptr);
+	unsigned int num_triangles = executeCommandBuffer(m_commandBuffer, m_backBuffer.get(), *m_scratch, m_frustumNearFar,
+		incremental ? &dirtyTiles : nullptr);
+	m_historyValid = m_temporalReuse && !incremental;
+	m_historyViewProject = viewProject;
+
+	if (incremental)
+	{
+		//Resolve the redrawn tiles and update them in the displayed frame, the other tiles are reused
+		const int tilesX = m_scratch->m_tilesX;
+		const int width = m_backBuffer->getWidth(), height = m_backBuffer->getHeight();
+		parallelFor((int)0, m_scratch->getTileNum(), [&](const int &t)
+		{
+			if (!dirtyTiles[t])
+				return;
+			glm::ivec2 rectMin((t % tilesX) * TILE_SIZE, (t / tilesX) * TILE_SIZE);
+			glm::ivec2 rectMax(glm::min(rectMin.x + TILE_SIZE, width) - 1, glm::min(rectMin.y + TILE_SIZE, height) - 1);
+			m_backBuffer->resolveRect(rectMin, rectMax);
+			m_frontBuffer->copyRect(*m_backBuffer, rectMin, rectMax);
+		}, ExecutionPolicy::PARALLEL);
+		return num_triangles;
 	}
 
 	//MSAA resolve stage
@@ -388,68 +620,388 @@ unsigned int Renderer::renderModel(const size_t &index)
 {
 	if (index >= m_models.size())
 		return 0;
+	preparePipelineHandler();
+
+	m_commandBuffer.clear();
+	m_commandBuffer.setLights(m_lights, m_projectMatrix * m_viewMatrix);
+	m_commandBuffer.setShadingMode(m_shadingMode);
+	recordModel(m_commandBuffer, m_models[index], *m_pipelineHandler);
+	m_backBuffer->disableTemporalCache();
+	applyPendingClear(nullptr);
+	return executeCommandBuffer(m_commandBuffer, m_backBuffer.get(), *m_scratch, m_frustumNearFar);
+}
 
-	unsigned int num_triangles = 0;
-	const auto &drawable = m_models[index];
-	const auto &submeshes = drawable->getDrawableSubMeshes();
+unsigned int Renderer::renderViews(std::vector<RenderView> &views)
+{
+	preparePipelineHandler();
+
+	//Vertex shader stage shared by all views
+	//Note: executed with an identity view-projection matrix, so the clip position of view i is VP_i * cpos
+	std::vector<std::vector<std::vector<Pipeline::VertexData>>> transformed(m_models.size());
+	{
+		Pipeline::ptr handler = m_pipelineHandler->clone();
+		handler->setViewProjectMatrix(glm::mat4(1.0f));
+		for (size_t m = 0; m < m_models.size(); ++m)
+		{
+			const auto &submeshes = m_models[m]->getDrawableSubMeshes();
+			handler->setModelMatrix(m_models[m]->getModelMatrix());
+			transformed[m].resize(submeshes.size());
+			for (size_t s = 0; s < submeshes.size(); ++s)
+			{
+				runVertexShader(*handler, submeshes[s], transformed[m][s]);
+			}
+		}
+	}
+
+	//Render targets and scratch memory of each view
+	m_viewScratches.resize(views.size());
+	for (size_t v = 0; v < views.size(); ++v)
+	{
+		auto &view = views[v];
+		if (view.m_frameBuffer == nullptr)
+		{
+			view.m_frameBuffer = std::make_shared<FrameBuffer>(m_backBuffer->getWidth(), m_backBuffer->getHeight());
+		}
+		const auto &target = view.m_frameBuffer;
+		auto &scratch = m_viewScratches[v];
+		if (scratch == nullptr || scratch->getWidth() != target->getWidth() || scratch->getHeight() != target->getHeight())
+		{
+			scratch = std::make_shared<DrawcallScratch>(target->getWidth(), target->getHeight());
+		}
+	}
+
+	//Views are drawn simultaneously, tbb balances the nested task graphs among the cores
+	std::atomic<unsigned int> num_triangles(0);
+	parallelFor((size_t)0, views.size(), [&](const size_t &v)
+	{
+		auto &view = views[v];
+		Pipeline::ptr handler = m_pipelineHandler->clone();
+		handler->setViewerPos(view.m_viewerPos);
+
+		CommandBuffer commandBuffer;
+		const glm::mat4 viewProject = view.m_projectMatrix * view.m_viewMatrix;
+		commandBuffer.setLights(m_lights, viewProject);
+		commandBuffer.setShadingMode(m_shadingMode);
+		for (size_t m = 0; m < m_models.size(); ++m)
+		{
+			recordModel(commandBuffer, m_models[m], *handler, &transformed[m], viewProject);
+		}
+
+		view.m_frameBuffer->clearColorAndDepth(view.m_clearColor, view.m_clearDepth);
+		num_triangles += executeCommandBuffer(commandBuffer, view.m_frameBuffer.get(), *m_viewScratches[v],
+			view.m_frustumNearFar);
+
+		//MSAA resolve stage
+		view.m_frameBuffer->resolve();
+	}, ExecutionPolicy::PARALLEL);
+
+	return num_triangles.load();
+}
+
+void Renderer::recordModel(
+	CommandBuffer &commandBuffer,
+	const Model::ptr &drawable,
+	const Pipeline &handler,
+	const std::vector<std::vector<Pipeline::VertexData>> *transformed,
+	const glm::mat4 &viewProjectMatrix)
+{
+	auto &submeshes = drawable->getDrawableSubMeshes();
 
 	//Configuration
-	m_context.m_CullFaceMode = drawable->getCullfaceMode();
-	m_context.m_DepthTestMode = drawable->getDepthtestMode();
-	m_context.m_DepthWriteMode = drawable->getDepthwriteMode();
-	m_context.m_AlphaBlendMode = drawable->getAlphablendMode();
+	Context context;
+	context.m_CullFaceMode = drawable->getCullfaceMode();
+	context.m_DepthTestMode = drawable->getDepthtestMode();
+	context.m_DepthWriteMode = drawable->getDepthwriteMode();
+	context.m_AlphaBlendMode = drawable->getAlphablendMode();
+	context.m_OITMode = drawable->getOITMode();
+	context.m_ShadingRate = drawable->getShadingRate();
 
 	//Setup the shading options
-	m_pipelineHandler->setModelMatrix(drawable->getModelMatrix());
-	m_pipelineHandler->setLightingEnable(drawable->getLightingMode() == LightingMode::LIGHTING_ENABLE);
-	m_pipelineHandler->setAmbientCoef(drawable->getAmbientCoff());
-	m_pipelineHandler->setDiffuseCoef(drawable->getDiffuseCoff());
-	m_pipelineHandler->setSpecularCoef(drawable->getSpecularCoff());
-	m_pipelineHandler->setEmissionColor(drawable->getEmissionCoff());
-	m_pipelineHandler->setShininess(drawable->getSpecularExponent());
-	m_pipelineHandler->setTransparency(drawable->getTransparency());
-
-	//Note: For those drawables which need the alpha blending, we should make sure the faces rendered in a fixed order 
-	tbb::filter_mode executeMopde = m_context.m_AlphaBlendMode == AlphaBlendingMode::ALPHA_DISABLE ?
-		tbb::filter_mode::parallel : tbb::filter_mode::serial_in_order;
-
-	//Setting for drawcall
-	static int ntokens = tbb::this_task_arena::max_concurrency() * 128;
-	static FragmentCache fragmentCache;
-	static FramebufferMutex framebufferMutex(m_backBuffer->getWidth(), m_backBuffer->getHeight());
+	Pipeline::ptr modelHandler = handler.clone();
+	modelHandler->setModelMatrix(drawable->getModelMatrix());
+	modelHandler->setLightingEnable(drawable->getLightingMode() == LightingMode::LIGHTING_ENABLE);
+	modelHandler->setAmbientCoef(drawable->getAmbientCoff());
+	modelHandler->setDiffuseCoef(drawable->getDiffuseCoff());
+	modelHandler->setSpecularCoef(drawable->getSpecularCoff());
+	modelHandler->setEmissionColor(drawable->getEmissionCoff());
+	modelHandler->setShininess(drawable->getSpecularExponent());
+	modelHandler->setTransparency(drawable->getTransparency());
 
 	for (size_t s = 0; s < submeshes.size(); ++s)
 	{
 		const auto &submesh = submeshes[s];
-		int faceNum = submesh.getIndices().size() / 3;
-		num_triangles += faceNum;
+
+		DrawCommand cmd;
+		cmd.m_mesh = &submesh;
+		cmd.m_context = context;
+		cmd.m_sharedVertices = (transformed != nullptr) ? &(*transformed)[s] : nullptr;
+		cmd.m_viewProjectMatrix = viewProjectMatrix;
 
 		//Texture setting
-		m_pipelineHandler->setDiffuseTexId(submesh.getDiffuseMapTexId());
-		m_pipelineHandler->setSpecularTexId(submesh.getSpecularMapTexId());
-		m_pipelineHandler->setNormalTexId(submesh.getNormalMapTexId());
-		m_pipelineHandler->setGlowTexId(submesh.getGlowMapTexId());
+		cmd.m_pipelineHandler = modelHandler->clone();
+		cmd.m_pipelineHandler->setDiffuseTexId(submesh.getDiffuseMapTexId());
+		cmd.m_pipelineHandler->setSpecularTexId(submesh.getSpecularMapTexId());
+		cmd.m_pipelineHandler->setNormalTexId(submesh.getNormalMapTexId());
+		cmd.m_pipelineHandler->setGlowTexId(submesh.getGlowMapTexId());
+
+		//Note: only the opaque draws could be deferred, coarse draws are cheaper to be shaded forward
+		cmd.m_deferred = commandBuffer.getShadingMode() == ShadingMode::DEFERRED_SHADING &&
+			context.m_AlphaBlendMode == AlphaBlendingMode::ALPHA_DISABLE &&
+			context.m_OITMode == OITMode::OIT_DISABLE &&
+			context.m_ShadingRate == ShadingRate::SHADING_RATE_1X1 &&
+			cmd.m_pipelineHandler->supportDeferredShading();
+
+		commandBuffer.record(cmd);
+	}
+}
 
-		//Draw call setting
-		DrawcallSetting drawCall(submesh.getVertices(), submesh.getIndices(), m_pipelineHandler.get(),
-			m_context, m_viewportMatrix, m_frustumNearFar.x, m_frustumNearFar.y, m_backBuffer.get());
+void Renderer::runVertexShader(const Pipeline &handler, const Mesh &mesh,
+	std::vector<Pipeline::VertexData> &vertices)
+{
+	const auto &vertexBuffer = mesh.getVertices();
+	const auto &transfer = mesh.getPRTTransfer();
+	const bool baked = transfer.size() == vertexBuffer.size();
+	//Note: each vertex is shaded once, instead of once for each face sharing it
+	vertices.resize(vertexBuffer.size());
+	parallelFor((size_t)0, vertexBuffer.size(), [&](const size_t &i)
+	{
+		vertices[i] = Pipeline::VertexData();
+		vertices[i].m_pos = vertexBuffer[i].m_vpositions;
+		vertices[i].m_nor = vertexBuffer[i].m_vnormals;
+		vertices[i].m_tex = vertexBuffer[i].m_vtexcoords;
+		vertices[i].m_tbn[0] = vertexBuffer[i].m_vtangent;
+		vertices[i].m_tbn[1] = vertexBuffer[i].m_vbitangent;
+		vertices[i].m_transfer = baked ? &transfer[i] : nullptr;
+		handler.vertexShader(vertices[i]);
+	}, ExecutionPolicy::PARALLEL);
+}
 
+unsigned int Renderer::executeCommandBuffer(
+	const CommandBuffer &commandBuffer,
+	FrameBuffer *target,
+	DrawcallScratch &scratch,
+	const glm::vec2 &frustumNearFar,
+	const std::vector<unsigned char> *dirtyTiles)
+{
+	//The frame is executed as a single dependency graph:
+	//  vertex shading (per draw) -> triangle setup & binning (per face batch) -> raster & shading (per tile)
+	//Tiles are processed in parallel, while each tile processes its triangles serially. Tiles overlapped by 
+	//blending draws restore the submission order of their triangles before shading, the others need not.
+	using namespace tbb::flow;
+	typedef continue_node<continue_msg> TaskNode;
+
+	const auto &commands = commandBuffer.getCommands();
+	const glm::mat4 viewportMatrix = calcViewPortMatrix(target->getWidth(), target->getHeight());
+	const float near = frustumNearFar.x, far = frustumNearFar.y;
+
+	//Face batches
+	struct FaceBatch { int m_command, m_startIndex, m_overIndex; };
+	std::vector<FaceBatch> batches;
+	unsigned int num_triangles = 0;
+	for (int c = 0; c < (int)commands.size(); ++c)
+	{
+		int faceNum = commands[c].getFaceNum();
+		num_triangles += faceNum;
 		for (int f = 0; f < faceNum; f += PIPELINE_BATCH_SIZE)
 		{
-			int startIndex = f;
-			int overIndex = glm::min(f + PIPELINE_BATCH_SIZE, faceNum);
-			tbb::parallel_pipeline(ntokens, //Number of tokens
-				//Note: Vertex shader and rasterization could be parallelized
-				tbb::make_filter<void, int>(executeMopde,
-					TBBVertexRastFilter(PIPELINE_BATCH_SIZE, startIndex, overIndex, drawCall, fragmentCache)) &
-				//Note: Fragment shaders between different faces could parallelized
-				//      because a mutex lock for framebuffer could avoid conflicts
-				tbb::make_filter<int, void>(executeMopde,
-					TBBFragmentFilter(PIPELINE_BATCH_SIZE, drawCall, fragmentCache, framebufferMutex)));
+			batches.push_back({ c, f, glm::min(f + PIPELINE_BATCH_SIZE, faceNum) });
 		}
+	}
+	scratch.prepare(commands.size(), batches.size());
 
+	//Attachments required by the draws
+	const Pipeline *lightingHandler = nullptr;
+	for (const auto &cmd : commands)
+	{
+		if (cmd.isOITDraw())
+		{
+			target->enableOIT();
+		}
+		if (cmd.m_deferred && lightingHandler == nullptr)
+		{
+			//Note: the lights and the viewer are the same among the draws of a frame
+			lightingHandler = cmd.m_pipelineHandler.get();
+			target->enableGBuffer();
+		}
 	}
 
+	auto getVertices = [&](const int &c) -> const std::vector<Pipeline::VertexData>&
+	{
+		return commands[c].m_sharedVertices != nullptr ? *commands[c].m_sharedVertices : scratch.m_vertexStreams[c];
+	};
+
+	graph taskGraph;
+	broadcast_node<continue_msg> start(taskGraph);
+	std::vector<std::unique_ptr<TaskNode>> vertexNodes(commands.size());
+	std::vector<std::unique_ptr<TaskNode>> batchNodes(batches.size());
+
+	//Light culling: list the lights whose influence sphere overlaps each tile
+	TaskNode cullNode(taskGraph, [&](const continue_msg &)
+	{
+		const auto &lights = commandBuffer.getLights();
+		std::vector<glm::ivec4> lightRects;
+		std::vector<unsigned int> visibleLights;
+		for (size_t l = 0; l < lights.size(); ++l)
+		{
+			glm::ivec2 rectMin, rectMax;
+			if (lightScreenRect(*lights[l], commandBuffer.getViewProjectMatrix(), viewportMatrix,
+				target->getWidth(), target->getHeight(), rectMin, rectMax))
+			{
+				lightRects.push_back(glm::ivec4(rectMin.x / TILE_SIZE, rectMin.y / TILE_SIZE, 
+					rectMax.x / TILE_SIZE, rectMax.y / TILE_SIZE));
+				visibleLights.push_back(l);
+			}
+		}
+		parallelFor((int)0, scratch.getTileNum(), [&](const int &t)
+		{
+			const int tx = t % scratch.m_tilesX, ty = t / scratch.m_tilesX;
+			auto &tileLights = scratch.m_tileLights[t];
+			tileLights.clear();
+			for (size_t l = 0; l < visibleLights.size(); ++l)
+			{
+				const auto &rect = lightRects[l];
+				if (tx >= rect.x && tx <= rect.z && ty >= rect.y && ty <= rect.w)
+				{
+					tileLights.push_back(visibleLights[l]);
+				}
+			}
+		}, ExecutionPolicy::PARALLEL);
+	});
+	make_edge(start, cullNode);
+
+	//Raster & shading of each tile
+	//Note: each tile is exclusively owned by one task, no lock required
+	TaskNode tileNode(taskGraph, [&](const continue_msg &)
+	{
+		parallelFor((int)0, scratch.getTileNum(), [&](const int &t)
+		{
+			auto &bin = scratch.m_bins[t];
+			if (bin.empty())
+				return;
+
+			//Bins are filled concurrently, restore the submission order
+			//Note: always sorted, since blending, disabled depth testing and equal depths all depend on the order
+			std::sort(bin.begin(), bin.end());
+			bool oit = false, deferred = false;
+			for (const auto &ref : bin)
+			{
+				const auto &cmd = commands[batches[ref.m_batch].m_command];
+				oit = oit || cmd.isOITDraw();
+				deferred = deferred || cmd.m_deferred;
+			}
+			//Shading passes: G-buffer -> forward -> OIT
+			//Note: transparent faces are deferred after the others, so that they are depth tested against the opaque
+			if (oit || deferred)
+			{
+				auto passOf = [&](const TriangleRef &ref) -> int
+				{
+					const auto &cmd = commands[batches[ref.m_batch].m_command];
+					return cmd.m_deferred ? 0 : (cmd.isOITDraw() ? 2 : 1);
+				};
+				std::stable_sort(bin.begin(), bin.end(), [&](const TriangleRef &a, const TriangleRef &b) -> bool
+				{
+					return passOf(a) < passOf(b);
+				});
+			}
+
+			glm::ivec2 rectMin((t % scratch.m_tilesX) * TILE_SIZE, (t / scratch.m_tilesX) * TILE_SIZE);
+			glm::ivec2 rectMax(glm::min(rectMin.x + TILE_SIZE, (int)target->getWidth()) - 1,
+				glm::min(rectMin.y + TILE_SIZE, (int)target->getHeight()) - 1);
+			auto &quads = scratch.m_tileQuads.local();
+			bool lit = !deferred;
+			for (const auto &ref : bin)
+			{
+				const auto &triangle = scratch.m_batchTriangles[ref.m_batch][ref.m_index];
+				const auto &cmd = commands[triangle.m_command];
+
+				//Lighting pass after all the G-buffer draws
+				if (!lit && !cmd.m_deferred)
+				{
+					deferredLightingTile(*lightingHandler, target, rectMin, rectMax, scratch.m_tileLights[t]);
+					lit = true;
+				}
+
+				quads.clear();
+				Pipeline::rasterizeFillEdgeFunction(triangle.m_vertices[0], triangle.m_vertices[1],
+					triangle.m_vertices[2], rectMin, rectMax, quads);
+				if (cmd.m_deferred)
+				{
+					cmd.m_pipelineHandler->shadeQuadsGBuffer(quads, cmd.m_context, target);
+				}
+				else
+				{
+					cmd.m_pipelineHandler->shadeQuads(quads, cmd.m_context, target, scratch.m_tileLights[t]);
+				}
+			}
+			if (!lit)
+			{
+				deferredLightingTile(*lightingHandler, target, rectMin, rectMax, scratch.m_tileLights[t]);
+			}
+		}, ExecutionPolicy::PARALLEL);
+	});
+	make_edge(cullNode, tileNode);
+
+	//Vertex shading of each draw
+	for (size_t c = 0; c < commands.size(); ++c)
+	{
+		vertexNodes[c].reset(new TaskNode(taskGraph, [&, c](const continue_msg &) 
+		{
+			const auto &cmd = commands[c];
+			if (cmd.m_sharedVertices == nullptr)
+			{
+				runVertexShader(*cmd.m_pipelineHandler, *cmd.m_mesh, scratch.m_vertexStreams[c]);
+			}
+		}));
+		make_edge(start, *vertexNodes[c]);
+	}
+
+	//Triangle setup and binning of each face batch
+	for (size_t b = 0; b < batches.size(); ++b)
+	{
+		const int c = batches[b].m_command;
+		batchNodes[b].reset(new TaskNode(taskGraph, [&, b, c](const continue_msg &)
+		{
+			const auto &cmd = commands[c];
+			const auto &vertices = getVertices(c);
+			auto &triangles = scratch.m_batchTriangles[b];
+			const int maxX = target->getWidth() - 1, maxY = target->getHeight() - 1;
+			for (int f = batches[b].m_startIndex; f < batches[b].m_overIndex; ++f)
+			{
+				Pipeline::VertexData v[3];
+				fetchFace(cmd, vertices, f, v);
+				setupTriangles(v, near, far, viewportMatrix, cmd.m_context.m_CullFaceMode,
+					[&](const Pipeline::VertexData &v0, const Pipeline::VertexData &v1, const Pipeline::VertexData &v2)
+				{
+					//Bin the triangle into the tiles overlapped by its bounding box
+					glm::ivec2 boundingMin, boundingMax;
+					boundingMin.x = glm::max(glm::min(v0.m_spos.x, glm::min(v1.m_spos.x, v2.m_spos.x)), 0);
+					boundingMin.y = glm::max(glm::min(v0.m_spos.y, glm::min(v1.m_spos.y, v2.m_spos.y)), 0);
+					boundingMax.x = glm::min(glm::max(v0.m_spos.x, glm::max(v1.m_spos.x, v2.m_spos.x)), maxX);
+					boundingMax.y = glm::min(glm::max(v0.m_spos.y, glm::max(v1.m_spos.y, v2.m_spos.y)), maxY);
+					if (boundingMin.x > boundingMax.x || boundingMin.y > boundingMax.y)
+						return;
+
+					TriangleRef ref = { (unsigned int)b, (unsigned int)triangles.size() };
+					triangles.push_back({ { v0, v1, v2 }, c });
+					for (int ty = boundingMin.y / TILE_SIZE; ty <= boundingMax.y / TILE_SIZE; ++ty)
+					{
+						for (int tx = boundingMin.x / TILE_SIZE; tx <= boundingMax.x / TILE_SIZE; ++tx)
+						{
+							const int t = ty * scratch.m_tilesX + tx;
+							if (dirtyTiles == nullptr || (*dirtyTiles)[t])
+								scratch.m_bins[t].push_back(ref);
+						}
+					}
+				});
+			}
+		}));
+		make_edge(*vertexNodes[c], *batchNodes[b]);
+		make_edge(*batchNodes[b], tileNode);
+	}
+
+	start.try_put(continue_msg());
+	taskGraph.wait_for_all();
+
 	return num_triangles;
 }
 
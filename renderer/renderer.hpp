@@ -7,12 +7,27 @@
 #include "model.hpp"
 #include "context.hpp"
 #include "pipeline.hpp"
+#include "command_buffer.hpp"
 
 namespace sr {
+
+class DrawcallScratch;
+
 class Renderer final {
 public:
 	typedef std::shared_ptr<Renderer> ptr;
 
+	//A camera view for batch rendering of the loaded models
+	struct RenderView {
+		glm::mat4 m_viewMatrix = glm::mat4(1.0f);
+		glm::mat4 m_projectMatrix = glm::mat4(1.0f);
+		glm::vec2 m_frustumNearFar = glm::vec2(0.1f, 100.0f);
+		glm::vec3 m_viewerPos = glm::vec3(0.0f);
+		glm::vec4 m_clearColor = glm::vec4(0.0f);
+		float m_clearDepth = 0.0f;
+		FrameBuffer::ptr m_frameBuffer = nullptr;	//Render target, created with the renderer's size if null
+	};
+
 	Renderer(int width, int height);
 	~Renderer() = default;
 
@@ -21,26 +36,45 @@ public:
 	void addModel(const std::vector<Model::ptr> &models);
 	void unloadDrawableMesh();
 
-	void clearColor(const glm::vec4 &color) { m_backBuffer->clearColor(color); }
-	void clearDepth(const float &depth) { m_backBuffer->clearDepth(depth); }
-	void clearColorAndDepth(const glm::vec4 &color, const float &depth) { m_backBuffer->clearColorAndDepth(color, depth); }
+	//Note: with incremental rendering, the clearing is deferred to the draw call so that only the redrawn tiles are cleared
+	void clearColor(const glm::vec4 &color);
+	void clearDepth(const float &depth);
+	void clearColorAndDepth(const glm::vec4 &color, const float &depth);
 
 	//Setting
 	void setViewMatrix(const glm::mat4 &view) { m_viewMatrix = view; }
 	void setModelMatrix(const glm::mat4 &model) { m_modelMatrix = model; }
 	void setProjectMatrix(const glm::mat4 &project, float near, float far) { m_projectMatrix = project;m_frustumNearFar = glm::vec2(near, far); }
-	void setShaderPipeline(Pipeline::ptr shader) { m_pipelineHandler = shader; }
+	void setShaderPipeline(Pipeline::ptr shader) { m_pipelineHandler = shader; m_historyValid = false; m_trackedValid = false; }
 	void setViewerPos(const glm::vec3 &viewer);
 
 	int addLightSource(Light::ptr lightSource);
 	Light::ptr getLightSource(const int &index);
 	void setExposure(const float &exposure);
+	//Note: deferred shading keeps k_GBufferSurfaces surfaces per pixel, a pixel covered by more of them (MSAA only)
+	//lights the sampling points of the smallest kept one with the attributes of the surface drawn last
+	void setShadingMode(ShadingMode mode) { m_shadingMode = mode; m_trackedValid = false; }
+	//Anisotropic texture filtering quality, sharper at grazing angles at the cost of more taps there
+	void setTextureAnisotropy(TextureAnisotropy anisotropy) { m_textureAnisotropy = anisotropy; m_historyValid = false; m_trackedValid = false; }
+	//Reuse the shading of last frame for the pixels whose reprojection is valid (renderAllModels only)
+	//Note: the history is rejected where the models (by Model::getVersion), the lights or their shadows changed.
+	//      Call invalidateTemporalHistory for anything else, e.g. the materials
+	void setTemporalReuse(bool enable) { m_temporalReuse = enable; m_historyValid = false; }
+	void invalidateTemporalHistory() { m_historyValid = false; }
+	//Redraw only the screen tiles covered by the changed models and lights, the others are kept from last frame
+	//Note: changes are tracked by Model::getVersion and the light parameters, anything else (e.g. the clear color)
+	//      requires invalidateIncrementalFrame to redraw the whole frame
+	void setIncrementalRendering(bool enable) { m_incrementalRendering = enable; m_trackedValid = false; }
+	void invalidateIncrementalFrame() { m_trackedValid = false; }
 
 	//Draw call
 	unsigned int renderAllModels();
 
 	unsigned int renderModel(const size_t &index);
 
+	//Draw all the models into each view's frame buffer (resolved) concurrently
+	unsigned int renderViews(std::vector<RenderView> &views);
+
 	//Commit rendered result
 	unsigned char* commitRenderedColorBuffer();
 
@@ -54,6 +88,45 @@ public:
 
 private:
 
+	//Load the renderer settings into the shader pipeline, return true if any shadow map was re-rendered
+	bool preparePipelineHandler();
+
+	//Re-render the shadow maps of the shadow casting lights if the casters or the lights changed
+	//Return true if any of them was re-rendered
+	bool updateShadowMaps();
+
+	//Compare the models and the lights with last frame, and mark the tiles they covered and cover now
+	//Return false if the changes are unknown, e.g. the models were replaced, all the tiles are marked then
+	//Note: the tiles covered last frame are in the screen of last view, see viewChanged
+	bool trackChanges(std::vector<unsigned char> &dirtyTiles, bool &viewChanged);
+
+	//Execute the deferred clearing of the back buffer, only in the dirty tiles if any
+	void applyPendingClear(const std::vector<unsigned char> *dirtyTiles);
+
+	//Record the draws of a model's submeshes with a snapshot of the shader pipeline
+	//Note: transformed is the world space vertices of each submesh shared by all views (optional)
+	static void recordModel(
+		CommandBuffer &commandBuffer,
+		const Model::ptr &drawable,
+		const Pipeline &handler,
+		const std::vector<std::vector<Pipeline::VertexData>> *transformed = nullptr,
+		const glm::mat4 &viewProjectMatrix = glm::mat4(1.0f));
+
+	//Execute all the recorded draws into the target as a task graph
+	//Note: only the tiles marked in dirtyTiles are drawn if given
+	static unsigned int executeCommandBuffer(
+		const CommandBuffer &commandBuffer,
+		FrameBuffer *target,
+		DrawcallScratch &scratch,
+		const glm::vec2 &frustumNearFar,
+		const std::vector<unsigned char> *dirtyTiles = nullptr);
+
+	//Vertex shader stage for each vertex of the mesh
+	static void runVertexShader(
+		const Pipeline &handler,
+		const Mesh &mesh,
+		std::vector<Pipeline::VertexData> &vertices);
+
 	//Cliping auxiliary functions
 	static std::vector<Pipeline::VertexData> clipingSutherlandHodgemanAux(
 		const std::vector<Pipeline::VertexData> &polygon,
@@ -70,10 +143,15 @@ private:
 	glm::mat4 m_projectMatrix = glm::mat4(1.0f);			//From camera space -> homogeneous clip space
 	glm::mat4 m_viewportMatrix = glm::mat4(1.0f);			//From ndc space    -> screen space
 
-	Context m_context;
-
 	//Near plane & far plane
 	glm::vec2 m_frustumNearFar;
+	glm::vec3 m_viewerPos = glm::vec3(0.0f);
+
+	//Lighting
+	std::vector<Light::ptr> m_lights;
+	float m_exposure = 1.0f;
+	ShadingMode m_shadingMode = ShadingMode::FORWARD_SHADING;
+	TextureAnisotropy m_textureAnisotropy = TextureAnisotropy::ANISOTROPY_1X;
 
 	//Shader pipeline handler
 	Pipeline::ptr m_pipelineHandler = nullptr;
@@ -81,7 +159,45 @@ private:
 	//Double buffers
 	FrameBuffer::ptr m_backBuffer;                      // The frame buffer that's goint to be written.
 	FrameBuffer::ptr m_frontBuffer;                     // The frame buffer that's goint to be displayed.
+
+	//Temporal reprojection, the front buffer keeps the shading cache of last frame
+	bool m_temporalReuse = false;
+	bool m_historyValid = false;
+	glm::mat4 m_historyViewProject = glm::mat4(1.0f);
+	unsigned int m_frameIndex = 0;
+	unsigned int m_textureGeneration = 0;	//Textures loaded in the background since last frame invalidate the history
+	unsigned int m_streamingGeneration = 0;
+
+	//Change tracking for incremental rendering
+	struct TrackedRect {
+		glm::ivec2 m_min = glm::ivec2(0), m_max = glm::ivec2(0);
+		bool m_visible = false;
+	};
+	struct TrackedModel {
+		const Model *m_model = nullptr;
+		unsigned int m_version = 0;
+		TrackedRect m_rect;		//Screen rectangle of the world space bounds
+	};
+	void markTilesDirty(const TrackedRect &rect, std::vector<unsigned char> &dirtyTiles) const;
+	bool m_incrementalRendering = false;
+	bool m_trackedValid = false;
+	glm::mat4 m_trackedViewProject = glm::mat4(1.0f);
+	glm::vec3 m_trackedViewerPos = glm::vec3(0.0f);
+	std::vector<TrackedModel> m_trackedModels;
+	std::vector<TrackedRect> m_trackedLightRects;
+	std::shared_ptr<const LightTable> m_trackedLights;
+	std::vector<unsigned char> m_shadowsChanged;		//Lights whose shadow map was re-rendered this frame
+	bool m_pendingClearColor = false, m_pendingClearDepth = false;
+	glm::vec4 m_pendingColor = glm::vec4(0.0f);
+	float m_pendingDepth = 0.0f;
 	std::vector<unsigned char> m_renderedImg;			// The rendered image.
+
+	//Draw list of current frame
+	CommandBuffer m_commandBuffer;
+
+	//Scratch memory of drawcalls for the back buffer and for each batch view
+	std::shared_ptr<DrawcallScratch> m_scratch;
+	std::vector<std::shared_ptr<DrawcallScratch>> m_viewScratches;
 };
 
 } // namespace sr
\ No newline at end of file
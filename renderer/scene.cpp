@@ -24,7 +24,8 @@ int SceneParser::getLight(const std::string &name)
 	return m_scene.m_lights[name];
 }
 
-void SceneParser::parse(const std::string &path, Renderer::ptr renderer, bool generatedMipmap)
+void SceneParser::parse(const std::string &path, Renderer::ptr renderer, bool generatedMipmap,
+	TextureCompressionMode compression)
 {
 	std::ifstream sceneFile;
 	sceneFile.open(path, std::ios::in);
@@ -207,7 +208,7 @@ void SceneParser::parse(const std::string &path, Renderer::ptr renderer, bool ge
 
 			std::getline(sceneFile, line);
 			std::string path = parseStr(line);
-			Model::ptr model = std::make_shared<Model>(path, generatedMipmap);
+			Model::ptr model = std::make_shared<Model>(path, generatedMipmap, compression);
 			renderer->addModel(model);
 			m_scene.m_entities[name] = model;
 
@@ -272,6 +273,16 @@ void SceneParser::parse(const std::string &path, Renderer::ptr renderer, bool ge
 					model->setAlphablendMode(AlphaBlendingMode::ALPHA_BLENDING);
 				else if (alphablend == "alpha2coverage")
 					model->setAlphablendMode(AlphaBlendingMode::ALPHA_TO_COVERAGE);
+				else if (alphablend == "oit_weighted")
+				{
+					model->setAlphablendMode(AlphaBlendingMode::ALPHA_BLENDING);
+					model->setOITMode(OITMode::OIT_WEIGHTED_BLENDED);
+				}
+				else if (alphablend == "oit_kbuffer")
+				{
+					model->setAlphablendMode(AlphaBlendingMode::ALPHA_BLENDING);
+					model->setOITMode(OITMode::OIT_K_BUFFER);
+				}
 				else
 					model->setAlphablendMode(AlphaBlendingMode::ALPHA_DISABLE);
 			}
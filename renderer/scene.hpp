@@ -29,7 +29,8 @@ public:
 	Model::ptr getEntity(const std::string &name);
 	int getLight(const std::string &name);
 
-	void parse(const std::string &path, Renderer::ptr renderer, bool generatedMipmap);
+	void parse(const std::string &path, Renderer::ptr renderer, bool generatedMipmap,
+		TextureCompressionMode compression = TextureCompressionMode::NONE);
 
 private:
 	float parseFloat(std::string str) const;
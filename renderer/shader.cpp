@@ -16,6 +16,105 @@ void Pipeline3D::fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 }
 
 
+//Lane i shades the fragment lanes[i], the inactive lanes replicate the first active one
+static inline void replicateInactiveLanes(const QuadMask &active, int lanes[4])
+{
+	int first = 0;
+	while (first < 3 && !active[first])
+		++first;
+	for (int i = 0; i < 4; ++i)
+	{
+		lanes[i] = active[i] ? i : first;
+	}
+}
+
+void Pipeline3D::fetchMaterialQuad(const QuadFragments &quad, const int lanes[4], TextureLod &lod,
+	QuadVec3 &difColor, QuadVec3 &speColor, QuadVec3 &glowColor, QuadFloat &alpha) const
+{
+	//Replicated lanes, e.g. the coarse shading, only fetch once
+	const bool single = lanes[1] == lanes[0] && lanes[2] == lanes[0] && lanes[3] == lanes[0];
+	glm::vec2 uv[4];
+	for (int i = 0; i < 4; ++i)
+		uv[i] = quad.m_fragments[lanes[i]].m_tex;
+
+	auto fetch = [&](const Texture *tex, glm::vec4 texels[4]) -> void
+	{
+		if (single)
+		{
+			texels[0] = texels[1] = texels[2] = texels[3] = texture(tex, uv[0], lod);
+		}
+		else
+		{
+			textureQuad(tex, uv, lod, texels);
+		}
+	};
+
+	glm::vec4 texels[4];
+	if (m_diffuseTex != nullptr)
+	{
+		fetch(m_diffuseTex, texels);
+		for (int i = 0; i < 4; ++i)
+		{
+			difColor.setLane(i, glm::vec3(texels[i]));
+			alpha[i] = texels[i].a;
+		}
+	}
+	else
+	{
+		difColor = QuadVec3(m_kD);
+		alpha = QuadFloat(1.0f);
+	}
+
+	if (m_specularTex != nullptr)
+	{
+		fetch(m_specularTex, texels);
+		for (int i = 0; i < 4; ++i)
+			speColor.setLane(i, glm::vec3(texels[i]));
+	}
+	else
+	{
+		speColor = QuadVec3(m_kS);
+	}
+
+	if (m_glowTex != nullptr)
+	{
+		fetch(m_glowTex, texels);
+		for (int i = 0; i < 4; ++i)
+			glowColor.setLane(i, glm::vec3(texels[i]));
+	}
+	else
+	{
+		glowColor = QuadVec3(m_kE);
+	}
+}
+
+void Pipeline3D::shadeSurfaceQuad(const QuadSurface &surface, const LightIndices &lights, glm::vec4 fragColor[4]) const
+{
+	//Calculate the lighting
+	QuadVec3 hdrColor = lightingQuad(surface.m_pos, surface.m_nor, surface.m_ambient, surface.m_diffuse,
+		surface.m_specular, QuadFloat(m_shininess), lights, true) + surface.m_emission;
+
+	//Tone mapping: HDR -> LDR
+	QuadVec3 ldrColor = QuadVec3(glm::vec3(1.0f)) - quadExp(hdrColor * QuadFloat(-m_exposure));
+	for (int i = 0; i < 4; ++i)
+		fragColor[i] = glm::vec4(ldrColor.lane(i), surface.m_alpha[i] * m_transparency);
+}
+
+void Pipeline3D::writeGBufferQuad(const QuadSurface &surface, GBufferTexel texels[4]) const
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		texels[i].m_pos = surface.m_pos.lane(i);
+		texels[i].m_nor = surface.m_nor.lane(i);
+		texels[i].m_ambient = surface.m_ambient.lane(i);
+		texels[i].m_diffuse = surface.m_diffuse.lane(i);
+		texels[i].m_specular = surface.m_specular.lane(i);
+		texels[i].m_emission = surface.m_emission.lane(i);
+		texels[i].m_shininess = m_shininess;
+		texels[i].m_alpha = surface.m_alpha[i] * m_transparency;
+	}
+}
+
 void DoNothingShading::vertexShader(VertexData &vertex) const {
 	//do nothing at all
 	vertex.m_cpos = glm::vec4(vertex.m_pos, 1.0f);
@@ -34,8 +133,9 @@ void TextureShading::fragmentShader(const FragmentData &data, glm::vec4 &fragCol
 	//Default color
 	fragColor = glm::vec4(m_kE, 1.0f);
 
-	if (m_diffuseTexId != -1) {
-		fragColor = texture(m_diffuseTexId, data.m_tex, dUVdx, dUVdy);
+	if (m_diffuseTex != nullptr) {
+		TextureLod lod(dUVdx, dUVdy, m_maxAnisotropy);
+		fragColor = texture(m_diffuseTex, data.m_tex, lod);
 	}
 }
 
@@ -58,7 +158,7 @@ void LODVisualize::fragmentShader(const FragmentData &data, glm::vec4 &fragColor
 		glm::vec3(0.25f, 0.25f, 0.25f),
 		glm::vec3(0.125f, 0.125f, 0.125f)
 	};
-	auto& tex = Pipeline::getTexture(m_diffuseTexId);
+	const Texture *tex = m_diffuseTex;
 	int w = 1000, h = 100;
 	if (tex != nullptr)
 	{
@@ -77,13 +177,14 @@ void LODVisualize::fragmentShader(const FragmentData &data, glm::vec4 &fragColor
 void PhongShading::fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 	const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const {
 	fragColor = glm::vec4(0.0f);
+	TextureLod lod(dUVdx, dUVdy, m_maxAnisotropy);
 
 	//Fetch the corresponding color 
 	glm::vec3 ambColor, difColor, speColor, glowColor;
-	glm::vec4 difftexcolor = (m_diffuseTexId != -1) ? texture(m_diffuseTexId, data.m_tex, dUVdx, dUVdy) : glm::vec4(1.0f);
-	ambColor = difColor = (m_diffuseTexId != -1) ? glm::vec3(difftexcolor) : m_kD;
-	speColor = (m_specularTexId != -1) ? glm::vec3(texture(m_specularTexId, data.m_tex, dUVdx, dUVdy)) : m_kS;
-	glowColor = (m_glowTexId != -1) ? glm::vec3(texture(m_glowTexId, data.m_tex, dUVdx, dUVdy)) : m_kE;
+	glm::vec4 difftexcolor = (m_diffuseTex != nullptr) ? texture(m_diffuseTex, data.m_tex, lod) : glm::vec4(1.0f);
+	ambColor = difColor = (m_diffuseTex != nullptr) ? glm::vec3(difftexcolor) : m_kD;
+	speColor = (m_specularTex != nullptr) ? glm::vec3(texture(m_specularTex, data.m_tex, lod)) : m_kS;
+	glowColor = (m_glowTex != nullptr) ? glm::vec3(texture(m_glowTex, data.m_tex, lod)) : m_kE;
 
 	//No lighting
 	if (!m_lightingEnable) {
@@ -136,16 +237,54 @@ void PhongShading::fragmentShader(const FragmentData &data, glm::vec4 &fragColor
 }
 
 
+void PhongShading::fragmentShaderQuad(const QuadFragments &quad, const QuadMask &active,
+	const LightIndices &lights, glm::vec4 fragColor[4]) const {
+	TextureLod lod(glm::vec2(quad.dUdx(), quad.dVdx()), glm::vec2(quad.dUdy(), quad.dVdy()), m_maxAnisotropy);
+	int lanes[4];
+	replicateInactiveLanes(active, lanes);
+
+	//Fetch the corresponding color 
+	QuadVec3 difColor, speColor, glowColor;
+	QuadFloat alpha;
+	fetchMaterialQuad(quad, lanes, lod, difColor, speColor, glowColor, alpha);
+
+	//No lighting
+	if (!m_lightingEnable)
+	{
+		for (int i = 0; i < 4; ++i)
+			fragColor[i] = glm::vec4(glowColor.lane(i), 1.0f);
+		return;
+	}
+
+	//Calculate the lighting
+	QuadVec3 fragPos, normal;
+	for (int i = 0; i < 4; ++i)
+	{
+		fragPos.setLane(i, quad.m_fragments[lanes[i]].m_pos);
+		normal.setLane(i, quad.m_fragments[lanes[i]].m_nor);
+	}
+	normal = quadNormalize(normal);
+	QuadVec3 hdrColor = lightingQuad(fragPos, normal, difColor, difColor * m_kD, speColor, QuadFloat(m_shininess), lights, 
+		false) + glowColor;
+
+	//Tone mapping: HDR -> LDR
+	QuadVec3 ldrColor = QuadVec3(glm::vec3(1.0f)) - quadExp(hdrColor * QuadFloat(-m_exposure));
+	for (int i = 0; i < 4; ++i)
+		fragColor[i] = glm::vec4(ldrColor.lane(i), alpha[i] * m_transparency);
+}
+
+
 void BlinnPhongShading::fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 	const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const {
 	fragColor = glm::vec4(0.0f);
+	TextureLod lod(dUVdx, dUVdy, m_maxAnisotropy);
 
 	//Fetch the corresponding color 
 	glm::vec3 ambColor, difColor, speColor, glowColor;
-	glm::vec4 difftexcolor = (m_diffuseTexId != -1) ? texture(m_diffuseTexId, data.m_tex, dUVdx, dUVdy) : glm::vec4(1.0f);
-	ambColor = difColor = (m_diffuseTexId != -1) ? glm::vec3(difftexcolor) : m_kD;
-	speColor = (m_specularTexId != -1) ? glm::vec3(texture(m_specularTexId, data.m_tex, dUVdx, dUVdy)) : m_kS;
-	glowColor = (m_glowTexId != -1) ? glm::vec3(texture(m_glowTexId, data.m_tex, dUVdx, dUVdy)) : m_kE;
+	glm::vec4 difftexcolor = (m_diffuseTex != nullptr) ? texture(m_diffuseTex, data.m_tex, lod) : glm::vec4(1.0f);
+	ambColor = difColor = (m_diffuseTex != nullptr) ? glm::vec3(difftexcolor) : m_kD;
+	speColor = (m_specularTex != nullptr) ? glm::vec3(texture(m_specularTex, data.m_tex, lod)) : m_kS;
+	glowColor = (m_glowTex != nullptr) ? glm::vec3(texture(m_glowTex, data.m_tex, lod)) : m_kE;
 
 	//No lighting
 	if (!m_lightingEnable)
@@ -199,6 +338,49 @@ void BlinnPhongShading::fragmentShader(const FragmentData &data, glm::vec4 &frag
 }
 
 
+void BlinnPhongShading::surfaceQuad(const QuadFragments &quad, const QuadMask &active, QuadSurface &surface) const {
+	TextureLod lod(glm::vec2(quad.dUdx(), quad.dVdx()), glm::vec2(quad.dUdy(), quad.dVdy()), m_maxAnisotropy);
+	int lanes[4];
+	replicateInactiveLanes(active, lanes);
+
+	//Fetch the corresponding color 
+	QuadVec3 difColor;
+	fetchMaterialQuad(quad, lanes, lod, difColor, surface.m_specular, surface.m_emission, surface.m_alpha);
+	surface.m_ambient = difColor * m_kA;
+	surface.m_diffuse = difColor * m_kD;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		surface.m_pos.setLane(i, quad.m_fragments[lanes[i]].m_pos);
+		surface.m_nor.setLane(i, quad.m_fragments[lanes[i]].m_nor);
+	}
+	surface.m_nor = quadNormalize(surface.m_nor);
+}
+
+void BlinnPhongShading::fragmentShaderQuad(const QuadFragments &quad, const QuadMask &active, 
+	const LightIndices &lights, glm::vec4 fragColor[4]) const {
+	QuadSurface surface;
+	surfaceQuad(quad, active, surface);
+
+	//No lighting
+	if (!m_lightingEnable)
+	{
+		for (int i = 0; i < 4; ++i)
+			fragColor[i] = glm::vec4(surface.m_emission.lane(i), surface.m_alpha[i]);
+		return;
+	}
+
+	shadeSurfaceQuad(surface, lights, fragColor);
+}
+
+void BlinnPhongShading::fragmentShaderGBuffer(const QuadFragments &quad, const QuadMask &active, 
+	GBufferTexel texels[4]) const {
+	QuadSurface surface;
+	surfaceQuad(quad, active, surface);
+	writeGBufferQuad(surface, texels);
+}
+
+
 void BlinnPhongNormalMapShading::vertexShader(VertexData &vertex) const {
 	//Local space -> World space -> Camera space -> Project space
 	vertex.m_pos = glm::vec3(m_modelMatrix * glm::vec4(vertex.m_pos.x, vertex.m_pos.y, vertex.m_pos.z, 1.0f));
@@ -214,13 +396,14 @@ void BlinnPhongNormalMapShading::vertexShader(VertexData &vertex) const {
 void BlinnPhongNormalMapShading::fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 	const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const {
 	fragColor = glm::vec4(0.0f);
+	TextureLod lod(dUVdx, dUVdy, m_maxAnisotropy);
 
 	//Fetch the corresponding color 
 	glm::vec3 ambColor, difColor, speColor, glowColor;
-	glm::vec4 difftexcolor = (m_diffuseTexId != -1) ? texture(m_diffuseTexId, data.m_tex, dUVdx, dUVdy) : glm::vec4(1.0f);
-	ambColor = difColor = (m_diffuseTexId != -1) ? glm::vec3(difftexcolor) : m_kD;
-	speColor = (m_specularTexId != -1) ? glm::vec3(texture(m_specularTexId, data.m_tex, dUVdx, dUVdy)) : m_kS;
-	glowColor = (m_glowTexId != -1) ? glm::vec3(texture(m_glowTexId, data.m_tex, dUVdx, dUVdy)) : m_kE;
+	glm::vec4 difftexcolor = (m_diffuseTex != nullptr) ? texture(m_diffuseTex, data.m_tex, lod) : glm::vec4(1.0f);
+	ambColor = difColor = (m_diffuseTex != nullptr) ? glm::vec3(difftexcolor) : m_kD;
+	speColor = (m_specularTex != nullptr) ? glm::vec3(texture(m_specularTex, data.m_tex, lod)) : m_kS;
+	glowColor = (m_glowTex != nullptr) ? glm::vec3(texture(m_glowTex, data.m_tex, lod)) : m_kE;
 
 	//No lighting
 	if (!m_lightingEnable)
@@ -231,9 +414,9 @@ void BlinnPhongNormalMapShading::fragmentShader(const FragmentData &data, glm::v
 
 	//Normal
 	glm::vec3 normal = data.m_nor;
-	if (m_normalTexId != -1)
+	if (m_normalTex != nullptr)
 	{
-		normal = glm::vec3(texture(m_normalTexId, data.m_tex, dUVdx, dUVdy)) * 2.0f - glm::vec3(1.0f);
+		normal = glm::vec3(texture(m_normalTex, data.m_tex, lod)) * 2.0f - glm::vec3(1.0f);
 		normal = data.m_tbn * normal;
 	}
 	normal = glm::normalize(normal);
@@ -281,17 +464,119 @@ void BlinnPhongNormalMapShading::fragmentShader(const FragmentData &data, glm::v
 }
 
 
+void BlinnPhongNormalMapShading::surfaceQuad(const QuadFragments &quad, const QuadMask &active, 
+	QuadSurface &surface) const {
+	TextureLod lod(glm::vec2(quad.dUdx(), quad.dVdx()), glm::vec2(quad.dUdy(), quad.dVdy()), m_maxAnisotropy);
+	int lanes[4];
+	replicateInactiveLanes(active, lanes);
+
+	//Fetch the corresponding color 
+	QuadVec3 difColor;
+	fetchMaterialQuad(quad, lanes, lod, difColor, surface.m_specular, surface.m_emission, surface.m_alpha);
+	surface.m_ambient = difColor;
+	surface.m_diffuse = difColor * m_kD;
+
+	//Normal
+	for (int i = 0; i < 4; ++i)
+	{
+		const auto &data = quad.m_fragments[lanes[i]];
+		surface.m_pos.setLane(i, data.m_pos);
+		surface.m_nor.setLane(i, data.m_nor);
+		//Note: the replicated lanes are fetched only once
+		if (m_normalTex != nullptr && lanes[i] == i)
+		{
+			glm::vec3 texNormal = glm::vec3(texture(m_normalTex, data.m_tex, lod)) * 2.0f - glm::vec3(1.0f);
+			surface.m_nor.setLane(i, data.m_tbn * texNormal);
+		}
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		if (lanes[i] != i)
+			surface.m_nor.setLane(i, surface.m_nor.lane(lanes[i]));
+	}
+	surface.m_nor = quadNormalize(surface.m_nor);
+}
+
+void BlinnPhongNormalMapShading::fragmentShaderQuad(const QuadFragments &quad, const QuadMask &active,
+	const LightIndices &lights, glm::vec4 fragColor[4]) const {
+	QuadSurface surface;
+	surfaceQuad(quad, active, surface);
+
+	//No lighting
+	if (!m_lightingEnable)
+	{
+		for (int i = 0; i < 4; ++i)
+			fragColor[i] = glm::vec4(surface.m_emission.lane(i), 1.0f);
+		return;
+	}
+
+	shadeSurfaceQuad(surface, lights, fragColor);
+}
+
+void BlinnPhongNormalMapShading::fragmentShaderGBuffer(const QuadFragments &quad, const QuadMask &active,
+	GBufferTexel texels[4]) const {
+	QuadSurface surface;
+	surfaceQuad(quad, active, surface);
+	writeGBufferQuad(surface, texels);
+}
+
+
 void AlphaBlendingShading::fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 	const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const {
 	//Default color
 	fragColor = glm::vec4(m_kE, 1.0f);
 
-	if (m_diffuseTexId != -1)
+	if (m_diffuseTex != nullptr)
 	{
-		fragColor = texture(m_diffuseTexId, data.m_tex, dUVdx, dUVdy);
+		TextureLod lod(dUVdx, dUVdy, m_maxAnisotropy);
+		fragColor = texture(m_diffuseTex, data.m_tex, lod);
 	}
 
 	fragColor.a *= m_transparency;
 }
 
+
+void PRTShading::vertexShader(VertexData &vertex) const {
+	Pipeline3D::vertexShader(vertex);
+
+	//Exitant radiance of the vertex
+	SHTransfer transfer;
+	if (vertex.m_transfer == nullptr)
+	{
+		evalSHCosineTransfer(vertex.m_nor, transfer);
+	}
+	vertex.m_color = glm::max(dotSH(vertex.m_transfer != nullptr ? *vertex.m_transfer : transfer, m_envLighting), glm::vec3(0.0f));
+	vertex.m_needInterpolatedColor = true;
+}
+
+void PRTShading::fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
+	const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const {
+	TextureLod lod(dUVdx, dUVdy, m_maxAnisotropy);
+	//Fetch the corresponding color 
+	glm::vec4 difftexcolor = (m_diffuseTex != nullptr) ? texture(m_diffuseTex, data.m_tex, lod) : glm::vec4(1.0f);
+	glm::vec3 difColor = (m_diffuseTex != nullptr) ? glm::vec3(difftexcolor) : m_kD;
+	glm::vec3 glowColor = (m_glowTex != nullptr) ? glm::vec3(texture(m_glowTex, data.m_tex, lod)) : m_kE;
+
+	//No lighting
+	if (!m_lightingEnable) {
+		fragColor = glm::vec4(glowColor, 1.0f);
+		return;
+	}
+
+	//Note: the transfer excludes the albedo, so that textured surfaces share the bake
+	glm::vec3 hdrColor = difColor * data.m_color + glowColor;
+
+	//Tone mapping: HDR -> LDR
+	fragColor = glm::vec4(glm::vec3(1.0f) - glm::exp(-hdrColor * m_exposure), difftexcolor.a * m_transparency);
+}
+
+//Shader specialized shading loops
+template class PipelineT<TextureShading, Pipeline3D>;
+template class PipelineT<LODVisualize, Pipeline3D>;
+template class PipelineT<PhongShading, Pipeline3D>;
+template class PipelineT<BlinnPhongShading, Pipeline3D>;
+template class PipelineT<BlinnPhongNormalMapShading, Pipeline3D>;
+template class PipelineT<AlphaBlendingShading, Pipeline3D>;
+template class PipelineT<PRTShading, Pipeline3D>;
+
 } // namespace sr
\ No newline at end of file
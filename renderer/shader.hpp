@@ -1,6 +1,7 @@
 #pragma once
 
 #include "pipeline.hpp"
+#include "pipeline_t.hpp"
 
 namespace sr {
 
@@ -10,10 +11,27 @@ public:
 
 	virtual ~Pipeline3D() = default;
 
+	virtual Pipeline::ptr clone() const override { return std::make_shared<Pipeline3D>(*this); }
+
 	virtual void vertexShader(VertexData &vertex) const override;
 	virtual void fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
 
+protected:
+	//Quad-wide helpers, lanes[i] is the fragment shaded by lane i (inactive lanes replicate an active one)
+	void fetchMaterialQuad(const QuadFragments &quad, const int lanes[4], TextureLod &lod,
+		QuadVec3 &difColor, QuadVec3 &speColor, QuadVec3 &glowColor, QuadFloat &alpha) const;
+
+	//Surface attributes of the quad lanes
+	struct QuadSurface {
+		QuadVec3 m_pos, m_nor;
+		QuadVec3 m_ambient, m_diffuse, m_specular, m_emission;	//Note: diffuse coefficient is premultiplied
+		QuadFloat m_alpha;
+	};
+	//Blinn-Phong lighting and tone mapping of the surface
+	void shadeSurfaceQuad(const QuadSurface &surface, const LightIndices &lights, glm::vec4 fragColor[4]) const;
+	void writeGBufferQuad(const QuadSurface &surface, GBufferTexel texels[4]) const;
+
 };
 
 class DoNothingShading : public Pipeline {
@@ -21,12 +39,14 @@ public:
 	typedef std::shared_ptr<DoNothingShading> ptr;
 	virtual ~DoNothingShading() = default;
 
+	virtual Pipeline::ptr clone() const override { return std::make_shared<DoNothingShading>(*this); }
+
 	virtual void vertexShader(VertexData &vertex) const override;
 	virtual void fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
 };
 
-class TextureShading final : public Pipeline3D {
+class TextureShading final : public PipelineT<TextureShading, Pipeline3D> {
 public:
 
 	typedef std::shared_ptr<TextureShading> ptr;
@@ -37,7 +57,7 @@ public:
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
 };
 
-class LODVisualize final : public Pipeline3D {
+class LODVisualize final : public PipelineT<LODVisualize, Pipeline3D> {
 public:
 	typedef std::shared_ptr<LODVisualize> ptr;
 
@@ -47,7 +67,7 @@ public:
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
 };
 
-class PhongShading final : public Pipeline3D {
+class PhongShading final : public PipelineT<PhongShading, Pipeline3D> {
 public:
 	typedef std::shared_ptr<PhongShading> ptr;
 
@@ -55,9 +75,11 @@ public:
 
 	virtual void fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
+	virtual void fragmentShaderQuad(const QuadFragments &quad, const QuadMask &active, 
+		const LightIndices &lights, glm::vec4 fragColor[4]) const override;
 };
 
-class BlinnPhongShading final : public Pipeline3D {
+class BlinnPhongShading final : public PipelineT<BlinnPhongShading, Pipeline3D> {
 public:
 	typedef std::shared_ptr<BlinnPhongShading> ptr;
 
@@ -65,9 +87,18 @@ public:
 
 	virtual void fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
+	virtual void fragmentShaderQuad(const QuadFragments &quad, const QuadMask &active, 
+		const LightIndices &lights, glm::vec4 fragColor[4]) const override;
+
+	virtual bool supportDeferredShading() const override { return m_lightingEnable; }
+	virtual void fragmentShaderGBuffer(const QuadFragments &quad, const QuadMask &active, 
+		GBufferTexel texels[4]) const override;
+
+private:
+	void surfaceQuad(const QuadFragments &quad, const QuadMask &active, QuadSurface &surface) const;
 };
 
-class BlinnPhongNormalMapShading final : public Pipeline3D
+class BlinnPhongNormalMapShading final : public PipelineT<BlinnPhongNormalMapShading, Pipeline3D>
 {
 public:
 	typedef std::shared_ptr<BlinnPhongNormalMapShading> ptr;
@@ -77,9 +108,18 @@ public:
 	virtual void vertexShader(VertexData &vertex) const override;
 	virtual void fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
+	virtual void fragmentShaderQuad(const QuadFragments &quad, const QuadMask &active, 
+		const LightIndices &lights, glm::vec4 fragColor[4]) const override;
+
+	virtual bool supportDeferredShading() const override { return m_lightingEnable; }
+	virtual void fragmentShaderGBuffer(const QuadFragments &quad, const QuadMask &active, 
+		GBufferTexel texels[4]) const override;
+
+private:
+	void surfaceQuad(const QuadFragments &quad, const QuadMask &active, QuadSurface &surface) const;
 };
 
-class AlphaBlendingShading final : public Pipeline3D {
+class AlphaBlendingShading final : public PipelineT<AlphaBlendingShading, Pipeline3D> {
 public:
 	typedef std::shared_ptr<AlphaBlendingShading> ptr;
 
@@ -89,6 +129,36 @@ public:
 		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
 };
 
+//Diffuse lighting of the distant environment with the precomputed radiance transfer, see PRTBaker
+//Note: the exitant radiance dot(transfer, lighting) is evaluated per vertex and interpolated.
+//      Vertices without baked transfer fall back to the unshadowed cosine transfer of the normal.
+class PRTShading final : public PipelineT<PRTShading, Pipeline3D> {
+public:
+	typedef std::shared_ptr<PRTShading> ptr;
+
+	virtual ~PRTShading() = default;
+
+	//World space environment lighting, e.g. from PRTBaker::projectLighting
+	void setEnvironmentLighting(const SHLighting &lighting) { m_envLighting = lighting; }
+	const SHLighting &getEnvironmentLighting() const { return m_envLighting; }
+
+	virtual void vertexShader(VertexData &vertex) const override;
+	virtual void fragmentShader(const FragmentData &data, glm::vec4 &fragColor,
+		const glm::vec2 &dUVdx, const glm::vec2 &dUVdy) const override;
+
+private:
+	SHLighting m_envLighting = SHLighting();
+};
+
+//Note: the specialized shading loops are instantiated in shader.cpp along with the shader bodies
+extern template class PipelineT<TextureShading, Pipeline3D>;
+extern template class PipelineT<LODVisualize, Pipeline3D>;
+extern template class PipelineT<PhongShading, Pipeline3D>;
+extern template class PipelineT<BlinnPhongShading, Pipeline3D>;
+extern template class PipelineT<BlinnPhongNormalMapShading, Pipeline3D>;
+extern template class PipelineT<AlphaBlendingShading, Pipeline3D>;
+extern template class PipelineT<PRTShading, Pipeline3D>;
+
 // class SkyboxShading final : public Pipeline3D {
 // public:
 // 	typedef std::shared_ptr<SkyboxShading> ptr;
@@ -101,14 +171,4 @@ public:
 
 // };
 
-// class ShadowMapping final : public Pipeline3D {
-// public:
-
-// };
-
-// class PRTShading final : public Pipeline3D {
-// public:
-
-// };
-
 } // namespace sr
\ No newline at end of file
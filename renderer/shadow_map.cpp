@@ -0,0 +1,347 @@
+#include "shadow_map.hpp"
+
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include <tbb/concurrent_vector.h>
+
+#include "math_utils.hpp"
+#include "parallel_wrapper.hpp"
+
+namespace sr {
+
+static constexpr int SHADOW_TILE_SIZE = 64;		//The width and height of a tile of the shadow map in texels
+
+//A light space triangle waiting for depth rasterization
+//Note: x, y are in texels, z is ndc depth (orthographic) or 1/w (perspective) which is linear in screen space
+struct DepthTriangle {
+	glm::vec3 m_vertices[3];
+};
+
+//Test if the bounding box is outside the frustum
+static bool outsideFrustum(const glm::mat4 &viewProjectMatrix, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+	glm::vec4 corners[8];
+	for (int c = 0; c < 8; ++c)
+	{
+		glm::vec3 corner((c & 1) ? boundsMax.x : boundsMin.x, (c & 2) ? boundsMax.y : boundsMin.y,
+			(c & 4) ? boundsMax.z : boundsMin.z);
+		corners[c] = viewProjectMatrix * glm::vec4(corner, 1.0f);
+	}
+	//All the corners are outside one of the clipping planes
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		bool outsideNeg = true, outsidePos = true;
+		for (int c = 0; c < 8; ++c)
+		{
+			outsideNeg = outsideNeg && corners[c][axis] < -corners[c].w;
+			outsidePos = outsidePos && corners[c][axis] > corners[c].w;
+		}
+		if (outsideNeg || outsidePos)
+			return true;
+	}
+	return false;
+}
+
+//Smallest power of two no less than x, so that an extent fitted to the moving casters rarely changes
+static float roundUpPow2(const float &x)
+{
+	return glm::exp2(glm::ceil(glm::log2(x)));
+}
+
+bool ShadowMap::setupFrusta(const Light &light, const glm::vec3 &sceneMin, const glm::vec3 &sceneMax)
+{
+	m_viewProjectMatrix.clear();
+	const glm::vec3 sceneCenter = (sceneMin + sceneMax) * 0.5f;
+	const float sceneRadius = glm::max(glm::length(sceneMax - sceneMin) * 0.5f, 1e-3f);
+
+	auto upVector = [](const glm::vec3 &dir) -> glm::vec3
+	{
+		return glm::abs(dir.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	};
+
+	if (const SpotLight *spot = dynamic_cast<const SpotLight*>(&light))
+	{
+		glm::vec3 center;
+		float radius;
+		const bool bounded = spot->influenceSphere(center, radius);
+		m_perspective = true;
+		m_lightPos = spot->getLightPos();
+		m_far = bounded ? radius : roundUpPow2(glm::length(m_lightPos - sceneCenter) + sceneRadius);
+		const glm::vec3 &dir = spot->getSpotDirection();
+		float fovy = glm::min(2.0f * glm::degrees(glm::acos(spot->getOuterCutoff())) + 2.0f, 170.0f);
+		m_viewProjectMatrix.push_back(calcPerspProjectMatrix(fovy, 1.0f, m_far * 0.01f, m_far) *
+			calcViewMatrix(m_lightPos, m_lightPos + dir, upVector(dir)));
+	}
+	else if (const PointLight *point = dynamic_cast<const PointLight*>(&light))
+	{
+		//Cube map
+		static const glm::vec3 axes[6] =
+		{
+			glm::vec3(+1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, +1, 0),
+			glm::vec3(0, -1, 0), glm::vec3(0, 0, +1), glm::vec3(0, 0, -1)
+		};
+		glm::vec3 center;
+		float radius;
+		const bool bounded = point->influenceSphere(center, radius);
+		m_perspective = true;
+		m_lightPos = point->getLightPos();
+		m_far = bounded ? radius : roundUpPow2(glm::length(m_lightPos - sceneCenter) + sceneRadius);
+		for (int f = 0; f < 6; ++f)
+		{
+			m_viewProjectMatrix.push_back(calcPerspProjectMatrix(90.0f, 1.0f, m_far * 0.01f, m_far) *
+				calcViewMatrix(m_lightPos, m_lightPos + axes[f], upVector(axes[f])));
+		}
+	}
+	else if (const DirectionalLight *directional = dynamic_cast<const DirectionalLight*>(&light))
+	{
+		//Orthographic projection fitting the bounding sphere of the scene
+		//Note: snapped to a grid of a quarter radius, so that the frustum stays while the casters move inside it
+		const glm::vec3 &dir = directional->getLightDir();
+		const float step = roundUpPow2(sceneRadius) * 0.25f;
+		const glm::vec3 center = glm::floor(sceneCenter / step + 0.5f) * step;
+		const float radius = roundUpPow2(sceneRadius) + step;
+		m_perspective = false;
+		m_lightPos = center + dir * (2.0f * radius);
+		m_far = 3.0f * radius;
+		m_viewProjectMatrix.push_back(calcOrthoProjectMatrix(-radius, radius, -radius, radius,
+			radius, m_far) * calcViewMatrix(m_lightPos, center, upVector(dir)));
+	}
+
+	return !m_viewProjectMatrix.empty() && m_far > 0.0f;
+}
+
+bool ShadowMap::update(const Light &light, const std::vector<Model::ptr> &models)
+{
+	//Shadow casters and the bounds of the scene
+	std::vector<Model::ptr> casters;
+	glm::vec3 sceneMin(std::numeric_limits<float>::max()), sceneMax(-std::numeric_limits<float>::max());
+	for (const auto &model : models)
+	{
+		if (!model->isCastShadow() || model.get() == light.getProxyModel())
+			continue;
+		glm::vec3 boundsMin, boundsMax;
+		model->getWorldBounds(boundsMin, boundsMax);
+		sceneMin = glm::min(sceneMin, boundsMin);
+		sceneMax = glm::max(sceneMax, boundsMax);
+		casters.push_back(model);
+	}
+
+	if (casters.empty() || !setupFrusta(light, sceneMin, sceneMax))
+	{
+		m_valid = false;
+		return false;
+	}
+
+	//Only the casters inside the light's frustum matter
+	std::vector<Model::ptr> visibleCasters;
+	size_t cacheKey = FNV_OFFSET_BASIS;
+	fnv1aHash(cacheKey, &m_resolution, sizeof(m_resolution));
+	for (const auto &vp : m_viewProjectMatrix)
+	{
+		fnv1aHash(cacheKey, &vp, sizeof(vp));
+	}
+	for (const auto &model : casters)
+	{
+		glm::vec3 boundsMin, boundsMax;
+		model->getWorldBounds(boundsMin, boundsMax);
+		bool visible = false;
+		for (const auto &vp : m_viewProjectMatrix)
+		{
+			visible = visible || !outsideFrustum(vp, boundsMin, boundsMax);
+		}
+		if (visible)
+		{
+			//Note: the version covers the transform and the settings, the buffers cover the replaced meshes
+			const Model *ptr = model.get();
+			const unsigned int version = model->getVersion();
+			fnv1aHash(cacheKey, &ptr, sizeof(ptr));
+			fnv1aHash(cacheKey, &version, sizeof(version));
+			fnv1aHash(cacheKey, &model->getModelMatrix(), sizeof(glm::mat4));
+			for (const auto &mesh : model->getDrawableSubMeshes())
+			{
+				const void *vertices = mesh.getVertices().data();
+				const size_t sizes[2] = { mesh.getVertices().size(), mesh.getIndices().size() };
+				fnv1aHash(cacheKey, &vertices, sizeof(vertices));
+				fnv1aHash(cacheKey, sizes, sizeof(sizes));
+			}
+			visibleCasters.push_back(model);
+		}
+	}
+
+	//Nothing changed, reuse the cached shadow map
+	if (m_valid && cacheKey == m_cacheKey)
+		return false;
+
+	m_depth.resize(m_viewProjectMatrix.size());
+	for (int f = 0; f < (int)m_viewProjectMatrix.size(); ++f)
+	{
+		rasterizeDepth(f, visibleCasters);
+	}
+	m_cacheKey = cacheKey;
+	m_valid = true;
+	return true;
+}
+
+void ShadowMap::rasterizeDepth(const int &face, const std::vector<Model::ptr> &casters)
+{
+	const glm::mat4 &viewProjectMatrix = m_viewProjectMatrix[face];
+	const int tilesX = (m_resolution + SHADOW_TILE_SIZE - 1) / SHADOW_TILE_SIZE;
+	const float res = static_cast<float>(m_resolution);
+
+	auto &depth = m_depth[face];
+	depth.assign(m_resolution * m_resolution, 1.0f);
+
+	//Triangle setup and binning
+	tbb::concurrent_vector<DepthTriangle> triangles;
+	std::vector<tbb::concurrent_vector<unsigned int>> bins(tilesX * tilesX);
+	for (const auto &model : casters)
+	{
+		const glm::mat4 mvp = viewProjectMatrix * model->getModelMatrix();
+		for (const auto &mesh : model->getDrawableSubMeshes())
+		{
+			const auto &vertices = mesh.getVertices();
+			const auto &indices = mesh.getIndices();
+			std::vector<glm::vec4> clipPos(vertices.size());
+			parallelFor((size_t)0, vertices.size(), [&](const size_t &i)
+			{
+				clipPos[i] = mvp * glm::vec4(vertices[i].m_vpositions, 1.0f);
+			}, ExecutionPolicy::PARALLEL);
+
+			parallelFor((size_t)0, indices.size() / 3, [&](const size_t &f)
+			{
+				//Clipping against the near plane (z >= -w)
+				const glm::vec4 corners[3] = { clipPos[indices[f * 3 + 0]], clipPos[indices[f * 3 + 1]], clipPos[indices[f * 3 + 2]] };
+				glm::vec4 polygon[4];
+				int num = 0;
+				for (int i = 0; i < 3; ++i)
+				{
+					const glm::vec4 &curr = corners[i], &next = corners[(i + 1) % 3];
+					float dc = curr.z + curr.w, dn = next.z + next.w;
+					if (dc >= 0.0f)
+						polygon[num++] = curr;
+					if ((dc >= 0.0f) != (dn >= 0.0f))
+						polygon[num++] = curr + (next - curr) * (dc / (dc - dn));
+				}
+
+				//Perspective division and viewport transformation
+				glm::vec3 screen[4];
+				for (int i = 0; i < num; ++i)
+				{
+					float rhw = 1.0f / polygon[i].w;
+					screen[i] = glm::vec3((polygon[i].x * rhw * 0.5f + 0.5f) * res, (polygon[i].y * rhw * 0.5f + 0.5f) * res,
+						m_perspective ? rhw : polygon[i].z * 0.5f + 0.5f);
+				}
+
+				//Triangle fan
+				for (int i = 1; i + 1 < num; ++i)
+				{
+					DepthTriangle tri = { { screen[0], screen[i], screen[i + 1] } };
+					glm::vec2 bmin = glm::min(glm::vec2(tri.m_vertices[0]), glm::min(glm::vec2(tri.m_vertices[1]), glm::vec2(tri.m_vertices[2])));
+					glm::vec2 bmax = glm::max(glm::vec2(tri.m_vertices[0]), glm::max(glm::vec2(tri.m_vertices[1]), glm::vec2(tri.m_vertices[2])));
+					glm::ivec2 tmin = glm::max(glm::ivec2(bmin) / SHADOW_TILE_SIZE, glm::ivec2(0));
+					glm::ivec2 tmax = glm::min(glm::ivec2(bmax) / SHADOW_TILE_SIZE, glm::ivec2(tilesX - 1));
+					if (bmax.x < 0.0f || bmax.y < 0.0f || tmin.x > tmax.x || tmin.y > tmax.y)
+						continue;
+
+					unsigned int index = static_cast<unsigned int>(triangles.push_back(tri) - triangles.begin());
+					for (int ty = tmin.y; ty <= tmax.y; ++ty)
+					{
+						for (int tx = tmin.x; tx <= tmax.x; ++tx)
+						{
+							bins[ty * tilesX + tx].push_back(index);
+						}
+					}
+				}
+			}, ExecutionPolicy::PARALLEL);
+		}
+	}
+
+	//Depth rasterization of each tile, keep the nearest depth
+	parallelFor((int)0, tilesX * tilesX, [&](const int &t)
+	{
+		const int x0 = (t % tilesX) * SHADOW_TILE_SIZE, y0 = (t / tilesX) * SHADOW_TILE_SIZE;
+		const int x1 = glm::min(x0 + SHADOW_TILE_SIZE, m_resolution) - 1, y1 = glm::min(y0 + SHADOW_TILE_SIZE, m_resolution) - 1;
+		for (const auto &index : bins[t])
+		{
+			const auto &v = triangles[index].m_vertices;
+			float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+			if (glm::abs(area) < 1e-8f)
+				continue;
+			const float invArea = 1.0f / area;
+
+			//Note: no face culling, both sides cast shadows
+			int minX = glm::max(static_cast<int>(glm::floor(glm::min(v[0].x, glm::min(v[1].x, v[2].x)))), x0);
+			int maxX = glm::min(static_cast<int>(glm::ceil(glm::max(v[0].x, glm::max(v[1].x, v[2].x)))), x1);
+			int minY = glm::max(static_cast<int>(glm::floor(glm::min(v[0].y, glm::min(v[1].y, v[2].y)))), y0);
+			int maxY = glm::min(static_cast<int>(glm::ceil(glm::max(v[0].y, glm::max(v[1].y, v[2].y)))), y1);
+			for (int y = minY; y <= maxY; ++y)
+			{
+				for (int x = minX; x <= maxX; ++x)
+				{
+					//Edge functions at the texel center
+					glm::vec2 p(x + 0.5f, y + 0.5f);
+					float w0 = ((v[1].x - p.x) * (v[2].y - p.y) - (v[2].x - p.x) * (v[1].y - p.y)) * invArea;
+					float w1 = ((v[2].x - p.x) * (v[0].y - p.y) - (v[0].x - p.x) * (v[2].y - p.y)) * invArea;
+					float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+
+					float z = w0 * v[0].z + w1 * v[1].z + w2 * v[2].z;
+					float d = m_perspective ? 1.0f / (z * m_far) : z;
+					float &dst = depth[y * m_resolution + x];
+					dst = glm::min(dst, d);
+				}
+			}
+		}
+	}, ExecutionPolicy::PARALLEL);
+}
+
+float ShadowMap::visibility(const glm::vec3 &worldPos, const float &cosTheta) const
+{
+	if (!m_valid)
+		return 1.0f;
+
+	//Cube map face of the major axis
+	int face = 0;
+	if (m_viewProjectMatrix.size() == 6)
+	{
+		glm::vec3 dir = worldPos - m_lightPos;
+		glm::vec3 absDir = glm::abs(dir);
+		if (absDir.x >= absDir.y && absDir.x >= absDir.z)
+			face = dir.x > 0.0f ? 0 : 1;
+		else if (absDir.y >= absDir.z)
+			face = dir.y > 0.0f ? 2 : 3;
+		else
+			face = dir.z > 0.0f ? 4 : 5;
+	}
+
+	glm::vec4 clipPos = m_viewProjectMatrix[face] * glm::vec4(worldPos, 1.0f);
+	if (clipPos.w <= 0.0f)
+		return 1.0f;
+	glm::vec3 ndcPos = glm::vec3(clipPos) / clipPos.w;
+	float depth = m_perspective ? clipPos.w / m_far : ndcPos.z * 0.5f + 0.5f;
+	if (glm::abs(ndcPos.x) > 1.0f || glm::abs(ndcPos.y) > 1.0f || depth > 1.0f)
+		return 1.0f;
+
+	//Slope scaled bias against shadow acne
+	//Refs: https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping
+	const float bias = glm::max(0.005f * (1.0f - cosTheta), 0.0005f);
+	const auto &shadowDepth = m_depth[face];
+	const int cx = static_cast<int>((ndcPos.x * 0.5f + 0.5f) * m_resolution);
+	const int cy = static_cast<int>((ndcPos.y * 0.5f + 0.5f) * m_resolution);
+	float lit = 0.0f;
+	for (int dy = -1; dy <= 1; ++dy)
+	{
+		for (int dx = -1; dx <= 1; ++dx)
+		{
+			int x = glm::clamp(cx + dx, 0, m_resolution - 1);
+			int y = glm::clamp(cy + dy, 0, m_resolution - 1);
+			lit += (depth - bias > shadowDepth[y * m_resolution + x]) ? 0.0f : 1.0f;
+		}
+	}
+	return lit / 9.0f;
+}
+
+} // namespace sr
\ No newline at end of file
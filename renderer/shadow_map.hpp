@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include <glm/glm.hpp>
+
+#include "light.hpp"
+#include "model.hpp"
+
+namespace sr {
+
+//Depth maps rendered from a light for shadowing
+//Directional and spot lights have one face, point lights have six faces as a cube map (+X, -X, +Y, -Y, +Z, -Z)
+class ShadowMap final {
+public:
+	typedef std::shared_ptr<ShadowMap> ptr;
+
+	ShadowMap(int resolution) : m_resolution(resolution) {}
+	~ShadowMap() = default;
+
+	int getResolution() const { return m_resolution; }
+	int getFaceNum() const { return static_cast<int>(m_viewProjectMatrix.size()); }
+
+	//Re-render the depth of the shadow casters only if the light or any caster inside its frustum changed
+	//Note: the frusta of point and spot lights only depend on the light, the proxy model of the light casts no shadow
+	//Return true if re-rendered
+	bool update(const Light &light, const std::vector<Model::ptr> &models);
+
+	//Percentage closer filtering (3x3), return the lit ratio
+	//Note: cosTheta is the cosine between the normal and the light direction, for slope scaled biasing
+	float visibility(const glm::vec3 &worldPos, const float &cosTheta) const;
+
+private:
+	//Light frustum of each face, return false if no shadow could be cast
+	bool setupFrusta(const Light &light, const glm::vec3 &sceneMin, const glm::vec3 &sceneMax);
+	//Depth-only rasterization of the casters
+	void rasterizeDepth(const int &face, const std::vector<Model::ptr> &casters);
+
+private:
+	int m_resolution;
+	bool m_perspective = false;
+	float m_far = 1.0f;
+	glm::vec3 m_lightPos = glm::vec3(0.0f);
+
+	//Note: depth is linear in [0,1], i.e. view depth / far for perspective faces and ndc depth for orthographic ones
+	std::vector<glm::mat4> m_viewProjectMatrix;
+	std::vector<std::vector<float>> m_depth;
+
+	size_t m_cacheKey = 0;
+	bool m_valid = false;
+};
+
+} // namespace sr
\ No newline at end of file
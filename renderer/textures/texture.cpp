@@ -1,47 +1,133 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_WINDOWS_UTF8
 #include "stb_image.h"
 
 #include "parallel_wrapper.hpp"
+#include "math_utils.hpp"
+#include "mapped_file.hpp"
 #include "Texture.hpp"
+#include "texture_streaming.hpp"
+#include "texture_filter.hpp"
+#include "quad_simd.hpp"
 
 namespace sr {
 
+std::string Texture::m_cacheDirectory = "";
+
 Texture::Texture() :
 	m_generateMipmap(false),
 	m_warpMode(TextureWarpMode::MIRRORED_REPEAT),
-	m_filteringMode(TextureFilterMode::LINEAR) {}
+	m_filteringMode(TextureFilterMode::LINEAR) {
+	bindSampler();
+}
 
-Texture::Texture(bool generatedMipmap) :
+Texture::Texture(bool generatedMipmap, TextureCompressionMode compression) :
 	m_generateMipmap(generatedMipmap),
+	m_compressionMode(compression),
 	m_warpMode(TextureWarpMode::MIRRORED_REPEAT),
-	m_filteringMode(TextureFilterMode::LINEAR) {}
+	m_filteringMode(TextureFilterMode::LINEAR) {
+	bindSampler();
+}
 
-void Texture::setWarpingMode(TextureWarpMode mode) { m_warpMode = mode; }
-void Texture::setFilteringMode(TextureFilterMode mode) { m_filteringMode = mode; }
+Texture::~Texture() {
+	if (m_streamed) {
+		TextureStreaming::unregisterTexture(this);
+	}
+}
+
+void Texture::setWarpingMode(TextureWarpMode mode) { m_warpMode = mode; bindSampler(); }
+void Texture::setFilteringMode(TextureFilterMode mode) { m_filteringMode = mode; bindSampler(); }
 
 bool Texture::loadTextureFromFile(
 	const std::string &filepath,
 	TextureWarpMode warpMode,
 	TextureFilterMode filterMode) {
+	m_ready.store(false, std::memory_order_relaxed);
+	m_warpMode = warpMode;
+	m_filteringMode = filterMode;
+	bindSampler();
+	bool success = loadTexture(filepath, std::vector<unsigned char>());
+	//Publish the loaded levels to the sampling threads
+	m_ready.store(success, std::memory_order_release);
+	return success;
+}
+
+bool Texture::loadTextureFromMemory(
+	const std::string &filepath,
+	std::vector<unsigned char> source,
+	TextureWarpMode warpMode,
+	TextureFilterMode filterMode) {
+	m_ready.store(false, std::memory_order_relaxed);
 	m_warpMode = warpMode;
 	m_filteringMode = filterMode;
+	bindSampler();
+	bool success = loadTexture(filepath, std::move(source));
+	m_ready.store(success, std::memory_order_release);
+	return success;
+}
+
+bool Texture::loadTexture(const std::string &filepath, std::vector<unsigned char> source) {
+	if (m_streamed) {
+		TextureStreaming::unregisterTexture(this);
+		m_streamed = false;
+	}
+	m_residentLevel = 0;
 	std::vector<TextureHolder::ptr>().swap(m_texHolders);
+	std::vector<TextureView>().swap(m_views);
+	m_blockFormat = TextureLayout::LINEAR;
+
+	//Pre-encoded blocks
+	{
+		std::string ext = filepath.substr(filepath.find_last_of('.') + 1);
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		if (ext == "dds") {
+			return loadTextureFromDDS(filepath, std::move(source));
+		}
+	}
+
+	//Preprocessed cache keyed by the source bytes
+	std::string cachePath;
+	size_t cacheKey = 0;
+	if (!m_cacheDirectory.empty()) {
+		if (source.empty()) {
+			std::ifstream file(filepath, std::ios::in | std::ios::binary);
+			if (file.is_open()) {
+				source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			}
+		}
+		if (!source.empty()) {
+			cacheKey = hashSource(filepath, source);
+			std::stringstream ss;
+			ss << m_cacheDirectory << "/" << std::hex << cacheKey << ".srtex";
+			cachePath = ss.str();
+			if (loadCache(cachePath, cacheKey)) {
+				return true;
+			}
+		}
+	}
 
 	unsigned char *pixels = nullptr;
 	int width, height, channel;
 	{
 		//stbi_set_flip_vertically_on_load(true);
-		pixels = stbi_load(filepath.c_str(), &width, &height, &channel, 0);
+		pixels = source.empty() ? stbi_load(filepath.c_str(), &width, &height, &channel, 0) :
+			stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &channel, 0);
 		if (pixels == nullptr) {
 			std::cerr << "Failed to load image from " << filepath << std::endl;
-			exit(1);
+			return false;
 		}
 		if (width <= 0 || width >= 65536 || height <= 0 || height >= 65536) {
 			std::cerr << "Invalid size from image: " << filepath << std::endl;
-			exit(1);
+			stbi_image_free(pixels);
+			return false;
 		}
 	}
 
@@ -72,140 +158,440 @@ bool Texture::loadTextureFromFile(
 	stbi_image_free(pixels);
 	pixels = nullptr;
 
+	switch (m_compressionMode) {
+	case TextureCompressionMode::BC1:
+		m_blockFormat = TextureLayout::BC1;
+		break;
+	case TextureCompressionMode::BC3:
+		m_blockFormat = TextureLayout::BC3;
+		break;
+	case TextureCompressionMode::AUTO:
+	{
+		bool translucent = false;
+		for (int index = 0; index < width * height && !translucent; ++index) {
+			translucent = raw[index * 4 + 3] != 255;
+		}
+		m_blockFormat = translucent ? TextureLayout::BC3 : TextureLayout::BC1;
+		break;
+	}
+	default:
+		break;
+	}
+
 	//Generate resolution pyramid for mipmap
 	if (m_generateMipmap) {
 		generateMipmap(raw, width, height, channel);
 	}
 	else {
-		m_texHolders = { std::make_shared<ZCurveTilingTextureHolder>(raw, width, height, channel) };
+		m_texHolders = { createHolder(raw, width, height, channel, TextureLayout::ZCURVE_TILING) };
 	}
+	updateViews();
 
 	delete[] raw;
 
+	if (!cachePath.empty()) {
+		saveCache(cachePath, cacheKey);
+		//Served from the cache file from now on, so that the fine levels could be streamed
+		if (m_generateMipmap && TextureStreaming::isEnabled()) {
+			loadCache(cachePath, cacheKey);
+		}
+	}
+
 	return true;
 }
 
-void Texture::generateMipmap(unsigned char *pixels, int width, int height, int channel) {
-	unsigned char *rawData = pixels;
-	bool reAlloc = false;
-
-	//Find the first greater number which equals to 2^n
-	static auto firstGreaterPowOf2 = [](const int &num) -> int {
-		int base = num - 1;
-		base |= (base >> 1);
-		base |= (base >> 2);
-		base |= (base >> 4);
-		base |= (base >> 8);
-		base |= (base >> 16);
-		return base + 1;
+size_t Texture::hashSource(const std::string &filepath, const std::vector<unsigned char> &source) const {
+	//Note: bump the version once the preprocessing or the storage layouts change
+	const std::uint32_t version = 1;
+	size_t hash = FNV_OFFSET_BASIS;
+	fnv1aHash(hash, &version, sizeof(version));
+	fnv1aHash(hash, filepath.data(), filepath.size());
+	fnv1aHash(hash, source.data(), source.size());
+	fnv1aHash(hash, &m_generateMipmap, sizeof(m_generateMipmap));
+	fnv1aHash(hash, &m_compressionMode, sizeof(m_compressionMode));
+	return hash;
+}
+
+//Cache file layout: "SRT1", key, mipmap flag, block format, level number,
+//then width, height, layout, width in tiles, word number and data offset of each level,
+//then the texels of each level at the 64 bytes aligned offsets, so that they are used in place after mapping
+static constexpr size_t k_cacheHeaderSize = 4 + 8 + 4 * 3;
+static constexpr size_t k_cacheLevelSize = 4 * 5 + 8;
+static constexpr size_t k_cacheAlignment = 64;
+
+bool Texture::loadCache(const std::string &path, const size_t &key) {
+	MappedFile::ptr mapped = MappedFile::open(path);
+	if (mapped == nullptr || mapped->size() < k_cacheHeaderSize)
+		return false;
+
+	const unsigned char *bytes = mapped->data();
+	auto read = [&](const size_t &offset, void *value, const size_t &size) -> void {
+		std::memcpy(value, bytes + offset, size);
 	};
-	int nw = firstGreaterPowOf2(width);
-	int nh = firstGreaterPowOf2(height);
-
-	// need to make sure that width and height equal to 2^n
-	if (nw != width || nh != height || nw != nh) {
-		//Reallocation for padding to 2^n * 2^n
-		nw = glm::max(nw, nh);
-		nh = glm::max(nw, nh);
-		reAlloc = true;
-		rawData = new unsigned char[nw * nh * channel];
-
-		auto readPixels = [&](const int &x, const int &y, unsigned char &r, unsigned char &g, unsigned char &b, unsigned char &a) -> void
-		{
-			int tx = (x >= width) ? (width - 1) : x;
-			int ty = (y >= height) ? (height - 1) : y;
-			r = pixels[(ty*width + tx) * channel + 0];
-			g = pixels[(ty*width + tx) * channel + 1];
-			b = pixels[(ty*width + tx) * channel + 2];
-			a = pixels[(ty*width + tx) * channel + 3];
-		};
 
-		parallelFor((int)0, (int)(nw * nh), [&](const int &index) -> void
-		{
-			float x = (float)(index % nw)/(float)(nw - 1) * (width - 1);
-			float y = (float)(index / nw)/(float)(nh - 1) * (height - 1);
-			unsigned char r, g, b, a;
-			//Binlear interpolation for scaling
-			{
-				int ix = (int)x, iy = (int)y;
-				int fx = x - ix, fy = y - iy;
-
-				unsigned char p[4][4];
-				readPixels(ix, iy, p[0][0], p[0][1], p[0][2], p[0][3]);
-				readPixels(ix + 1, iy, p[1][0], p[1][1], p[1][2], p[1][3]);
-				readPixels(ix, iy + 1, p[2][0], p[2][1], p[2][2], p[2][3]);
-				readPixels(ix + 1, iy + 1, p[3][0], p[3][1], p[3][2], p[3][3]);
-
-				float w0 = (1.0f - fx) * (1.0f - fy), w1 = fx * (1.0f - fy);
-				float w2 = (1.0f - fx) * fy, w3 = fx * fy;
-				r = (unsigned char)(w0 * p[0][0] + w1 * p[1][0] + w2 * p[2][0] + w3 * p[3][0]);
-				g = (unsigned char)(w0 * p[0][1] + w1 * p[1][1] + w2 * p[2][1] + w3 * p[3][1]);
-				b = (unsigned char)(w0 * p[0][2] + w1 * p[1][2] + w2 * p[2][2] + w3 * p[3][2]);
-				a = (unsigned char)(w0 * p[0][3] + w1 * p[1][3] + w2 * p[2][3] + w3 * p[3][3]);
+	std::uint64_t fileKey = 0;
+	std::uint32_t generateMipmap = 0, blockFormat = 0, levelNum = 0;
+	read(4, &fileKey, 8);
+	read(12, &generateMipmap, 4);
+	read(16, &blockFormat, 4);
+	read(20, &levelNum, 4);
+	if (std::memcmp(bytes, "SRT1", 4) != 0 || fileKey != key || levelNum == 0 ||
+		mapped->size() < k_cacheHeaderSize + levelNum * k_cacheLevelSize)
+		return false;
+
+	std::vector<TextureView> views;
+	std::vector<std::uint64_t> offsets;
+	std::vector<size_t> wordNums;
+	for (std::uint32_t level = 0; level < levelNum; ++level) {
+		std::uint32_t width, height, layout, wordNum;
+		std::int32_t widthInTiles;
+		std::uint64_t offset;
+		size_t base = k_cacheHeaderSize + level * k_cacheLevelSize;
+		read(base + 0, &width, 4);
+		read(base + 4, &height, 4);
+		read(base + 8, &layout, 4);
+		read(base + 12, &widthInTiles, 4);
+		read(base + 16, &wordNum, 4);
+		read(base + 20, &offset, 8);
+		if (layout > (std::uint32_t)TextureLayout::BC3 || offset % k_cacheAlignment != 0 ||
+			offset + (std::uint64_t)wordNum * 4 > mapped->size())
+			return false;
+
+		TextureView view;
+		view.m_data = reinterpret_cast<const std::uint32_t*>(bytes + offset);
+		view.m_width = (std::uint16_t)width;
+		view.m_height = (std::uint16_t)height;
+		view.m_widthInTiles = widthInTiles;
+		view.m_layout = (TextureLayout)layout;
+		views.push_back(view);
+		offsets.push_back(offset);
+		wordNums.push_back(wordNum);
+	}
+
+	//The levels finer than the tail are streamed, the tail is copied out so that the mapping could be released
+	bool streamed = generateMipmap != 0 && levelNum > 1 && TextureStreaming::isEnabled();
+	int tailLevel = 0;
+	if (streamed) {
+		tailLevel = (int)levelNum - 1;
+		for (int level = 0; level < (int)levelNum; ++level) {
+			if (views[level].m_width <= TextureStreaming::k_tailSize && views[level].m_height <= TextureStreaming::k_tailSize) {
+				tailLevel = level;
+				break;
 			}
-			rawData[index * channel] = r;
-			rawData[index * channel + 1] = g; 
-			rawData[index * channel + 2] = b;
-			rawData[index * channel + 3] = a;
+		}
+		streamed = tailLevel > 0;
+	}
+
+	std::vector<TextureHolder::ptr> holders(levelNum);
+	for (int level = 0; level < (int)levelNum; ++level) {
+		if (!streamed) {
+			holders[level] = std::make_shared<ExternalTextureHolder>(views[level], wordNums[level], mapped);
+		}
+		else if (level >= tailLevel) {
+			auto words = std::make_shared<std::vector<std::uint32_t>>(views[level].m_data, views[level].m_data + wordNums[level]);
+			views[level].m_data = words->data();
+			holders[level] = std::make_shared<ExternalTextureHolder>(views[level], wordNums[level], words);
+		}
+		else {
+			views[level].m_data = nullptr;
+		}
+	}
+
+	m_generateMipmap = generateMipmap != 0;
+	m_blockFormat = (TextureLayout)blockFormat;
+	m_texHolders.swap(holders);
+	m_views.swap(views);
+
+	if (streamed) {
+		m_streamed = true;
+		m_tailLevel = tailLevel;
+		m_residentLevel = tailLevel;
+		m_requestedLevel.store(INT_MAX, std::memory_order_relaxed);
+		m_streamingPath = path;
+		m_levelOffsets.swap(offsets);
+		m_levelWordNums.swap(wordNums);
+		m_levelLastUse.assign(levelNum, 0);
+		TextureStreaming::registerTexture(this);
+	}
+	return true;
+}
+
+void Texture::saveCache(const std::string &path, const size_t &key) const {
+	//Written to a temporary file first, so that a partial file is never mapped
+	const std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cerr << "Failed to write the texture cache: " << path << std::endl;
+			return;
+		}
+
+		const std::uint64_t fileKey = key;
+		const std::uint32_t generateMipmap = m_generateMipmap ? 1 : 0, blockFormat = (std::uint32_t)m_blockFormat;
+		const std::uint32_t levelNum = (std::uint32_t)m_texHolders.size();
+		file.write("SRT1", 4);
+		file.write(reinterpret_cast<const char*>(&fileKey), 8);
+		file.write(reinterpret_cast<const char*>(&generateMipmap), 4);
+		file.write(reinterpret_cast<const char*>(&blockFormat), 4);
+		file.write(reinterpret_cast<const char*>(&levelNum), 4);
+
+		auto align = [](const std::uint64_t &offset) -> std::uint64_t {
+			return (offset + k_cacheAlignment - 1) / k_cacheAlignment * k_cacheAlignment;
+		};
+		std::uint64_t offset = align(k_cacheHeaderSize + levelNum * k_cacheLevelSize);
+		std::vector<std::uint64_t> offsets;
+		for (const auto &holder : m_texHolders) {
+			const auto &view = holder->getView();
+			const std::uint32_t width = view.m_width, height = view.m_height, layout = (std::uint32_t)view.m_layout;
+			const std::uint32_t wordNum = (std::uint32_t)holder->getWordNum();
+			const std::int32_t widthInTiles = view.m_widthInTiles;
+			file.write(reinterpret_cast<const char*>(&width), 4);
+			file.write(reinterpret_cast<const char*>(&height), 4);
+			file.write(reinterpret_cast<const char*>(&layout), 4);
+			file.write(reinterpret_cast<const char*>(&widthInTiles), 4);
+			file.write(reinterpret_cast<const char*>(&wordNum), 4);
+			file.write(reinterpret_cast<const char*>(&offset), 8);
+			offsets.push_back(offset);
+			offset = align(offset + (std::uint64_t)wordNum * 4);
+		}
+
+		static const char padding[k_cacheAlignment] = {};
+		for (size_t level = 0; level < m_texHolders.size(); ++level) {
+			const auto &holder = m_texHolders[level];
+			file.write(padding, (std::streamsize)(offsets[level] - (std::uint64_t)file.tellp()));
+			file.write(reinterpret_cast<const char*>(holder->getView().m_data), holder->getWordNum() * 4);
+		}
+
+		if (!file) {
+			std::cerr << "Failed to write the texture cache: " << path << std::endl;
+			return;
+		}
+	}
+
+	//Note: the rename fails if another loader wrote the same cache meanwhile, which is as good
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+	}
+}
+
+bool Texture::loadTextureFromDDS(const std::string &filepath, std::vector<unsigned char> bytes) {
+	//Refs: https://learn.microsoft.com/en-us/windows/win32/direct3ddds/dx-graphics-dds-pguide
+	if (bytes.empty()) {
+		std::ifstream in(filepath, std::ios::binary);
+		if (!in.is_open()) {
+			std::cerr << "Failed to load image from " << filepath << std::endl;
+			return false;
+		}
+		bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	auto readU32 = [&](const size_t &offset) -> std::uint32_t {
+		return bytes[offset] | (bytes[offset + 1] << 8) | (bytes[offset + 2] << 16) | ((std::uint32_t)bytes[offset + 3] << 24);
+	};
+
+	//Magic + DDS_HEADER
+	constexpr size_t headerSize = 128;
+	if (bytes.size() < headerSize || std::memcmp(bytes.data(), "DDS ", 4) != 0) {
+		std::cerr << "Invalid dds file: " << filepath << std::endl;
+		return false;
+	}
+	int height = (int)readU32(12), width = (int)readU32(16);
+	int levelNum = glm::max((int)readU32(28), 1);
+	if (std::memcmp(bytes.data() + 84, "DXT1", 4) == 0) {
+		m_blockFormat = TextureLayout::BC1;
+	}
+	else if (std::memcmp(bytes.data() + 84, "DXT5", 4) == 0) {
+		m_blockFormat = TextureLayout::BC3;
+	}
+	else {
+		std::cerr << "Unsupported dds format (DXT1 and DXT5 only): " << filepath << std::endl;
+		return false;
+	}
+	if (width <= 0 || width >= 65536 || height <= 0 || height >= 65536) {
+		std::cerr << "Invalid size from image: " << filepath << std::endl;
+		return false;
+	}
+
+	if (m_generateMipmap && levelNum == 1) {
+		std::cout << "Warning: no mipmaps in " << filepath << ", mipmapping disabled\n";
+		m_generateMipmap = false;
+	}
+	if (!m_generateMipmap) {
+		levelNum = 1;
+	}
+
+	size_t offset = headerSize;
+	for (int level = 0; level < levelNum; ++level) {
+		int w = glm::max(width >> level, 1), h = glm::max(height >> level, 1);
+		size_t size = CompressedTextureHolder::getBlockBytes(w, h, m_blockFormat);
+		if (offset + size > bytes.size()) {
+			break;
+		}
+		m_texHolders.push_back(std::make_shared<CompressedTextureHolder>(bytes.data() + offset, w, h, m_blockFormat));
+		offset += size;
+	}
+
+	if (m_texHolders.empty()) {
+		std::cerr << "Truncated dds file: " << filepath << std::endl;
+		return false;
+	}
+	updateViews();
+
+	return true;
+}
+
+TextureHolder::ptr Texture::createHolder(unsigned char *pixels, int width, int height, int channel,
+	TextureLayout layout) const {
+	if (m_blockFormat != TextureLayout::LINEAR) {
+		return std::make_shared<CompressedTextureHolder>(pixels, width, height, channel, m_blockFormat);
+	}
+	switch (layout) {
+	case TextureLayout::TILING:
+		return std::make_shared<TilingTextureHolder>(pixels, width, height, channel);
+	case TextureLayout::ZCURVE_TILING:
+		return std::make_shared<ZCurveTilingTextureHolder>(pixels, width, height, channel);
+	default:
+		return std::make_shared<LinearTextureHolder>(pixels, width, height, channel);
+	}
+}
+
+//Source texels covered by a destination texel along an axis, with the area weights
+struct DownsampleTaps {
+	int m_first = 0;
+	int m_num = 0;
+	float m_weights[3] = { 0.0f, 0.0f, 0.0f };
+};
+
+static std::vector<DownsampleTaps> computeDownsampleTaps(const int &srcSize, const int &dstSize) {
+	//Box filter over the source footprint [x*r, (x+1)*r), r is in [1,3] for floor-halving
+	std::vector<DownsampleTaps> taps(dstSize);
+	const float ratio = (float)srcSize / (float)dstSize;
+	for (int x = 0; x < dstSize; ++x) {
+		float begin = x * ratio, end = (x + 1) * ratio;
+		auto &tap = taps[x];
+		tap.m_first = (int)begin;
+		for (int s = tap.m_first; s < end && s < srcSize && tap.m_num < 3; ++s) {
+			float overlap = glm::min(end, (float)(s + 1)) - glm::max(begin, (float)s);
+			tap.m_weights[tap.m_num++] = overlap / ratio;
+		}
+	}
+	return taps;
+}
+
+//2x2 box filtering of a row of RGBA8 texels, dst[x] = avg(src0[2x], src0[2x+1], src1[2x], src1[2x+1])
+static void downsampleRowBox(const unsigned char *src0, const unsigned char *src1, unsigned char *dst, const int &dstWidth) {
+	int x = 0;
+#ifdef SR_TEXTURE_SSE2
+	//Two destination texels at a time
+	const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(2);
+	for (; x + 2 <= dstWidth; x += 2) {
+		__m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + x * 8));
+		__m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + x * 8));
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, zero), _mm_unpacklo_epi8(r1, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(r1, zero));
+		lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+		hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+		__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), round), 2);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 4), _mm_packus_epi16(sum, sum));
+	}
+#endif
+	for (; x < dstWidth; ++x) {
+		for (int c = 0; c < 4; ++c) {
+			dst[x * 4 + c] = (unsigned char)((src0[x * 8 + c] + src0[x * 8 + 4 + c] + src1[x * 8 + c] + src1[x * 8 + 4 + c] + 2) >> 2);
+		}
+	}
+}
+
+//Downsample a level to the next one of the floor-halving chain
+static void downsampleLevel(const unsigned char *src, const int &srcWidth, const int &srcHeight,
+	unsigned char *dst, const int &dstWidth, const int &dstHeight, const int &channel) {
+	//Even sizes: the exact 2x2 box filter
+	if (channel == 4 && srcWidth == dstWidth * 2 && srcHeight == dstHeight * 2) {
+		parallelFor((int)0, dstHeight, [&](const int &y) -> void {
+			downsampleRowBox(src + (2 * y) * srcWidth * 4, src + (2 * y + 1) * srcWidth * 4, dst + y * dstWidth * 4, dstWidth);
 		});
-		width = nw;
-		height = nh;
-		std::cout << "Warning: texture padding to 2^n * 2^n\n";
+		return;
 	}
-	
+
+	//Odd sizes or the 1-pixel wide/high levels: area weighted box filter over up to 3x3 texels
+	const auto tapsX = computeDownsampleTaps(srcWidth, dstWidth);
+	const auto tapsY = computeDownsampleTaps(srcHeight, dstHeight);
+	parallelFor((int)0, dstHeight, [&](const int &y) -> void {
+		const auto &ty = tapsY[y];
+		for (int x = 0; x < dstWidth; ++x) {
+			const auto &tx = tapsX[x];
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int j = 0; j < ty.m_num; ++j) {
+				for (int i = 0; i < tx.m_num; ++i) {
+					const float w = ty.m_weights[j] * tx.m_weights[i];
+					const unsigned char *texel = src + ((ty.m_first + j) * srcWidth + tx.m_first + i) * channel;
+					for (int c = 0; c < channel; ++c) {
+						sum[c] += w * texel[c];
+					}
+				}
+			}
+			for (int c = 0; c < channel; ++c) {
+				dst[(y * dstWidth + x) * channel + c] = (unsigned char)glm::min(sum[c] + 0.5f, 255.0f);
+			}
+		}
+	});
+}
+
+void Texture::generateMipmap(unsigned char *pixels, int width, int height, int channel) {
+	//Non-power-of-two chain: each level is floor(w/2) x floor(h/2) of the previous one down to 1x1,
+	//so that the textures keep their native sizes without padding or resampling.
+
 	//First level
 	int curW = width, curH = height;
-	m_texHolders.push_back(std::make_shared<ZCurveTilingTextureHolder>(rawData, curW, curH, channel));
+	m_texHolders.push_back(createHolder(pixels, curW, curH, channel, TextureLayout::ZCURVE_TILING));
 
 	//The rest of levels
-	unsigned char *previous = rawData;
-	unsigned char *tmpAlloc = new unsigned char[curW * curH * channel];
-	unsigned char *current = tmpAlloc;
-	while(curW >= 2)
+	const int maxLevelSize = glm::max(width / 2, 1) * glm::max(height / 2, 1) * channel;
+	std::vector<unsigned char> buffers[2] = { std::vector<unsigned char>(maxLevelSize), std::vector<unsigned char>(maxLevelSize) };
+	const unsigned char *previous = pixels;
+	int index = 0;
+	while (curW > 1 || curH > 1)
 	{
-		curW /= 2, curH /= 2;
-		parallelFor((int)0, (int)(curW * curH), [&](const int &index)
-		{
-			int x = index % curW;
-			int y = index / curW;
-			unsigned char r, g, b, a;
-			int destX = 2 * x, destY = 2 * y;
-			int target1 = (destY * curW * 2 + destX) * channel;
-			int target2 = (destY * curW * 2 + destX + 1) * channel;
-			int target3 = ((destY + 1) * curW * 2 + destX) * channel;
-			int target4 = ((destY + 1) * curW * 2 + destX + 1) * channel;
-			//Box filtering for down-sampling
-			r = (previous[target1 + 0] + previous[target2 + 0] + previous[target3 + 0] + previous[target4 + 0]) * 0.25;
-			g = (previous[target1 + 1] + previous[target2 + 1] + previous[target3 + 1] + previous[target4 + 1]) * 0.25;
-			b = (previous[target1 + 2] + previous[target2 + 2] + previous[target3 + 2] + previous[target4 + 2]) * 0.25;
-			a = (previous[target1 + 3] + previous[target2 + 3] + previous[target3 + 3] + previous[target4 + 3]) * 0.25;
-			current[index * channel + 0] = r;
-			current[index * channel + 1] = g;
-			current[index * channel + 2] = b;
-			current[index * channel + 3] = a;
-		});
+		int nextW = glm::max(curW / 2, 1), nextH = glm::max(curH / 2, 1);
+		unsigned char *current = buffers[index].data();
+		downsampleLevel(previous, curW, curH, current, nextW, nextH, channel);
 
 		//Note: Tiling and ZCuve mapping are also time-consuming
-		//if (curW >= 32)
-		//{
-		//	m_texHolders.push_back(std::make_shared<TRZCurveTilingTextureHolder>(current, curW, curH, channel));
-		//}
-		//else
-		//{
-		//	m_texHolders.push_back(std::make_shared<TRLinearTextureHolder>(current, curW, curH, channel));
-		//}
-		m_texHolders.push_back(std::make_shared<TilingTextureHolder>(current, curW, curH, channel));
-		//m_texHolders.push_back(std::make_shared<TRLinearTextureHolder>(current, curW, curH, channel));
-		std::swap(current, previous);
-	}
-
-	delete[] tmpAlloc;
-	if (reAlloc)
-	{
-		delete[] rawData;
+		m_texHolders.push_back(createHolder(current, nextW, nextH, channel, TextureLayout::TILING));
+
+		previous = current;
+		index = 1 - index;
+		curW = nextW, curH = nextH;
 	}
 }
 
+void Texture::updateViews() {
+	m_views.resize(m_texHolders.size());
+	for (size_t i = 0; i < m_texHolders.size(); ++i) {
+		m_views[i] = m_texHolders[i]->getView();
+	}
+}
+
+void Texture::requestLevel(const int &level) const {
+	//Note: mostly a plain read, since the same level is requested by most of the fragments
+	int requested = m_requestedLevel.load(std::memory_order_relaxed);
+	while (level < requested && !m_requestedLevel.compare_exchange_weak(requested, level, std::memory_order_relaxed)) {}
+}
+
+void Texture::installLevel(const int &level, const std::shared_ptr<std::vector<std::uint32_t>> &words) {
+	TextureView view = m_views[level];
+	view.m_data = words->data();
+	m_texHolders[level] = std::make_shared<ExternalTextureHolder>(view, words->size(), words);
+	m_views[level] = view;
+	m_residentLevel = level;
+}
+
+void Texture::evictLevel() {
+	m_texHolders[m_residentLevel] = nullptr;
+	m_views[m_residentLevel].m_data = nullptr;
+	++m_residentLevel;
+}
+
 void Texture::readPixel(const std::uint16_t &u, const std::uint16_t &v, unsigned char &r, 
 	unsigned char &g, unsigned char &b, unsigned char &a, const int level) const
 {
@@ -218,131 +604,257 @@ void Texture::readPixel(const std::uint16_t &u, const std::uint16_t &v, unsigned
 	a = (texel >>  0) & 0xFF;
 }
 
-glm::vec4 Texture::sample(const glm::vec2 &uv, const float &level) const
+//Warping of the uv coordinate into [0,1]
+//Note: wrapped in 40.24 fixed point, so that the repeating is a bit masking of the fraction regardless of the texture size
+//      and the negative coordinates are floored by the two's complement for free.
+static constexpr int k_warpFractionBits = 24;
+static constexpr std::int64_t k_warpOne = (std::int64_t)1 << k_warpFractionBits;
+static constexpr float k_warpScale = (float)k_warpOne;
+
+template<TextureWarpMode Warp>
+static inline float warpCoord(const float &u);
+
+template<>
+inline float warpCoord<TextureWarpMode::REPEAT>(const float &u) {
+	return (float)((std::int64_t)(u * k_warpScale) & (k_warpOne - 1)) * (1.0f / k_warpScale);
+}
+
+template<>
+inline float warpCoord<TextureWarpMode::MIRRORED_REPEAT>(const float &u) {
+	//The odd periods are reflected
+	const std::int64_t fixed = (std::int64_t)(u * k_warpScale);
+	const std::int64_t frac = fixed & (k_warpOne - 1);
+	return (float)((fixed & k_warpOne) ? (k_warpOne - frac) : frac) * (1.0f / k_warpScale);
+}
+
+template<>
+inline float warpCoord<TextureWarpMode::CLAMP_TO_EDGE>(const float &u) {
+	return glm::clamp(u, 0.0f, 1.0f);
+}
+
+//Packed texels of the level with the filtering mode
+template<TextureFilterMode Filter>
+static inline std::uint32_t fetchFiltered(const TextureView &view, const glm::vec2 &uv);
+
+template<>
+inline std::uint32_t fetchFiltered<TextureFilterMode::NEAREST>(const TextureView &view, const glm::vec2 &uv) {
+	return TextureSampler::fetchNearest(view, uv);
+}
+
+template<>
+inline std::uint32_t fetchFiltered<TextureFilterMode::LINEAR>(const TextureView &view, const glm::vec2 &uv) {
+	return TextureSampler::fetchBilinear(view, uv);
+}
+
+template<TextureFilterMode Filter>
+static inline void fetchFilteredQuad(const TextureView &view, const glm::vec2 uv[4], std::uint32_t texels[4]) {
+	for (int i = 0; i < 4; ++i)
+		texels[i] = fetchFiltered<Filter>(view, uv[i]);
+}
+
+template<>
+inline void fetchFilteredQuad<TextureFilterMode::LINEAR>(const TextureView &view, const glm::vec2 uv[4], std::uint32_t texels[4]) {
+	TextureSampler::fetchBilinearQuad(view, uv, texels);
+}
+
+void Texture::bindSampler()
+{
+	switch (m_warpMode)
+	{
+	case TextureWarpMode::REPEAT:
+		bindSampler<TextureWarpMode::REPEAT>();
+		break;
+	case TextureWarpMode::MIRRORED_REPEAT:
+		bindSampler<TextureWarpMode::MIRRORED_REPEAT>();
+		break;
+	default:
+		bindSampler<TextureWarpMode::CLAMP_TO_EDGE>();
+		break;
+	}
+}
+
+template<TextureWarpMode Warp>
+void Texture::bindSampler()
+{
+	if (m_filteringMode == TextureFilterMode::NEAREST)
+	{
+		m_sampleFunc = &sampleWith<Warp, TextureFilterMode::NEAREST>;
+		m_sampleQuadFunc = &sampleQuadWith<Warp, TextureFilterMode::NEAREST>;
+	}
+	else
+	{
+		m_sampleFunc = &sampleWith<Warp, TextureFilterMode::LINEAR>;
+		m_sampleQuadFunc = &sampleQuadWith<Warp, TextureFilterMode::LINEAR>;
+	}
+}
+
+template<TextureWarpMode Warp, TextureFilterMode Filter>
+glm::vec4 Texture::sampleWith(const Texture &tex, const glm::vec2 &uv, const float &level)
 {
 	//Perform sampling procedure
 	//Note: return texel that ranges from 0.0f to 1.0f instead of [0,255]
-	float u = uv.x, v = uv.y;
-	//Texture warpping mode
+	const glm::vec2 st(warpCoord<Warp>(uv.x), warpCoord<Warp>(uv.y));
+
+	//No mipmap: just sampling at the first level
+	if (!tex.m_generateMipmap)
 	{
-		if (u < 0 || u > 1.0f)
-		{
-			switch (m_warpMode)
-			{
-			case TextureWarpMode::REPEAT:
-				u = (u > 0) ? (u - (int)u) : (1.0f - ((int)u - u));
-				break;
-			case TextureWarpMode::MIRRORED_REPEAT:
-				u = (u > 0) ? (1.0f - (u - (int)u)) : ((int)u - u);
-				break;
-			case TextureWarpMode::CLAMP_TO_EDGE:
-				u = (u < 0) ? 0 : 1.0f;
-				break;
-			default:
-				u = (u < 0) ? 0 : 1.0f;
-				break;
-			}
-		}
+		return unpackTexel(fetchFiltered<Filter>(tex.m_views[0], st));
+	}
+
+	//Mipmap: linear interpolation between two levels, blended in packed form
+	//Note: the levels not resident yet are replaced by the finest resident one
+	if (tex.m_streamed)
+		tex.requestLevel((int)level);
+	const int maxLevel = (int)tex.m_views.size() - 1;
+	int level1 = glm::max(glm::min((int)level, maxLevel), tex.m_residentLevel);
+	int level2 = glm::max(glm::min((int)level + 1, maxLevel), tex.m_residentLevel);
+	std::uint32_t texel1 = fetchFiltered<Filter>(tex.m_views[level1], st);
+	std::uint32_t texel2 = (level1 != level2) ? fetchFiltered<Filter>(tex.m_views[level2], st) : texel1;
+	return unpackTexel(lerpTexels(texel1, texel2, toFilterWeight(level - (int)level)));
+}
+
+template<TextureWarpMode Warp, TextureFilterMode Filter>
+void Texture::sampleQuadWith(const Texture &tex, const glm::vec2 uv[4], const float &level, glm::vec4 texels[4])
+{
+	glm::vec2 st[4];
+	for (int i = 0; i < 4; ++i)
+		st[i] = glm::vec2(warpCoord<Warp>(uv[i].x), warpCoord<Warp>(uv[i].y));
 
-		if (v < 0 || v > 1.0f)
+	std::uint32_t packed[4];
+	if (!tex.m_generateMipmap)
+	{
+		fetchFilteredQuad<Filter>(tex.m_views[0], st, packed);
+	}
+	else
+	{
+		if (tex.m_streamed)
+			tex.requestLevel((int)level);
+		const int maxLevel = (int)tex.m_views.size() - 1;
+		int level1 = glm::max(glm::min((int)level, maxLevel), tex.m_residentLevel);
+		int level2 = glm::max(glm::min((int)level + 1, maxLevel), tex.m_residentLevel);
+		fetchFilteredQuad<Filter>(tex.m_views[level1], st, packed);
+		if (level1 != level2)
 		{
-			switch (m_warpMode)
-			{
-			case TextureWarpMode::REPEAT:
-				v = (v > 0) ? (v - (int)v) : (1.0f - ((int)v - v));
-				break;
-			case TextureWarpMode::MIRRORED_REPEAT:
-				v = (v > 0) ? (1.0f - (v - (int)v)) : ((int)v - v);
-				break;
-			case TextureWarpMode::CLAMP_TO_EDGE:
-				v = (v < 0) ? 0 : 1.0f;
-				break;
-			default:
-				v = (v < 0) ? 0 : 1.0f;
-				break;
-			}
+			std::uint32_t packed2[4];
+			fetchFilteredQuad<Filter>(tex.m_views[level2], st, packed2);
+			const std::uint16_t frac = toFilterWeight(level - (int)level);
+			for (int i = 0; i < 4; ++i)
+				packed[i] = lerpTexels(packed[i], packed2[i], frac);
 		}
 	}
 
-	glm::vec4 texel(1.0f);
-	//No mipmap: just sampling at the first level
-	if (!m_generateMipmap)
+	for (int i = 0; i < 4; ++i)
+		texels[i] = unpackTexel(packed[i]);
+}
+
+glm::vec4 Texture::sampleAnisotropic(const glm::vec2 &uv, const float &level, const glm::vec2 &step, const int &taps) const
+{
+	//Note: the taps are equally weighted, the offsets are symmetric about uv
+	glm::vec4 sum(0.0f);
+	glm::vec2 tapUV = uv - step * (0.5f * (taps - 1));
+	for (int i = 0; i < taps; ++i, tapUV += step)
 	{
-		switch (m_filteringMode)
-		{
-		case TextureFilterMode::NEAREST:
-			texel = TextureSampler::textureSamplingNearest(m_texHolders[0], glm::vec2(u, v));
-			break;
-		case TextureFilterMode::LINEAR:
-			texel = TextureSampler::textureSamplingBilinear(m_texHolders[0], glm::vec2(u, v));
-			break;
-		default:
-			break;
-		}
+		sum += m_sampleFunc(*this, tapUV, level);
 	}
-	//Mipmap: linear interpolation between two levels
-	else {
-		glm::vec4 texel1(1.0f), texel2(1.0f);
-		unsigned int level1 = glm::min((unsigned int)level, (unsigned int)m_texHolders.size() - 1);
-		unsigned int level2 = glm::min((unsigned int)(level + 1), (unsigned int)m_texHolders.size() - 1);
-		switch (m_filteringMode)
+	return sum * (1.0f / taps);
+}
+
+void Texture::sampleQuadAnisotropic(const glm::vec2 uv[4], const float &level, const glm::vec2 &step, const int &taps,
+	glm::vec4 texels[4]) const
+{
+	//The lanes share the footprint, so that each tap is a quad sampling
+	const glm::vec2 offset = step * (-0.5f * (taps - 1));
+	glm::vec2 tapUV[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		tapUV[i] = uv[i] + offset;
+		texels[i] = glm::vec4(0.0f);
+	}
+
+	glm::vec4 tapTexels[4];
+	for (int t = 0; t < taps; ++t)
+	{
+		m_sampleQuadFunc(*this, tapUV, level, tapTexels);
+		for (int i = 0; i < 4; ++i)
 		{
-		case TextureFilterMode::NEAREST:
-			if (level1 != level2)
-			{
-				texel1 = TextureSampler::textureSamplingNearest(m_texHolders[level1], glm::vec2(u, v));
-				texel2 = TextureSampler::textureSamplingNearest(m_texHolders[level2], glm::vec2(u, v));
-			}
-			else
-			{
-				texel1 = TextureSampler::textureSamplingNearest(m_texHolders[level1], glm::vec2(u, v));
-				texel2 = texel1;
-			}
-			break;
-		case TextureFilterMode::LINEAR:
-			//Trilinear interpolation
-			if (level1 != level2)
-			{
-				texel1 = TextureSampler::textureSamplingBilinear(m_texHolders[level1], glm::vec2(u, v));
-				texel2 = TextureSampler::textureSamplingBilinear(m_texHolders[level2], glm::vec2(u, v));
-			}
-			else
-			{
-				texel1 = TextureSampler::textureSamplingBilinear(m_texHolders[level1], glm::vec2(u, v));
-				texel2 = texel1;
-			}
-			break;
+			texels[i] += tapTexels[i];
+			tapUV[i] += step;
 		}
-		//Interpolation
-		float frac = level - (int)level;
-		texel = (1.0f - frac) * texel1 + frac * texel2;
 	}
 
-	return texel;
+	const float weight = 1.0f / taps;
+	for (int i = 0; i < 4; ++i)
+		texels[i] *= weight;
 }
 
+std::uint32_t TextureSampler::fetchNearest(const TextureView &texture, const glm::vec2 &uv) {
+	//Resolve the layout once per sample instead of per texel
+	switch (texture.m_layout) {
+	case TextureLayout::TILING:
+		return fetchNearest<TilingLayout>(texture, uv);
+	case TextureLayout::ZCURVE_TILING:
+		return fetchNearest<ZCurveTilingLayout>(texture, uv);
+	case TextureLayout::BC1:
+		return fetchNearest<BC1Layout>(texture, uv);
+	case TextureLayout::BC3:
+		return fetchNearest<BC3Layout>(texture, uv);
+	default:
+		return fetchNearest<LinearLayout>(texture, uv);
+	}
+}
 
-glm::vec4 TextureSampler::textureSamplingNearest(TextureHolder::ptr texture, glm::vec2 uv){
-	//Perform nearest sampling procedure
-	unsigned char r, g, b, a = 255;
-	texture->read(
-		(std::uint16_t)(uv.x * (texture->getWidth() - 1)  + 0.5f), //Rounding
-		(std::uint16_t)(uv.y * (texture->getHeight() - 1) + 0.5f), //Rounding
-		r, g, b, a);
+std::uint32_t TextureSampler::fetchBilinear(const TextureView &texture, const glm::vec2 &uv) {
+	switch (texture.m_layout) {
+	case TextureLayout::TILING:
+		return fetchBilinear<TilingLayout>(texture, uv);
+	case TextureLayout::ZCURVE_TILING:
+		return fetchBilinear<ZCurveTilingLayout>(texture, uv);
+	case TextureLayout::BC1:
+		return fetchBilinear<BC1Layout>(texture, uv);
+	case TextureLayout::BC3:
+		return fetchBilinear<BC3Layout>(texture, uv);
+	default:
+		return fetchBilinear<LinearLayout>(texture, uv);
+	}
+}
 
-	constexpr float denom = 1.0f / 255.0f;
-	return glm::vec4(r, g, b, a) * denom;
+void TextureSampler::fetchBilinearQuad(const TextureView &texture, const glm::vec2 uv[4], std::uint32_t texels[4]) {
+	switch (texture.m_layout) {
+	case TextureLayout::TILING:
+		fetchBilinearQuad<TilingLayout>(texture, uv, texels);
+		break;
+	case TextureLayout::ZCURVE_TILING:
+		fetchBilinearQuad<ZCurveTilingLayout>(texture, uv, texels);
+		break;
+	case TextureLayout::BC1:
+		fetchBilinearQuad<BC1Layout>(texture, uv, texels);
+		break;
+	case TextureLayout::BC3:
+		fetchBilinearQuad<BC3Layout>(texture, uv, texels);
+		break;
+	default:
+		fetchBilinearQuad<LinearLayout>(texture, uv, texels);
+		break;
+	}
 }
 
-glm::vec4 TextureSampler::textureSamplingBilinear(TextureHolder::ptr texture, glm::vec2 uv)
+template<typename Layout>
+std::uint32_t TextureSampler::fetchNearest(const TextureView &texture, const glm::vec2 &uv) {
+	//Perform nearest sampling procedure
+	return fetchTexel<Layout>(texture,
+		(std::uint16_t)(uv.x * (texture.m_width - 1)  + 0.5f), //Rounding
+		(std::uint16_t)(uv.y * (texture.m_height - 1) + 0.5f)); //Rounding
+}
+
+template<typename Layout>
+std::uint32_t TextureSampler::fetchBilinear(const TextureView &texture, const glm::vec2 &uv)
 {
 	//Perform bilinear sampling procedure
-	const auto &w = texture->getWidth();
-	const auto &h = texture->getHeight();
+	const auto &w = texture.m_width;
+	const auto &h = texture.m_height;
 
 	float fx = (uv.x * (w- 1)), fy = (uv.y * (h - 1));
 	std::uint16_t ix = (std::uint16_t)fx, iy = (std::uint16_t)fy;
-	float frac_x = fx - ix, frac_y = fy - iy;
 
 	/*********************
 	 *   p2--p3
@@ -350,23 +862,39 @@ glm::vec4 TextureSampler::textureSamplingBilinear(TextureHolder::ptr texture, gl
 	 *   p0--p1 
 	 * Note: p0 is (ix,iy)
 	 ********************/
-	static constexpr float denom = 1.0f / 255.0f;
-	unsigned char r, g, b, a = 255;
-	
-	//p0
-	texture->read(ix, iy, r, g, b, a);
-	glm::vec4 p0(r, g, b, a);
-	//p1
-	texture->read((ix + 1 >= w) ? ix : (ix + 1), iy, r, g, b, a);
-	glm::vec4 p1(r, g, b, a);
-	//p2
-	texture->read(ix, (iy + 1 >= h) ? iy : (iy + 1), r, g, b, a);
-	glm::vec4 p2(r, g, b, a);
-	//p3
-	texture->read((ix + 1 >= w) ? ix : (ix + 1), (iy + 1 >= h) ? iy : (iy + 1), r, g, b, a);
-	glm::vec4 p3(r, g, b, a);
-	return ((1.0f - frac_x) * (1.0f - frac_y) * p0 + frac_x * (1.0f - frac_y) * p1 +
-			(1.0f - frac_x) * frac_y * p2 + frac_x * frac_y * p3) * denom;
+	std::uint32_t texels[4];
+	gatherTexels<Layout>(texture, ix, iy, (ix + 1 >= w) ? ix : (ix + 1), (iy + 1 >= h) ? iy : (iy + 1), texels);
+
+	std::uint16_t weights[4];
+	bilinearFilterWeights(toFilterWeight(fx - ix), toFilterWeight(fy - iy), weights);
+	return blendTexels(texels, weights);
+}
+
+template<typename Layout>
+void TextureSampler::fetchBilinearQuad(const TextureView &texture, const glm::vec2 uv[4], std::uint32_t texels[4])
+{
+	const auto &w = texture.m_width;
+	const auto &h = texture.m_height;
+
+	//Texel coordinates and weights of the four lanes at once
+	QuadFloat fx = QuadFloat(uv[0].x, uv[1].x, uv[2].x, uv[3].x) * (float)(w - 1);
+	QuadFloat fy = QuadFloat(uv[0].y, uv[1].y, uv[2].y, uv[3].y) * (float)(h - 1);
+	glm::ivec4 ix = glm::ivec4(fx), iy = glm::ivec4(fy);
+	//Note: rounded as toFilterWeight
+	glm::ivec4 fracX = glm::ivec4((fx - QuadFloat(ix)) * (float)k_filterWeightOne + 0.5f);
+	glm::ivec4 fracY = glm::ivec4((fy - QuadFloat(iy)) * (float)k_filterWeightOne + 0.5f);
+	glm::ivec4 nx = glm::min(ix + 1, glm::ivec4(w - 1)), ny = glm::min(iy + 1, glm::ivec4(h - 1));
+
+	for (int i = 0; i < 4; ++i)
+	{
+		std::uint32_t footprint[4];
+		gatherTexels<Layout>(texture, (std::uint16_t)ix[i], (std::uint16_t)iy[i],
+			(std::uint16_t)nx[i], (std::uint16_t)ny[i], footprint);
+
+		std::uint16_t weights[4];
+		bilinearFilterWeights((std::uint16_t)fracX[i], (std::uint16_t)fracY[i], weights);
+		texels[i] = blendTexels(footprint, weights);
+	}
 }
 
 }
\ No newline at end of file
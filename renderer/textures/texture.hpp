@@ -3,6 +3,8 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <climits>
 
 #include "glm/glm.hpp"
 
@@ -16,48 +18,144 @@ public:
 	typedef std::shared_ptr<Texture> ptr;
 
 	Texture();
-	Texture(bool generatedMipmap);
-	~Texture() = default;
+	Texture(bool generatedMipmap, TextureCompressionMode compression = TextureCompressionMode::NONE);
+	~Texture();
 
 	bool isGeneratedMipmap() const { return m_generateMipmap; }
-	int getWidth() const { return m_texHolders[0]->getWidth(); }
-	int getHeight() const { return m_texHolders[0]->getHeight(); }
+	//Whether the texture could be sampled, i.e. loaded successfully (possibly by another thread)
+	bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+	int getWidth() const { return m_views[0].m_width; }
+	int getHeight() const { return m_views[0].m_height; }
 
 	//Sampling options setting
 	void setWarpingMode(TextureWarpMode mode);
 	void setFilteringMode(TextureFilterMode mode);
+	//Block compression of the texels, takes effect on the next loading
+	void setCompressionMode(TextureCompressionMode mode) { m_compressionMode = mode; }
+	bool isCompressed() const { return m_blockFormat != TextureLayout::LINEAR; }
 
+	//Note: the .dds files of BC1 (DXT1) or BC3 (DXT5) are loaded as they are, mipmaps included
+	//Return false if the file is missing or invalid, the texture is not ready then
 	bool loadTextureFromFile(
 		const std::string &filepath,
 		TextureWarpMode warpMode = TextureWarpMode::REPEAT,
 		TextureFilterMode filterMode = TextureFilterMode::LINEAR);
+	//Same as loadTextureFromFile with the bytes of the file already read, e.g. hashed by the caller
+	//Note: the path still selects the format and keys the cache
+	bool loadTextureFromMemory(
+		const std::string &filepath,
+		std::vector<unsigned char> source,
+		TextureWarpMode warpMode = TextureWarpMode::REPEAT,
+		TextureFilterMode filterMode = TextureFilterMode::LINEAR);
 
 	//Sampling according to the given uv coordinate
-	glm::vec4 sample(const glm::vec2 &uv, const float &level = 0.0f) const;
+	glm::vec4 sample(const glm::vec2 &uv, const float &level = 0.0f) const { return m_sampleFunc(*this, uv, level); }
+	//Sampling for the four lanes of a quad with the same level
+	void sampleQuad(const glm::vec2 uv[4], const float &level, glm::vec4 texels[4]) const {
+		m_sampleQuadFunc(*this, uv, level, texels);
+	}
+
+	//Anisotropic sampling: the average of the taps centered at uv and spaced by step, e.g. along the major axis of the footprint
+	glm::vec4 sampleAnisotropic(const glm::vec2 &uv, const float &level, const glm::vec2 &step, const int &taps) const;
+	void sampleQuadAnisotropic(const glm::vec2 uv[4], const float &level, const glm::vec2 &step, const int &taps,
+		glm::vec4 texels[4]) const;
+
+	//Directory of the preprocessed textures (decoded, mipmapped, tiled or compressed), mapped on the next loading
+	//Note: the cache is keyed by the path, the content and the settings of the source image. Empty disables it.
+	static void setCacheDirectory(const std::string &dir) { m_cacheDirectory = dir; }
+
+	int getLevelNum() const { return (int)m_views.size(); }
+	const TextureView &getView(const int &level) const { return m_views[level]; }
+	//Finest level that could be sampled now, the finer ones are streamed in once requested
+	int getResidentLevel() const { return m_residentLevel; }
 
 private:
 	//Auxiliary functions
 	void readPixel(const std::uint16_t &u, const std::uint16_t &v, unsigned char &r, 
 		unsigned char &g, unsigned char &b, unsigned char &a, const int level = 0) const;
 
+	//Note: source is the bytes of the file, empty -> read from the file
+	bool loadTexture(const std::string &filepath, std::vector<unsigned char> source);
+	bool loadTextureFromDDS(const std::string &filepath, std::vector<unsigned char> bytes);
+
+	//Preprocessed texture cache
+	size_t hashSource(const std::string &filepath, const std::vector<unsigned char> &source) const;
+	bool loadCache(const std::string &path, const size_t &key);
+	void saveCache(const std::string &path, const size_t &key) const;
+
 	void generateMipmap(unsigned char *pixels, int width, int height, int channel);
 
+	//Holder of the given layout, or of the block format if compressed
+	TextureHolder::ptr createHolder(unsigned char *pixels, int width, int height, int channel, TextureLayout layout) const;
+
+	void updateViews();
+
+	//Streaming of the levels finer than the tail, see TextureStreaming
+	void requestLevel(const int &level) const;
+	void installLevel(const int &level, const std::shared_ptr<std::vector<std::uint32_t>> &words);
+	void evictLevel();
+
+	//Resolve the sampling functions of the warping and filtering modes, so that they are not switched per sample
+	void bindSampler();
+	template<TextureWarpMode Warp>
+	void bindSampler();
+
+	template<TextureWarpMode Warp, TextureFilterMode Filter>
+	static glm::vec4 sampleWith(const Texture &tex, const glm::vec2 &uv, const float &level);
+	template<TextureWarpMode Warp, TextureFilterMode Filter>
+	static void sampleQuadWith(const Texture &tex, const glm::vec2 uv[4], const float &level, glm::vec4 texels[4]);
+
 private:
 	bool m_generateMipmap = false;
+	std::atomic<bool> m_ready { false };
 	std::vector<TextureHolder::ptr> m_texHolders;
+	std::vector<TextureView> m_views;		//Raw views of m_texHolders for sampling
+
+	TextureCompressionMode m_compressionMode = TextureCompressionMode::NONE;
+	TextureLayout m_blockFormat = TextureLayout::LINEAR;	//BC1 or BC3 if the loaded texture is compressed
+
+	static std::string m_cacheDirectory;
+
+	//Streaming states, guarded by TextureStreaming
+	bool m_streamed = false;
+	int m_tailLevel = 0;							//The levels from here on are always resident
+	int m_residentLevel = 0;
+	mutable std::atomic<int> m_requestedLevel { INT_MAX };	//Finest level sampled since last update
+	std::string m_streamingPath;					//Cache file of the streamed levels
+	std::vector<std::uint64_t> m_levelOffsets;
+	std::vector<size_t> m_levelWordNums;
+	std::vector<unsigned int> m_levelLastUse;		//Frame of the last sampling of each level
+	std::uint64_t m_streamingId = 0;
 
 	TextureWarpMode m_warpMode;
 	TextureFilterMode m_filteringMode;
 
+	typedef glm::vec4 (*SampleFunc)(const Texture &, const glm::vec2 &, const float &);
+	typedef void (*SampleQuadFunc)(const Texture &, const glm::vec2[4], const float &, glm::vec4[4]);
+	SampleFunc m_sampleFunc = nullptr;
+	SampleQuadFunc m_sampleQuadFunc = nullptr;
+
 	friend class TextureSampler;
+	friend class TextureStreaming;
 };
 
 class TextureSampler final
 {
 public:
-	//Sampling algorithm
-	static glm::vec4 textureSamplingNearest(TextureHolder::ptr texture, glm::vec2 uv);
-	static glm::vec4 textureSamplingBilinear(TextureHolder::ptr texture, glm::vec2 uv);
+	//Sampling algorithm, return the packed texel (r << 24 | g << 16 | b << 8 | a)
+	static std::uint32_t fetchNearest(const TextureView &texture, const glm::vec2 &uv);
+	static std::uint32_t fetchBilinear(const TextureView &texture, const glm::vec2 &uv);
+	//Bilinear sampling of the four lanes of a quad
+	static void fetchBilinearQuad(const TextureView &texture, const glm::vec2 uv[4], std::uint32_t texels[4]);
+
+private:
+	//Instances for each storage layout
+	template<typename Layout>
+	static std::uint32_t fetchNearest(const TextureView &texture, const glm::vec2 &uv);
+	template<typename Layout>
+	static std::uint32_t fetchBilinear(const TextureView &texture, const glm::vec2 &uv);
+	template<typename Layout>
+	static void fetchBilinearQuad(const TextureView &texture, const glm::vec2 uv[4], std::uint32_t texels[4]);
 };
 
 } // namespace sr
\ No newline at end of file
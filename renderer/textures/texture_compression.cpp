@@ -0,0 +1,151 @@
+#include "texture_compression.hpp"
+
+#include <cstdlib>
+#include <algorithm>
+
+namespace sr {
+
+static std::uint32_t toColor565(const int &r, const int &g, const int &b) {
+	return ((std::uint32_t)(r >> 3) << 11) | ((std::uint32_t)(g >> 2) << 5) | (std::uint32_t)(b >> 3);
+}
+
+//Texels with alpha below it are encoded as transparent black by the BC1 3-color mode
+static constexpr int k_bc1AlphaThreshold = 128;
+
+//Encode the color part, punchThrough -> the transparent texels use the BC1 3-color mode
+static void encodeColorBlock(const std::uint32_t texels[16], bool punchThrough, std::uint32_t block[2]) {
+	//Bounding box of the colors, the transparent texels are left out
+	int minC[3] = { 255, 255, 255 }, maxC[3] = { 0, 0, 0 };
+	int colors[16][3];
+	bool transparent[16];
+	int opaqueNum = 0;
+	for (int i = 0; i < 16; ++i) {
+		colors[i][0] = (texels[i] >> 24) & 0xFF;
+		colors[i][1] = (texels[i] >> 16) & 0xFF;
+		colors[i][2] = (texels[i] >>  8) & 0xFF;
+		transparent[i] = punchThrough && (int)(texels[i] & 0xFF) < k_bc1AlphaThreshold;
+		if (transparent[i])
+			continue;
+		++opaqueNum;
+		for (int c = 0; c < 3; ++c) {
+			minC[c] = std::min(minC[c], colors[i][c]);
+			maxC[c] = std::max(maxC[c], colors[i][c]);
+		}
+	}
+	const bool threeColor = opaqueNum < 16;
+	if (opaqueNum == 0) {
+		block[0] = 0;
+		block[1] = 0xFFFFFFFF;
+		return;
+	}
+
+	//Choose the diagonal of the box along which the colors spread, by the covariance signs against red
+	//Refs: J.M.P. van Waveren, Real-Time DXT Compression
+	{
+		int center[3] = { (minC[0] + maxC[0]) / 2, (minC[1] + maxC[1]) / 2, (minC[2] + maxC[2]) / 2 };
+		int covRG = 0, covRB = 0;
+		for (int i = 0; i < 16; ++i) {
+			if (transparent[i])
+				continue;
+			int dr = colors[i][0] - center[0];
+			covRG += dr * (colors[i][1] - center[1]);
+			covRB += dr * (colors[i][2] - center[2]);
+		}
+		if (covRG < 0) std::swap(minC[1], maxC[1]);
+		if (covRB < 0) std::swap(minC[2], maxC[2]);
+	}
+
+	//Inset the endpoints by 1/16 of the extent to reduce the error of the interpolated colors
+	for (int c = 0; c < 3; ++c) {
+		int inset = (maxC[c] - minC[c]) / 16;
+		maxC[c] -= inset;
+		minC[c] += inset;
+	}
+
+	std::uint32_t c0 = toColor565(maxC[0], maxC[1], maxC[2]);
+	std::uint32_t c1 = toColor565(minC[0], minC[1], minC[2]);
+	if (c0 == c1 && !threeColor) {
+		block[0] = c0 | (c1 << 16);
+		block[1] = 0;
+		return;
+	}
+	//The 4-color mode requires c0 > c1, the 3-color mode c0 <= c1
+	if ((c0 < c1) != threeColor) {
+		std::swap(c0, c1);
+	}
+	block[0] = c0 | (c1 << 16);
+
+	//Nearest palette entry for each texel, index 3 is transparent black in the 3-color mode
+	//Note: decoded with the indices of texel k -> entry k to get the palette
+	std::uint32_t palette[16];
+	block[1] = 0xE4;
+	decodeColorBlock(block, threeColor, palette);
+	const int entryNum = threeColor ? 3 : 4;
+	int entries[4][3];
+	for (int k = 0; k < 4; ++k) {
+		entries[k][0] = (palette[k] >> 24) & 0xFF;
+		entries[k][1] = (palette[k] >> 16) & 0xFF;
+		entries[k][2] = (palette[k] >>  8) & 0xFF;
+	}
+
+	std::uint32_t indices = 0;
+	for (int i = 0; i < 16; ++i) {
+		int best = 3, bestDist = 0x7FFFFFFF;
+		for (int k = 0; !transparent[i] && k < entryNum; ++k) {
+			int dr = colors[i][0] - entries[k][0], dg = colors[i][1] - entries[k][1], db = colors[i][2] - entries[k][2];
+			int dist = dr * dr + dg * dg + db * db;
+			if (dist < bestDist) {
+				bestDist = dist;
+				best = k;
+			}
+		}
+		indices |= (std::uint32_t)best << (2 * i);
+	}
+	block[1] = indices;
+}
+
+static void encodeAlphaBlock(const std::uint32_t texels[16], std::uint32_t block[2]) {
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; ++i) {
+		int a = texels[i] & 0xFF;
+		a0 = std::max(a0, a);
+		a1 = std::min(a1, a);
+	}
+
+	std::uint64_t bits = (std::uint64_t)a0 | ((std::uint64_t)a1 << 8);
+	//The 8-alpha mode requires a0 > a1, all indices are 0 if they are equal
+	if (a0 > a1) {
+		int palette[8];
+		palette[0] = a0;
+		palette[1] = a1;
+		for (int k = 2; k < 8; ++k)
+			palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+
+		for (int i = 0; i < 16; ++i) {
+			int a = texels[i] & 0xFF;
+			int best = 0, bestDist = 256;
+			for (int k = 0; k < 8; ++k) {
+				int dist = std::abs(a - palette[k]);
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = k;
+				}
+			}
+			bits |= (std::uint64_t)best << (16 + 3 * i);
+		}
+	}
+
+	block[0] = (std::uint32_t)(bits & 0xFFFFFFFF);
+	block[1] = (std::uint32_t)(bits >> 32);
+}
+
+void encodeBC1Block(const std::uint32_t texels[16], std::uint32_t block[2]) {
+	encodeColorBlock(texels, true, block);
+}
+
+void encodeBC3Block(const std::uint32_t texels[16], std::uint32_t block[4]) {
+	encodeAlphaBlock(texels, block);
+	encodeColorBlock(texels, false, block + 2);
+}
+
+} // namespace sr
\ No newline at end of file
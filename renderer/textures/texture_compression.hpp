@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace sr {
+
+//Block compression of the RGBA8 texels, each block covers 4x4 texels
+//Refs: https://learn.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression
+//Note: the blocks are stored as little-endian 32-bit words as in the dds files,
+//      BC1 (8 bytes, RGB, 1-bit alpha) and BC3 (16 bytes, BC1 color + interpolated alpha) are supported.
+//      BC1 encodes the texels with alpha below 128 as transparent black, the others as opaque.
+static constexpr int k_bc1BlockWords = 2;
+static constexpr int k_bc3BlockWords = 4;
+
+inline std::uint32_t packTexel(const std::uint32_t &r, const std::uint32_t &g, const std::uint32_t &b, const std::uint32_t &a) {
+	return (r << 24) | (g << 16) | (b << 8) | (a << 0);
+}
+
+//RGB565 -> RGB888, the high bits are replicated into the low bits
+inline void expandColor565(const std::uint32_t &c, std::uint32_t &r, std::uint32_t &g, std::uint32_t &b) {
+	r = (c >> 11) & 0x1F, g = (c >> 5) & 0x3F, b = c & 0x1F;
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+}
+
+//Decode the color part, the 3-color mode with transparent black is only allowed in BC1
+inline void decodeColorBlock(const std::uint32_t block[2], bool allowTransparent, std::uint32_t texels[16]) {
+	const std::uint32_t c0 = block[0] & 0xFFFF, c1 = block[0] >> 16;
+	std::uint32_t r0, g0, b0, r1, g1, b1;
+	expandColor565(c0, r0, g0, b0);
+	expandColor565(c1, r1, g1, b1);
+
+	std::uint32_t palette[4];
+	palette[0] = packTexel(r0, g0, b0, 255);
+	palette[1] = packTexel(r1, g1, b1, 255);
+	if (c0 > c1 || !allowTransparent) {
+		palette[2] = packTexel((2 * r0 + r1) / 3, (2 * g0 + g1) / 3, (2 * b0 + b1) / 3, 255);
+		palette[3] = packTexel((r0 + 2 * r1) / 3, (g0 + 2 * g1) / 3, (b0 + 2 * b1) / 3, 255);
+	}
+	else {
+		palette[2] = packTexel((r0 + r1) / 2, (g0 + g1) / 2, (b0 + b1) / 2, 255);
+		palette[3] = 0;
+	}
+
+	const std::uint32_t indices = block[1];
+	for (int i = 0; i < 16; ++i) {
+		texels[i] = palette[(indices >> (2 * i)) & 3];
+	}
+}
+
+//Decode the alpha part of BC3 and merge it into the texels
+inline void decodeAlphaBlock(const std::uint32_t block[2], std::uint32_t texels[16]) {
+	const std::uint64_t bits = block[0] | ((std::uint64_t)block[1] << 32);
+	const std::uint32_t a0 = bits & 0xFF, a1 = (bits >> 8) & 0xFF;
+
+	std::uint32_t palette[8];
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1) {
+		for (int k = 2; k < 8; ++k)
+			palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+	}
+	else {
+		for (int k = 2; k < 6; ++k)
+			palette[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	for (int i = 0; i < 16; ++i) {
+		texels[i] = (texels[i] & 0xFFFFFF00) | palette[(bits >> (16 + 3 * i)) & 7];
+	}
+}
+
+template<int BlockWords>
+inline void decodeBlock(const std::uint32_t *block, std::uint32_t texels[16]) {
+	if (BlockWords == k_bc1BlockWords) {
+		decodeColorBlock(block, true, texels);
+	}
+	else {
+		decodeColorBlock(block + 2, false, texels);
+		decodeAlphaBlock(block, texels);
+	}
+}
+
+//Decode the block through a small per-thread cache, since the neighboring fetches mostly hit the same block
+//Note: the cache is direct mapped by the block address but validated by the block bits,
+//      so that it never goes stale even if the texture memory is reused.
+template<int BlockWords>
+inline const std::uint32_t *decodeBlockCached(const std::uint32_t *block) {
+	static constexpr int k_entryNum = 64;
+	struct Entry {
+		std::uint32_t m_bits[BlockWords];
+		std::uint32_t m_texels[16];
+		bool m_valid;
+	};
+	static thread_local Entry entries[k_entryNum];
+
+	Entry &entry = entries[(reinterpret_cast<std::uintptr_t>(block) / (BlockWords * 4)) & (k_entryNum - 1)];
+	if (!entry.m_valid || std::memcmp(entry.m_bits, block, BlockWords * 4) != 0) {
+		decodeBlock<BlockWords>(block, entry.m_texels);
+		std::memcpy(entry.m_bits, block, BlockWords * 4);
+		entry.m_valid = true;
+	}
+	return entry.m_texels;
+}
+
+//Encoding of the 4x4 packed texels (row major)
+void encodeBC1Block(const std::uint32_t texels[16], std::uint32_t block[2]);
+void encodeBC3Block(const std::uint32_t texels[16], std::uint32_t block[4]);
+
+} // namespace sr
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SR_TEXTURE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace sr {
+
+//Filtering kernels on the packed RGBA8 texels
+//Note: the texels are blended with 16-bit fixed-point weights of 8 fractional bits (the weights sum to 256),
+//      so all four channels are processed at once without unpacking to float.
+static constexpr int k_filterWeightBits = 8;
+static constexpr int k_filterWeightOne = 1 << k_filterWeightBits;
+
+//Fraction in [0,1] -> fixed-point weight in [0,256]
+inline std::uint16_t toFilterWeight(const float &frac) {
+	return (std::uint16_t)(frac * k_filterWeightOne + 0.5f);
+}
+
+//Bilinear weights of p0 (x0,y0), p1 (x1,y0), p2 (x0,y1), p3 (x1,y1)
+inline void bilinearFilterWeights(const std::uint16_t &fx, const std::uint16_t &fy, std::uint16_t weights[4]) {
+	//Note: derived from w3 so that the weights are non-negative and sum to 256 exactly
+	const int w3 = (fx * fy + k_filterWeightOne / 2) >> k_filterWeightBits;
+	weights[0] = (std::uint16_t)(k_filterWeightOne - fx - fy + w3);
+	weights[1] = (std::uint16_t)(fx - w3);
+	weights[2] = (std::uint16_t)(fy - w3);
+	weights[3] = (std::uint16_t)w3;
+}
+
+//Weighted sum of four texels, the weights should sum to 256
+inline std::uint32_t blendTexels(const std::uint32_t texels[4], const std::uint16_t weights[4]) {
+#ifdef SR_TEXTURE_SSE2
+	//Note: 255 * 256 + 128 still fits into the unsigned 16-bit lanes
+	const __m128i zero = _mm_setzero_si128();
+	__m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels));
+	__m128i p01 = _mm_unpacklo_epi8(packed, zero);
+	__m128i p23 = _mm_unpackhi_epi8(packed, zero);
+	__m128i w01 = _mm_set_epi16(weights[1], weights[1], weights[1], weights[1],
+		weights[0], weights[0], weights[0], weights[0]);
+	__m128i w23 = _mm_set_epi16(weights[3], weights[3], weights[3], weights[3],
+		weights[2], weights[2], weights[2], weights[2]);
+	__m128i sum = _mm_add_epi16(_mm_mullo_epi16(p01, w01), _mm_mullo_epi16(p23, w23));
+	sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+	sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(k_filterWeightOne / 2)), k_filterWeightBits);
+	return (std::uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#else
+	std::uint32_t ret = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		std::uint32_t sum = k_filterWeightOne / 2;
+		for (int i = 0; i < 4; ++i) {
+			sum += ((texels[i] >> shift) & 0xFF) * weights[i];
+		}
+		ret |= (sum >> k_filterWeightBits) << shift;
+	}
+	return ret;
+#endif
+}
+
+//Linear interpolation between two texels, e.g. two mipmap levels
+inline std::uint32_t lerpTexels(const std::uint32_t &t0, const std::uint32_t &t1, const std::uint16_t &frac) {
+#ifdef SR_TEXTURE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	__m128i packed = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)t0), _mm_cvtsi32_si128((int)t1));
+	__m128i p01 = _mm_unpacklo_epi8(packed, zero);
+	__m128i w01 = _mm_set_epi16(frac, frac, frac, frac, k_filterWeightOne - frac, k_filterWeightOne - frac,
+		k_filterWeightOne - frac, k_filterWeightOne - frac);
+	__m128i sum = _mm_mullo_epi16(p01, w01);
+	sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+	sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(k_filterWeightOne / 2)), k_filterWeightBits);
+	return (std::uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#else
+	std::uint32_t ret = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		std::uint32_t sum = k_filterWeightOne / 2 + ((t0 >> shift) & 0xFF) * (k_filterWeightOne - frac)
+			+ ((t1 >> shift) & 0xFF) * frac;
+		ret |= (sum >> k_filterWeightBits) << shift;
+	}
+	return ret;
+#endif
+}
+
+//Packed texel (r << 24 | g << 16 | b << 8 | a) -> color in [0,1]
+inline glm::vec4 unpackTexel(const std::uint32_t &texel) {
+	constexpr float denom = 1.0f / 255.0f;
+	return glm::vec4((texel >> 24) & 0xFF, (texel >> 16) & 0xFF, (texel >> 8) & 0xFF, texel & 0xFF) * denom;
+}
+
+} // namespace sr
\ No newline at end of file
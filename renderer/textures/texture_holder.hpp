@@ -5,27 +5,166 @@
 #include <glm/glm.hpp>
 
 #include "parallel_wrapper.hpp"
+#include "texture_compression.hpp"
 
 namespace sr {
 
+//Storage layout of the texels
+enum class TextureLayout {
+	LINEAR,
+	TILING,
+	ZCURVE_TILING,
+	BC1,			//Block compressed, see texture_compression.hpp
+	BC3,
+};
+
+//Non-owning view of a texture level, all the texel fetches go through it without any virtual call
+//Note: valid as long as the holder is alive
+struct TextureView {
+	const std::uint32_t *m_data = nullptr;
+	std::uint16_t m_width = 0, m_height = 0;
+	int m_widthInTiles = 0;			//Width in tiles or in blocks for the compressed layouts
+	TextureLayout m_layout = TextureLayout::LINEAR;
+};
+
+//Address mapping of the layouts
+//Note: the address of (x,y) is separable as row(y) + col(x) for all of them,
+//      so that a 2x2 footprint only needs two row and two column offsets.
+struct LinearLayout {
+	static unsigned int row(const TextureView &view, const std::uint16_t &y) { return y * view.m_width; }
+	static unsigned int col(const TextureView &, const std::uint16_t &x) { return x; }
+};
+
+//4x4 blocks
+struct TilingLayout {
+	static constexpr int k_blockSize = 4;
+	static constexpr int k_blockSize2 = 16;
+
+	//Note: this is naive version
+	// return ((int)(y / k_blockSize) * m_widthInTiles + (int)(x / k_blockSize)) * k_blockSize2 + (y % k_blockSize) * k_blockSize + x % k_blockSize;
+	static unsigned int row(const TextureView &view, const std::uint16_t &y) {
+		return (((y >> 2) * view.m_widthInTiles) << 4) + ((y & 3) << 2);
+	}
+	static unsigned int col(const TextureView &, const std::uint16_t &x) { return ((x >> 2) << 4) + (x & 3); }
+};
+
+//Tiling and morton order layout
+//Refs: https://fgiesen.wordpress.com/2011/01/17/texture-tiling-and-swizzling/
+struct ZCurveTilingLayout {
+	//Block size for tiling
+	static constexpr int k_blockSize = 32; //Note: block size should not exceed 256
+	static constexpr int k_blockSize2 = 1024;
+	static constexpr int bits = 5;
+
+	//The bits of x and y are interleaved, i.e. morton(x,y) = spread(x) | (spread(y) << 1)
+	static unsigned int row(const TextureView &view, const std::uint16_t &y) {
+		return (y >> bits) * view.m_widthInTiles * k_blockSize2 + (spreadBits(y & (k_blockSize - 1)) << 1);
+	}
+	static unsigned int col(const TextureView &, const std::uint16_t &x) {
+		return (x >> bits) * k_blockSize2 + spreadBits(x & (k_blockSize - 1));
+	}
+
+	//Morton curve encoding
+	//Refs: https://en.wikipedia.org/wiki/Z-order_curve
+	static unsigned int spreadBits(unsigned int v) {
+		v = (v | (v << 4)) & 0x0F0F;
+		v = (v | (v << 2)) & 0x3333;
+		v = (v | (v << 1)) & 0x5555;
+		return v;
+	}
+};
+
+template<typename Layout>
+inline std::uint32_t fetchTexel(const TextureView &view, const std::uint16_t &x, const std::uint16_t &y) {
+	return view.m_data[Layout::row(view, y) + Layout::col(view, x)];
+}
+
+//Fetch the 2x2 footprint of bilinear filtering
+//Note: texels are p0 (x0,y0), p1 (x1,y0), p2 (x0,y1), p3 (x1,y1)
+template<typename Layout>
+inline void gatherTexels(const TextureView &view, const std::uint16_t &x0, const std::uint16_t &y0,
+	const std::uint16_t &x1, const std::uint16_t &y1, std::uint32_t texels[4]) {
+	const unsigned int r0 = Layout::row(view, y0), r1 = Layout::row(view, y1);
+	const unsigned int c0 = Layout::col(view, x0), c1 = Layout::col(view, x1);
+	texels[0] = view.m_data[r0 + c0];
+	texels[1] = view.m_data[r0 + c1];
+	texels[2] = view.m_data[r1 + c0];
+	texels[3] = view.m_data[r1 + c1];
+}
+
+//4x4 compressed blocks, decoded on fetch
+template<int BlockWords>
+struct BlockCompressedLayout {
+	static const std::uint32_t *block(const TextureView &view, const std::uint16_t &x, const std::uint16_t &y) {
+		return view.m_data + ((y >> 2) * view.m_widthInTiles + (x >> 2)) * BlockWords;
+	}
+	static std::uint32_t fetch(const TextureView &view, const std::uint16_t &x, const std::uint16_t &y) {
+		return decodeBlockCached<BlockWords>(block(view, x, y))[((y & 3) << 2) + (x & 3)];
+	}
+};
+typedef BlockCompressedLayout<k_bc1BlockWords> BC1Layout;
+typedef BlockCompressedLayout<k_bc3BlockWords> BC3Layout;
+
+template<>
+inline std::uint32_t fetchTexel<BC1Layout>(const TextureView &view, const std::uint16_t &x, const std::uint16_t &y) {
+	return BC1Layout::fetch(view, x, y);
+}
+
+template<>
+inline std::uint32_t fetchTexel<BC3Layout>(const TextureView &view, const std::uint16_t &x, const std::uint16_t &y) {
+	return BC3Layout::fetch(view, x, y);
+}
+
+template<>
+inline void gatherTexels<BC1Layout>(const TextureView &view, const std::uint16_t &x0, const std::uint16_t &y0,
+	const std::uint16_t &x1, const std::uint16_t &y1, std::uint32_t texels[4]) {
+	texels[0] = BC1Layout::fetch(view, x0, y0);
+	texels[1] = BC1Layout::fetch(view, x1, y0);
+	texels[2] = BC1Layout::fetch(view, x0, y1);
+	texels[3] = BC1Layout::fetch(view, x1, y1);
+}
+
+template<>
+inline void gatherTexels<BC3Layout>(const TextureView &view, const std::uint16_t &x0, const std::uint16_t &y0,
+	const std::uint16_t &x1, const std::uint16_t &y1, std::uint32_t texels[4]) {
+	texels[0] = BC3Layout::fetch(view, x0, y0);
+	texels[1] = BC3Layout::fetch(view, x1, y0);
+	texels[2] = BC3Layout::fetch(view, x0, y1);
+	texels[3] = BC3Layout::fetch(view, x1, y1);
+}
+
 class TextureHolder {
 public:
 	typedef std::shared_ptr<TextureHolder> ptr;
 
-	TextureHolder(std::uint16_t width, std::uint16_t height) : m_width { width}, m_height { height }, 
-		m_data { nullptr } {}
+	TextureHolder(std::uint16_t width, std::uint16_t height, TextureLayout layout) : m_data { nullptr } {
+		m_view.m_width = width;
+		m_view.m_height = height;
+		m_view.m_layout = layout;
+	}
 	virtual ~TextureHolder() {
 		freeTextureHolder();
 	}
 
-	std::uint16_t getWidth() const { return m_width; }
-	std::uint16_t getHeight() const { return m_height; }
-
-	virtual std::uint32_t read(const std::uint16_t& x, const std::uint16_t& y) const {
-		return m_data[to_index(x, y)];
+	std::uint16_t getWidth() const { return m_view.m_width; }
+	std::uint16_t getHeight() const { return m_view.m_height; }
+	TextureLayout getLayout() const { return m_view.m_layout; }
+	const TextureView &getView() const { return m_view; }
+	//Number of the 32-bit words of the texels or blocks
+	size_t getWordNum() const { return m_wordNum; }
+
+	std::uint32_t read(const std::uint16_t& x, const std::uint16_t& y) const {
+		switch (m_view.m_layout) {
+			case TextureLayout::BC1:
+				return fetchTexel<BC1Layout>(m_view, x, y);
+			case TextureLayout::BC3:
+				return fetchTexel<BC3Layout>(m_view, x, y);
+			default:
+				return m_view.m_data[to_index(x, y)];
+		}
 	}
 
-	virtual void read(const std::uint16_t& x, const std::uint16_t& y, unsigned char& r, unsigned char& g,
+	void read(const std::uint16_t& x, const std::uint16_t& y, unsigned char& r, unsigned char& g,
 		unsigned char& b, unsigned char& a) const {
 		std::uint32_t texel = read(x, y);
 		r = (texel >> 24) & 0xFF;
@@ -35,42 +174,59 @@ public:
 	}
 	
 protected:
-	std::uint16_t m_width, m_height;
 	std::uint32_t *m_data; 
+	TextureView m_view;
+	size_t m_wordNum = 0;
 
 	void loadTextureHolder(const unsigned int& nElements, unsigned char* data, const std::uint16_t& width, 
 		const std::uint16_t& height, const int& channel) {
 		m_data = new std::uint32_t[nElements];
+		m_view.m_data = m_data;
+		m_wordNum = nElements;
 		parallelFor((int)0, (int)(height * width), [&](const int &index) -> void {
 			int y = index / width, x = index % width;
-			unsigned char r, g, b, a;
-			int addres = index * channel;
-			switch (channel) {
-				case 1:
-					r = g = b = data[addres], a = 255;
-					break;
-				case 3:
-					r = data[addres + 0], g = data[addres + 1], b = data[addres + 2], a = 255;
-					break;
-				case 4:
-					r = data[addres + 0], g = data[addres + 1], b = data[addres + 2], a = data[addres + 3];
-					break;
-				default:
-					r = g = b = data[addres], a = 255;
-					break;
-			}
-			m_data[to_index(x, y)] = (r << 24) | (g << 16) | (b << 8) | (a << 0);
+			m_data[to_index(x, y)] = packPixel(data, index, channel);
 		});
 	}
 
+	static std::uint32_t packPixel(const unsigned char *data, const int &index, const int &channel) {
+		unsigned char r, g, b, a;
+		int addres = index * channel;
+		switch (channel) {
+			case 1:
+				r = g = b = data[addres], a = 255;
+				break;
+			case 3:
+				r = data[addres + 0], g = data[addres + 1], b = data[addres + 2], a = 255;
+				break;
+			case 4:
+				r = data[addres + 0], g = data[addres + 1], b = data[addres + 2], a = data[addres + 3];
+				break;
+			default:
+				r = g = b = data[addres], a = 255;
+				break;
+		}
+		return (r << 24) | (g << 16) | (b << 8) | (a << 0);
+	}
+
 	void freeTextureHolder() {
 		if (m_data != nullptr) {
 			delete[] m_data;
 			m_data = nullptr;
+			m_view.m_data = nullptr;
 		}
 	}
 
-	virtual unsigned int to_index(const std::uint16_t& x, const std::uint16_t& y) const = 0;
+	unsigned int to_index(const std::uint16_t& x, const std::uint16_t& y) const {
+		switch (m_view.m_layout) {
+			case TextureLayout::TILING:
+				return TilingLayout::row(m_view, y) + TilingLayout::col(m_view, x);
+			case TextureLayout::ZCURVE_TILING:
+				return ZCurveTilingLayout::row(m_view, y) + ZCurveTilingLayout::col(m_view, x);
+			default:
+				return LinearLayout::row(m_view, y) + LinearLayout::col(m_view, x);
+		}
+	}
 };
 
 
@@ -79,16 +235,10 @@ public:
 	typedef std::shared_ptr<LinearTextureHolder> ptr;
 
 	LinearTextureHolder(unsigned char *data, std::uint16_t width, std::uint16_t height, int channel) 
-	: TextureHolder(width, height) {
+	: TextureHolder(width, height, TextureLayout::LINEAR) {
 		TextureHolder::loadTextureHolder(width * height, data, width, height, channel);
 	}
 	virtual ~LinearTextureHolder() = default;
-
-private:
-	virtual unsigned int to_index(const std::uint16_t &x, const std::uint16_t &y) const override {
-		return y * m_width + x;
-	}
-
 };
 
 
@@ -97,88 +247,101 @@ public:
 	typedef std::shared_ptr<TilingTextureHolder> ptr;
 
 	TilingTextureHolder(unsigned char* data, std::uint16_t width, std::uint16_t height, int channel) 
-	: TextureHolder(width, height) {
-		m_widthInTiles = (width + k_blockSize - 1) / k_blockSize;
-		m_heightInTiles = (height + k_blockSize - 1) / k_blockSize;
-		unsigned int nElements = m_widthInTiles * m_heightInTiles * k_blockSize2;
+	: TextureHolder(width, height, TextureLayout::TILING) {
+		constexpr int k_blockSize = TilingLayout::k_blockSize;
+		m_view.m_widthInTiles = (width + k_blockSize - 1) / k_blockSize;
+		int heightInTiles = (height + k_blockSize - 1) / k_blockSize;
+		unsigned int nElements = m_view.m_widthInTiles * heightInTiles * TilingLayout::k_blockSize2;
 		TextureHolder::loadTextureHolder(nElements, data, width, height, channel);
 	}
 	virtual ~TilingTextureHolder() = default;
-
-private:
-	static constexpr int k_blockSize = 4;
-	static constexpr int k_blockSize2 = 16;
-
-	int m_widthInTiles = 0;
-	int m_heightInTiles = 0;
-
-	virtual unsigned int to_index(const std::uint16_t& x, const std::uint16_t& y) const override {
-		// Tiling address mapping
-		// Note: this is naive version
-		// return ((int)(y / k_blockSize) * m_widthInTiles + (int)(x / k_blockSize)) * k_blockSize2 + (y % k_blockSize) * k_blockSize + x % k_blockSize;
-		// Note: this is optimized version
-		return (((int)(y >> 2) * m_widthInTiles + (int)(x >> 2)) << 4) + ((y & 3) << 2) + (x & 3);
-	}
-
 };
 
 
-//Tiling and morton order layout
-//Refs: https://fgiesen.wordpress.com/2011/01/17/TextureHolder-tiling-and-swizzling/
 class ZCurveTilingTextureHolder : public TextureHolder {
 public:
 	typedef std::shared_ptr<ZCurveTilingTextureHolder> ptr;
 
 	ZCurveTilingTextureHolder(unsigned char* data, std::uint16_t width, std::uint16_t height, int channel) 
-	: TextureHolder(width, height) {
-		m_widthInTiles = (width + k_blockSize - 1) / k_blockSize;
-		m_heightInTiles = (height + k_blockSize - 1) / k_blockSize;
-		unsigned int nElements = m_widthInTiles * m_heightInTiles * k_blockSize2;
+	: TextureHolder(width, height, TextureLayout::ZCURVE_TILING) {
+		constexpr int k_blockSize = ZCurveTilingLayout::k_blockSize;
+		m_view.m_widthInTiles = (width + k_blockSize - 1) / k_blockSize;
+		int heightInTiles = (height + k_blockSize - 1) / k_blockSize;
+		unsigned int nElements = m_view.m_widthInTiles * heightInTiles * ZCurveTilingLayout::k_blockSize2;
 		TextureHolder::loadTextureHolder(nElements, data, width, height, channel);
 	}
 	virtual ~ZCurveTilingTextureHolder() = default;
+};
 
-private:
-	//Block size for tiling
-	static constexpr int k_blockSize = 32; //Note: block size should not exceed 256
-	static constexpr int k_blockSize2 = 1024;
-	static constexpr int bits = 5;
 
-	int m_widthInTiles = 0;
-	int m_heightInTiles = 0;
+//Block compressed storage, encoded from the pixels or loaded from the pre-encoded blocks
+class CompressedTextureHolder : public TextureHolder {
+public:
+	typedef std::shared_ptr<CompressedTextureHolder> ptr;
+
+	//format: TextureLayout::BC1 or TextureLayout::BC3
+	CompressedTextureHolder(unsigned char* data, std::uint16_t width, std::uint16_t height, int channel,
+		TextureLayout format) : TextureHolder(width, height, format) {
+		allocateBlocks();
+		const int blockWords = getBlockWords();
+		const int widthInBlocks = m_view.m_widthInTiles;
+		const int heightInBlocks = (height + 3) / 4;
+		parallelFor((int)0, (int)(widthInBlocks * heightInBlocks), [&](const int &index) -> void {
+			int bx = index % widthInBlocks, by = index / widthInBlocks;
+			//The partial blocks on the borders replicate the edge pixels
+			std::uint32_t texels[16];
+			for (int i = 0; i < 16; ++i) {
+				int x = glm::min(bx * 4 + (i & 3), width - 1);
+				int y = glm::min(by * 4 + (i >> 2), height - 1);
+				texels[i] = packPixel(data, y * width + x, channel);
+			}
+			if (blockWords == k_bc1BlockWords)
+				encodeBC1Block(texels, m_data + index * blockWords);
+			else
+				encodeBC3Block(texels, m_data + index * blockWords);
+		});
+	}
 
-	virtual unsigned int to_index(const std::uint16_t &x, const std::uint16_t & y) const override {
-		std::uint8_t rx = x & (k_blockSize - 1), ry = y & (k_blockSize - 1);
-		std::uint16_t ri = 0;
-		ZCurveTilingTextureHolder::encodeMortonCurve(rx, ry, ri);
-		return ((y >> bits) * m_widthInTiles + (x  >> bits)) * k_blockSize2 + ri;
+	//blocks: the encoded blocks in row major order, e.g. a level of the dds files
+	CompressedTextureHolder(const unsigned char *blocks, std::uint16_t width, std::uint16_t height,
+		TextureLayout format) : TextureHolder(width, height, format) {
+		allocateBlocks();
+		std::memcpy(m_data, blocks, getBlockBytes(width, height, format));
 	}
+	virtual ~CompressedTextureHolder() = default;
 
-	static void decodeMortonCurve(const std::uint16_t &index, std::uint8_t &x, std::uint8_t &y) {
-		//Morton curve decoding
-		//Refs: https://en.wikipedia.org/wiki/Z-order_curve
-		x = 0, y = 0;
-		for (int i = 0; i < bits; ++i) {
-			x |= (index & (1 << (2 * i))) >> i;
-			y |= (index & (1 << (2 * i + 1))) >> (i + 1);
-		}
+	int getBlockWords() const { return (m_view.m_layout == TextureLayout::BC1) ? k_bc1BlockWords : k_bc3BlockWords; }
+
+	static size_t getBlockBytes(const int &width, const int &height, const TextureLayout &format) {
+		size_t blockNum = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+		return blockNum * ((format == TextureLayout::BC1) ? k_bc1BlockWords : k_bc3BlockWords) * 4;
 	}
 
-	inline static void encodeMortonCurve(const std::uint8_t &x, const std::uint8_t &y, std::uint16_t &index) {
-		//Morton curve encoding
-		//Refs: https://en.wikipedia.org/wiki/Z-order_curve
-		index = 0;
-		index |= ((x & (1 << 0)) << (0)) | ((y & (1 << 0)) << (1));
-		index |= ((x & (1 << 1)) << (1)) | ((y & (1 << 1)) << (2));
-		index |= ((x & (1 << 2)) << (2)) | ((y & (1 << 2)) << (3));
-		index |= ((x & (1 << 3)) << (3)) | ((y & (1 << 3)) << (4));
-		index |= ((x & (1 << 4)) << (4)) | ((y & (1 << 4)) << (5));
-		index |= ((x & (1 << 5)) << (5)) | ((y & (1 << 5)) << (6));
-		index |= ((x & (1 << 6)) << (6)) | ((y & (1 << 6)) << (7));
-		index |= ((x & (1 << 7)) << (7)) | ((y & (1 << 7)) << (8));
-		index |= ((x & (1 << 8)) << (8)) | ((y & (1 << 8)) << (9));
-		index |= ((x & (1 << 9)) << (9)) | ((y & (1 << 9)) << (10));
+private:
+	void allocateBlocks() {
+		m_view.m_widthInTiles = (m_view.m_width + 3) / 4;
+		m_wordNum = getBlockBytes(m_view.m_width, m_view.m_height, m_view.m_layout) / 4;
+		m_data = new std::uint32_t[m_wordNum];
+		m_view.m_data = m_data;
 	}
 };
 
+
+//Texels of any layout residing in the memory owned by others, e.g. a mapped cache file
+class ExternalTextureHolder : public TextureHolder {
+public:
+	typedef std::shared_ptr<ExternalTextureHolder> ptr;
+
+	//owner: kept alive as long as the holder for the memory of view.m_data
+	ExternalTextureHolder(const TextureView &view, const size_t &wordNum, std::shared_ptr<const void> owner)
+	: TextureHolder(view.m_width, view.m_height, view.m_layout), m_owner(owner) {
+		m_view = view;
+		m_wordNum = wordNum;
+	}
+	virtual ~ExternalTextureHolder() = default;
+
+private:
+	std::shared_ptr<const void> m_owner;
+};
+
 } // namespace sr
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "texture_streaming.hpp"
+
+#include <mutex>
+#include <limits>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <tbb/task_group.h>
+
+#include "texture.hpp"
+
+namespace sr {
+
+//Levels [m_firstLevel, m_firstLevel + m_words.size()) of a texture read from its cache file
+struct FinishedStreamingLoad {
+	std::uint64_t m_textureId = 0;
+	int m_firstLevel = 0;
+	std::vector<std::shared_ptr<std::vector<std::uint32_t>>> m_words;	//Empty if the reading failed
+};
+
+struct TextureStreamingState {
+	std::mutex m_mutex;
+	size_t m_budget = 0;
+	size_t m_residentBytes = 0;
+	unsigned int m_frame = 0;
+	unsigned int m_generation = 0;
+	std::uint64_t m_nextId = 0;
+	std::unordered_map<std::uint64_t, Texture*> m_textures;	//Registered textures by their streaming ids
+	std::unordered_set<std::uint64_t> m_loading;				//Textures with a load in flight
+	std::vector<FinishedStreamingLoad> m_finished;
+};
+
+//Note: never destroyed, so that exiting with the pending loads is fine
+static TextureStreamingState &streamingState()
+{
+	static TextureStreamingState *state = new TextureStreamingState();
+	return *state;
+}
+
+static tbb::task_group &streamingLoadGroup()
+{
+	static tbb::task_group *group = new tbb::task_group();
+	return *group;
+}
+
+void TextureStreaming::setBudget(const size_t &bytes)
+{
+	auto &state = streamingState();
+	std::lock_guard<std::mutex> lock(state.m_mutex);
+	state.m_budget = bytes;
+}
+
+bool TextureStreaming::isEnabled()
+{
+	auto &state = streamingState();
+	std::lock_guard<std::mutex> lock(state.m_mutex);
+	return state.m_budget > 0;
+}
+
+unsigned int TextureStreaming::getGeneration()
+{
+	auto &state = streamingState();
+	std::lock_guard<std::mutex> lock(state.m_mutex);
+	return state.m_generation;
+}
+
+size_t TextureStreaming::getResidentBytes()
+{
+	auto &state = streamingState();
+	std::lock_guard<std::mutex> lock(state.m_mutex);
+	return state.m_residentBytes;
+}
+
+void TextureStreaming::registerTexture(Texture *texture)
+{
+	auto &state = streamingState();
+	std::lock_guard<std::mutex> lock(state.m_mutex);
+	texture->m_streamingId = ++state.m_nextId;
+	state.m_textures[texture->m_streamingId] = texture;
+}
+
+void TextureStreaming::unregisterTexture(Texture *texture)
+{
+	auto &state = streamingState();
+	std::lock_guard<std::mutex> lock(state.m_mutex);
+	state.m_textures.erase(texture->m_streamingId);
+	for (int level = texture->m_residentLevel; level < texture->m_tailLevel; ++level)
+	{
+		state.m_residentBytes -= texture->m_levelWordNums[level] * 4;
+	}
+	//Note: the load in flight, if any, is dropped once finished since the id is not registered anymore
+}
+
+bool TextureStreaming::update()
+{
+	auto &state = streamingState();
+	std::lock_guard<std::mutex> lock(state.m_mutex);
+	++state.m_frame;
+	bool changed = false;
+
+	//Install the finished loads from the coarsest level, so that the resident levels stay contiguous
+	for (auto &load : state.m_finished)
+	{
+		state.m_loading.erase(load.m_textureId);
+		auto iter = state.m_textures.find(load.m_textureId);
+		if (iter == state.m_textures.end())
+			continue;
+
+		Texture *texture = iter->second;
+		for (int i = (int)load.m_words.size() - 1; i >= 0; --i)
+		{
+			const int level = load.m_firstLevel + i;
+			if (level != texture->m_residentLevel - 1)
+				break;
+			state.m_residentBytes += load.m_words[i]->size() * 4;
+			texture->installLevel(level, load.m_words[i]);
+			changed = true;
+		}
+	}
+	state.m_finished.clear();
+
+	//Mark the sampled levels and read the missing ones
+	for (auto &entry : state.m_textures)
+	{
+		Texture *texture = entry.second;
+		int requested = texture->m_requestedLevel.exchange(std::numeric_limits<int>::max(), std::memory_order_relaxed);
+		if (requested >= texture->m_tailLevel)
+			continue;
+
+		requested = glm::max(requested, 0);
+		for (int level = requested; level < texture->m_tailLevel; ++level)
+		{
+			texture->m_levelLastUse[level] = state.m_frame;
+		}
+
+		if (requested >= texture->m_residentLevel || state.m_loading.count(entry.first) != 0)
+			continue;
+
+		//Levels [requested, resident) are read at once
+		const std::uint64_t id = entry.first;
+		const int firstLevel = requested, lastLevel = texture->m_residentLevel;
+		const std::string path = texture->m_streamingPath;
+		const std::vector<std::uint64_t> offsets(texture->m_levelOffsets.begin() + firstLevel, texture->m_levelOffsets.begin() + lastLevel);
+		const std::vector<size_t> wordNums(texture->m_levelWordNums.begin() + firstLevel, texture->m_levelWordNums.begin() + lastLevel);
+		state.m_loading.insert(id);
+		streamingLoadGroup().run([id, firstLevel, path, offsets, wordNums]()
+		{
+			FinishedStreamingLoad load;
+			load.m_textureId = id;
+			load.m_firstLevel = firstLevel;
+			std::ifstream file(path, std::ios::in | std::ios::binary);
+			for (size_t i = 0; file.is_open() && i < offsets.size(); ++i)
+			{
+				auto words = std::make_shared<std::vector<std::uint32_t>>(wordNums[i]);
+				file.seekg((std::streamoff)offsets[i]);
+				file.read(reinterpret_cast<char*>(words->data()), (std::streamsize)(wordNums[i] * 4));
+				if (!file)
+					break;
+				load.m_words.push_back(words);
+			}
+			//Partially read levels are useless for the contiguity
+			if (load.m_words.size() != offsets.size())
+				load.m_words.clear();
+
+			auto &state = streamingState();
+			std::lock_guard<std::mutex> lock(state.m_mutex);
+			state.m_finished.push_back(load);
+		});
+	}
+
+	//Evict the least recently sampled levels, the finest first for each texture
+	//Note: the levels sampled in last frame are kept even if the budget is exceeded
+	while (state.m_residentBytes > state.m_budget)
+	{
+		Texture *victim = nullptr;
+		unsigned int oldest = state.m_frame;
+		for (auto &entry : state.m_textures)
+		{
+			Texture *texture = entry.second;
+			if (texture->m_residentLevel < texture->m_tailLevel && texture->m_levelLastUse[texture->m_residentLevel] < oldest)
+			{
+				oldest = texture->m_levelLastUse[texture->m_residentLevel];
+				victim = texture;
+			}
+		}
+		if (victim == nullptr)
+			break;
+
+		state.m_residentBytes -= victim->m_levelWordNums[victim->m_residentLevel] * 4;
+		victim->evictLevel();
+		changed = true;
+	}
+
+	if (changed)
+		++state.m_generation;
+	return changed;
+}
+
+} // namespace sr
\ No newline at end of file
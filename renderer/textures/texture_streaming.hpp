@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+
+namespace sr {
+
+class Texture;
+
+//Streaming of the fine mipmap levels of the textures under a memory budget
+//The coarse levels (the mip tail) are always resident, the finer ones are read from the texture cache file
+//once they are sampled and evicted in least recently used order when the budget is exceeded.
+//Note: only the mipmapped textures loaded with the cache directory set are streamed,
+//      the others are fully resident and not counted in the budget.
+class TextureStreaming final {
+public:
+	//Levels no larger than this in both dimensions belong to the tail
+	static constexpr int k_tailSize = 128;
+
+	//Bytes of the resident streamed levels, 0 disables the streaming (default)
+	//Note: takes effect on the textures loaded afterwards
+	static void setBudget(const size_t &bytes);
+	static bool isEnabled();
+	static size_t getResidentBytes();
+
+	//Install the finished loads, evict the levels over budget and issue the loads of the levels sampled since last call
+	//Return true if the resident levels of any texture changed
+	//Note: the evicted levels are freed at once, so the application must call it between the frames of all the
+	//      renderers, i.e. when no texture is being sampled. The renderers never call it.
+	static bool update();
+	//Incremented by each update changing the resident levels, e.g. to invalidate the shading reused from last frame
+	static unsigned int getGeneration();
+
+private:
+	friend class Texture;
+	static void registerTexture(Texture *texture);
+	static void unregisterTexture(Texture *texture);
+};
+
+} // namespace sr
\ No newline at end of file
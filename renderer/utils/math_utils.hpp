@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+
 #include <glm/glm.hpp>
 
 namespace sr {
@@ -64,4 +67,28 @@ static glm::mat4 calcViewPortMatrix(int width, int height) {
     return vpMat;
 }
 
+//FNV-1a hashing of the bytes, accumulated into hash
+//Note: hash should be initialized with FNV_OFFSET_BASIS
+static constexpr size_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static void fnv1aHash(size_t &hash, const void *data, const size_t &size) {
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+//Approximate log2(x) for x > 0 from the exponent bits and a quadratic fit of the mantissa
+//Note: the absolute error is below 0.005, which is fine for the mipmap level selection
+static inline float fastLog2(const float &x) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    const float exponent = (float)((int)(bits >> 23) - 128);
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float mantissa;
+    std::memcpy(&mantissa, &bits, sizeof(mantissa));
+    return exponent + (-0.34484843f * mantissa + 2.02466578f) * mantissa - 0.67487759f;
+}
+
 } // namespace sr
\ No newline at end of file
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SR_QUAD_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace sr {
+
+//Quad-wide SIMD types for shading the 2x2 fragments at once
+//Each lane corresponds to a fragment of the quad (lane i -> QuadFragments::m_fragments[i])
+//Note: glm::vec4 is utilized as the 4-lane register, operations on it are lane-wise.
+//      The plain arithmetic is vectorized by the compiler, the transcendental functions
+//      (evaluated per component by glm) are written with SSE2 below.
+
+using QuadFloat = glm::vec4;
+using QuadMask = glm::bvec4;
+
+//3D vectors of four lanes in SoA layout
+struct QuadVec3 {
+	QuadFloat x, y, z;
+
+	QuadVec3() = default;
+	QuadVec3(const QuadFloat &vx, const QuadFloat &vy, const QuadFloat &vz) : x(vx), y(vy), z(vz) {}
+	//Broadcast to all the lanes
+	explicit QuadVec3(const glm::vec3 &v) : x(v.x), y(v.y), z(v.z) {}
+
+	glm::vec3 lane(const int &i) const { return glm::vec3(x[i], y[i], z[i]); }
+	void setLane(const int &i, const glm::vec3 &v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+
+	QuadVec3 &operator+=(const QuadVec3 &rhs) { x += rhs.x; y += rhs.y; z += rhs.z; return *this; }
+};
+
+inline QuadVec3 operator+(const QuadVec3 &a, const QuadVec3 &b) { return QuadVec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline QuadVec3 operator-(const QuadVec3 &a, const QuadVec3 &b) { return QuadVec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline QuadVec3 operator*(const QuadVec3 &a, const QuadVec3 &b) { return QuadVec3(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline QuadVec3 operator*(const QuadVec3 &a, const QuadFloat &s) { return QuadVec3(a.x * s, a.y * s, a.z * s); }
+inline QuadVec3 operator*(const QuadVec3 &a, const glm::vec3 &v) { return QuadVec3(a.x * v.x, a.y * v.y, a.z * v.z); }
+inline QuadVec3 operator-(const QuadVec3 &a) { return QuadVec3(-a.x, -a.y, -a.z); }
+
+inline QuadFloat quadDot(const QuadVec3 &a, const QuadVec3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+#ifdef SR_QUAD_SSE2
+inline __m128 quadLoad(const QuadFloat &v) { return _mm_loadu_ps(&v[0]); }
+inline QuadFloat quadStore(const __m128 &v) { QuadFloat ret; _mm_storeu_ps(&ret[0], v); return ret; }
+
+//2^x, the relative error is below 2e-7
+inline __m128 quadExp2(__m128 x)
+{
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.0f)), _mm_set1_ps(126.0f));
+	//Split into the integer part (floored) and the fraction in [0,1)
+	__m128i ipart = _mm_cvttps_epi32(x);
+	__m128 fpart = _mm_sub_ps(x, _mm_cvtepi32_ps(ipart));
+	__m128 negative = _mm_cmplt_ps(fpart, _mm_setzero_ps());
+	ipart = _mm_add_epi32(ipart, _mm_castps_si128(negative));
+	fpart = _mm_add_ps(fpart, _mm_and_ps(negative, _mm_set1_ps(1.0f)));
+
+	//Minimax polynomial of 2^f on [0,1)
+	__m128 poly = _mm_set1_ps(1.8775767e-3f);
+	poly = _mm_add_ps(_mm_mul_ps(poly, fpart), _mm_set1_ps(8.9893397e-3f));
+	poly = _mm_add_ps(_mm_mul_ps(poly, fpart), _mm_set1_ps(5.5826318e-2f));
+	poly = _mm_add_ps(_mm_mul_ps(poly, fpart), _mm_set1_ps(2.4015361e-1f));
+	poly = _mm_add_ps(_mm_mul_ps(poly, fpart), _mm_set1_ps(6.9315308e-1f));
+	poly = _mm_add_ps(_mm_mul_ps(poly, fpart), _mm_set1_ps(9.9999994e-1f));
+
+	//Scale by 2^i through the exponent bits
+	__m128i scale = _mm_slli_epi32(_mm_add_epi32(ipart, _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(poly, _mm_castsi128_ps(scale));
+}
+
+//log2(x) for x > 0, the absolute error is below 1e-5
+inline __m128 quadLog2(const __m128 &x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	__m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128 mantissa = _mm_or_ps(_mm_castsi128_ps(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF))), _mm_set1_ps(1.0f));
+
+	//log2(m) = 2 / ln2 * atanh((m - 1) / (m + 1)) for the mantissa m in [1,2)
+	__m128 t = _mm_div_ps(_mm_sub_ps(mantissa, _mm_set1_ps(1.0f)), _mm_add_ps(mantissa, _mm_set1_ps(1.0f)));
+	__m128 t2 = _mm_mul_ps(t, t);
+	__m128 poly = _mm_set1_ps(0.32059940f);
+	poly = _mm_add_ps(_mm_mul_ps(poly, t2), _mm_set1_ps(0.41219858f));
+	poly = _mm_add_ps(_mm_mul_ps(poly, t2), _mm_set1_ps(0.57707801f));
+	poly = _mm_add_ps(_mm_mul_ps(poly, t2), _mm_set1_ps(0.96179669f));
+	poly = _mm_add_ps(_mm_mul_ps(poly, t2), _mm_set1_ps(2.88539008f));
+	return _mm_add_ps(exponent, _mm_mul_ps(poly, t));
+}
+#endif
+
+inline QuadFloat quadInverseSqrt(const QuadFloat &v)
+{
+#ifdef SR_QUAD_SSE2
+	//Estimation refined by a Newton-Raphson step, about 22 bits of precision
+	__m128 x = quadLoad(v);
+	__m128 y = _mm_rsqrt_ps(x);
+	__m128 yyx = _mm_mul_ps(_mm_mul_ps(y, y), x);
+	return quadStore(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), yyx)));
+#else
+	return glm::inversesqrt(v);
+#endif
+}
+
+inline QuadFloat quadExp(const QuadFloat &v)
+{
+#ifdef SR_QUAD_SSE2
+	return quadStore(quadExp2(_mm_mul_ps(quadLoad(v), _mm_set1_ps(1.44269504f))));
+#else
+	return glm::exp(v);
+#endif
+}
+
+//base^exponent for the non-negative base, pow(0, y) is 0 for y > 0 and 1 for y == 0 as glm::pow
+inline QuadFloat quadPow(const QuadFloat &base, const QuadFloat &exponent)
+{
+#ifdef SR_QUAD_SSE2
+	__m128 x = quadLoad(base), y = quadLoad(exponent);
+	__m128 ret = quadExp2(_mm_mul_ps(quadLog2(x), y));
+	ret = _mm_and_ps(ret, _mm_cmpgt_ps(x, _mm_setzero_ps()));
+	__m128 one = _mm_cmpeq_ps(y, _mm_setzero_ps());
+	return quadStore(_mm_or_ps(_mm_andnot_ps(one, ret), _mm_and_ps(one, _mm_set1_ps(1.0f))));
+#else
+	return glm::pow(base, exponent);
+#endif
+}
+
+inline QuadVec3 quadNormalize(const QuadVec3 &v) { return v * quadInverseSqrt(quadDot(v, v)); }
+
+inline QuadVec3 quadExp(const QuadVec3 &v) { return QuadVec3(quadExp(v.x), quadExp(v.y), quadExp(v.z)); }
+
+//Transform by a 3x3 matrix of each lane
+inline QuadVec3 quadTransform(const glm::mat3 mats[4], const QuadVec3 &v)
+{
+	QuadVec3 ret;
+	for (int i = 0; i < 4; ++i)
+	{
+		ret.setLane(i, mats[i] * v.lane(i));
+	}
+	return ret;
+}
+
+} // namespace sr
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+
+#include <glm/glm.hpp>
+
+namespace sr {
+
+//Real spherical harmonics up to band 2 (l = 0, 1, 2), i.e. 9 coefficients
+//Refs: Peter-Pike Sloan, Stupid Spherical Harmonics (SH) Tricks
+
+static constexpr int SH_BAND_NUM = 3;
+static constexpr int SH_COEFF_NUM = SH_BAND_NUM * SH_BAND_NUM;
+
+//Scalar transfer of a vertex, i.e. how the incident lighting of each basis is reflected
+typedef std::array<float, SH_COEFF_NUM> SHTransfer;
+//RGB incident lighting projected onto the basis
+typedef std::array<glm::vec3, SH_COEFF_NUM> SHLighting;
+
+//Basis functions evaluated at the unit direction
+inline void evalSHBasis(const glm::vec3 &dir, float basis[SH_COEFF_NUM])
+{
+	const float &x = dir.x, &y = dir.y, &z = dir.z;
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * y;
+	basis[2] = 0.488603f * z;
+	basis[3] = 0.488603f * x;
+	basis[4] = 1.092548f * x * y;
+	basis[5] = 1.092548f * y * z;
+	basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+	basis[7] = 1.092548f * x * z;
+	basis[8] = 0.546274f * (x * x - y * y);
+}
+
+//Unshadowed diffuse transfer of the normal, the clamped cosine lobe convolved analytically
+//Refs: Ramamoorthi and Hanrahan, An Efficient Representation for Irradiance Environment Maps
+inline void evalSHCosineTransfer(const glm::vec3 &normal, SHTransfer &transfer)
+{
+	//A_l / pi of each band
+	static const float bandScale[SH_BAND_NUM] = { 1.0f, 2.0f / 3.0f, 0.25f };
+	float basis[SH_COEFF_NUM];
+	evalSHBasis(normal, basis);
+	for (int i = 0; i < SH_COEFF_NUM; ++i)
+	{
+		transfer[i] = basis[i] * bandScale[i == 0 ? 0 : (i < 4 ? 1 : 2)];
+	}
+}
+
+//Exitant radiance = dot(transfer, lighting)
+inline glm::vec3 dotSH(const SHTransfer &transfer, const SHLighting &lighting)
+{
+	glm::vec3 result(0.0f);
+	for (int i = 0; i < SH_COEFF_NUM; ++i)
+	{
+		result += transfer[i] * lighting[i];
+	}
+	return result;
+}
+
+} // namespace sr
\ No newline at end of file
@@ -28,6 +28,7 @@ THE SOFTWARE.*/
 #include "math_utils.hpp"
 #include "shader.hpp"
 #include "scene.hpp"
+#include "texture_streaming.hpp"
 
 #include <iostream>
 
@@ -63,6 +64,9 @@ int main(int argc, char* args[]) {
 	//Blinn-Phong lighting
 	renderer->setShaderPipeline(std::make_shared<BlinnPhongShading>());
 
+	//Only the light cubes and the regions they lit change among frames
+	renderer->setIncrementalRendering(true);
+
 	PointLight::ptr redLight = std::dynamic_pointer_cast<PointLight>(renderer->getLightSource(parser.getLight("readLight")));
 	PointLight::ptr greenLight = std::dynamic_pointer_cast<PointLight>(renderer->getLightSource(parser.getLight("greenLight")));
 	PointLight::ptr blueLight = std::dynamic_pointer_cast<PointLight>(renderer->getLightSource(parser.getLight("blueLight")));
@@ -81,6 +85,11 @@ int main(int argc, char* args[]) {
 	Model::ptr greenLightMesh = parser.getEntity("GreenLight");
 	Model::ptr blueLightMesh = parser.getEntity("BlueLight");
 
+	//The light cubes move with their lights, they must not shadow their own lights
+	redLight->setProxyModel(redLightMesh.get());
+	greenLight->setProxyModel(greenLightMesh.get());
+	blueLight->setProxyModel(blueLightMesh.get());
+
 	const auto originMat = redLightMesh->getModelMatrix();
 
 	//Rendering loop
@@ -90,8 +99,13 @@ int main(int argc, char* args[]) {
 		winApp->processEvent();
 
 		//Clear frame buffer (both color buffer and depth buffer)
+		//Note: deferred by the incremental rendering, only the redrawn tiles are cleared
 		renderer->clearColorAndDepth(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), 0.0f);
 
+		//Streamed texture levels are installed and evicted between frames, no texture is sampled here
+		TextureStreaming::update();
+		Pipeline::collectReleasedTextures();
+
 		//Draw call
 		renderer->setViewerPos(cameraPos);
 		auto numTriangles = renderer->renderAllModels();
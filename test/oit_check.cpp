@@ -0,0 +1,66 @@
+//Check of the k-buffer overflow: k + 1 overlapping fragments should composite the same in any arriving order
+
+#include <cstdio>
+#include <cmath>
+
+#include "frame_buffer.hpp"
+
+using namespace sr;
+
+//Front-to-back compositing of the kept layers over black
+static glm::vec3 composite(const KBufferPixel &pixel)
+{
+	glm::vec3 color(0.0f);
+	float transmittance = 1.0f;
+	for (int i = 0; i < pixel.m_count; ++i)
+	{
+		const auto &frag = pixel.m_fragments[i];
+		color += glm::vec3(frag.m_color) * frag.m_color.a * transmittance;
+		transmittance *= 1.0f - frag.m_color.a;
+	}
+	return color;
+}
+
+int main()
+{
+	//Reversed depth: fragment 0 is the nearest
+	OITFragment frags[k_OITLayers + 1];
+	for (int i = 0; i <= k_OITLayers; ++i)
+	{
+		frags[i].m_depth = 1.0f - 0.1f * i;
+		frags[i].m_color = glm::vec4(i == 0 ? 1.0f : 0.0f, (float)i / k_OITLayers, i == k_OITLayers ? 1.0f : 0.0f, 0.5f);
+	}
+
+	KBufferPixel nearFirst, farFirst;
+	for (int i = 0; i <= k_OITLayers; ++i)
+	{
+		insertKBufferFragment(nearFirst, frags[i]);
+		insertKBufferFragment(farFirst, frags[k_OITLayers - i]);
+	}
+
+	//All the layers without merging
+	glm::vec3 expected(0.0f);
+	{
+		float transmittance = 1.0f;
+		for (int i = 0; i <= k_OITLayers; ++i)
+		{
+			expected += glm::vec3(frags[i].m_color) * frags[i].m_color.a * transmittance;
+			transmittance *= 1.0f - frags[i].m_color.a;
+		}
+	}
+
+	bool passed = nearFirst.m_count == k_OITLayers && farFirst.m_count == k_OITLayers;
+	for (int i = 0; passed && i < k_OITLayers; ++i)
+	{
+		passed = nearFirst.m_fragments[i].m_depth == farFirst.m_fragments[i].m_depth;
+	}
+	for (const auto *pixel : { &nearFirst, &farFirst })
+	{
+		glm::vec3 color = composite(*pixel);
+		for (int c = 0; c < 3; ++c)
+			passed = passed && std::fabs(color[c] - expected[c]) < 1e-4f;
+	}
+
+	std::printf("k-buffer overflow check %s\n", passed ? "passed" : "failed");
+	return passed ? 0 : 1;
+}